@@ -0,0 +1,21 @@
+
+#include "../client_src/client_headers.h"
+#include <pthread.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+
+
+#define LOAD_CONNECT_TIMEOUT 10										//seconds to wait for the server to start listening
+
+
+
+//session.c
+extern struct sockaddr_in serverAddr;
+extern char userRec[MAX_USER_REC_STR_LEN+1];
+
+void initSessions(char *ip, int port, char *username, char *password);
+int connectSession(char *token);
+char sendRequest(int sock, char *buff, char *resp);
+void sleepUntil(unsigned long ns);
+char *readWholeFile(char *filename, size_t *len);
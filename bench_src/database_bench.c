@@ -0,0 +1,628 @@
+
+/*
+ *  Microbenchmarks of the dynamic array functions of database.c.
+ *
+ *  Every operation is timed on its own, and counted in a latency histogram,
+ *  for every size of the dynamic array from BENCH_MIN_SIZE up to DYNARR_MAX_POSSIBLE_SIZE.
+ *  The results are printed one per line, as "key=value" pairs, so that two runs
+ *  can be compared line by line to catch regressions:
+ *
+ *    op=find_hit size=1024 ops=100000 ns_op=95.2 p50_ns=87 p90_ns=111 p99_ns=159 p999_ns=527 max_ns=10735
+ *
+ *  The growth of the array is timed apart, appending already allocated records up to DYNARR_MAX_POSSIBLE_SIZE,
+ *  and counting separately the appends done when the size is a power of 2 (where the array used to be doubled).
+ *
+ *  The block store of the read workers is timed against the dynamic array it's built from:
+ *  its searches, and its scans of BENCH_SCAN_LEN records from a random key (written as search responses).
+ *  Its memory is printed once for every size, with the one of the dynamic array
+ *  and the one of the arena layout of the shared segment, as "mem=" lines.
+ *  The writes copied in the shared segment are timed too, as "shared_write",
+ *  and the ones that start or complete a merge of its delta also as "shared_write_merge",
+ *  since they are the ones that rebuilt the whole base while holding the write lock.
+ *
+ *  The parsing of the record strings is timed against the previous implementation (the "legacy" ops),
+ *  for a short and a long record, whose length is printed as the size.
+ *
+ *  The keys are generated from a fixed seed, so every run executes the same operations.
+ *  (the files are created in a temporary folder, removed at the end)
+ */
+
+#include "../server_src/server_headers.h"
+
+
+#define BENCH_MIN_SIZE 1024
+#define BENCH_LOOKUPS 100000										//the searches timed for every size
+#define BENCH_OVERWRITES 50000
+#define BENCH_FILE_RUNS 5											//the exports, imports and recoveries timed for every size
+#define BENCH_WAL_RATIO 4											//the recovery replays size/BENCH_WAL_RATIO WAL records
+#define BENCH_PARSES 20000											//the batches of parses timed for every record
+#define BENCH_PARSE_BATCH 64										//the parses timed together, to leave out the cost of the timer
+#define BENCH_GROWTH_RUNS 64										//the times the dynamic array is grown from empty to DYNARR_MAX_POSSIBLE_SIZE
+#define BENCH_SCANS 2000
+#define BENCH_SCAN_LEN 100											//the records read by every scan
+#define BENCH_SHARED_WRITES 200000									//the overwrites copied in the shared segment, for every size
+
+
+//the globals of server.c, used by the database and WAL functions
+int sem;
+dArrS *mainDynArr = NULL;
+unsigned nReadWorkers = 0;
+int walDirect = 0;
+unsigned slowReqUs = 0;
+unsigned long lastLsn = 0;
+
+int stdoutFd;														//the real standard output, while the one of the database functions is muted
+unsigned long timerOverhead;
+
+
+
+void benchKey(unsigned long i, char *dest);
+unsigned long benchRand(unsigned long *state);
+void muteStdout(int mute);
+void benchReport(char *op, unsigned long size, histS *hist);
+void benchSize(unsigned long size, histS *hist);
+void benchBlockStore(dArrS *dynArr, unsigned long *rnd, histS *hist);
+void benchSharedDb(dArrS *dynArr, unsigned long *rnd, histS *hist);
+void benchParse(char *rec, histS *hist);
+void benchGrowth(histS *hist);
+int legacyCheckGenericString(char *str, const char *charset, size_t maxSize);
+int legacyCheckNumsString(char *nums);
+int legacyCheckRecordString(char *str);
+recS *legacyStringToRecord(char *str);
+
+
+
+int main(int argc, char **argv){
+	char dir[] = "/tmp/database_bench_XXXXXX";
+	histS *hist;
+	unsigned long start;
+
+	if(!mkdtemp(dir)) fatalError("mkdtemp() failed");
+	if(chdir(dir)==-1) fatalError("chdir() failed");
+	if(mkdir(RESOURCES_FOLDER, 0700)==-1) fatalError("mkdir() failed");
+	if(mkdir(WAL_FOLDER, 0700)==-1) fatalError("mkdir() failed");
+	if((stdoutFd = dup(STDOUT_FILENO))==-1) fatalError("dup() failed");
+	if(!(hist = malloc(sizeof(histS)))) fatalError("malloc() failed");
+	initLogRing();
+	initCrc32c();
+
+	start = getTimeNs();											//the cost of timing an empty operation, included in all the results
+	for(int i=0; i<BENCH_LOOKUPS; i++) getTimeNs();
+	timerOverhead = (getTimeNs() - start) / BENCH_LOOKUPS;
+	printf("timer_overhead_ns=%lu\n", timerOverhead);
+	fflush(stdout);
+
+	benchParse("Rossi Mario:3331234567,+390551234567", hist);
+	benchParse("Bianchi Giovanni Battista Maria de' Medici d'Altavilla Sforza Visconti Gonzaga Este Malatesta 01234:"
+		"+3933312345678,+3933312345679,+3933312345670,+3933312345671,+3933312345672,+3933312345673,+3933312345674,+3933312345675", hist);
+	for(unsigned long size=BENCH_MIN_SIZE; size<=DYNARR_MAX_POSSIBLE_SIZE; size<<=2) benchSize(size, hist);
+	benchGrowth(hist);
+
+	free(hist);
+	unlink(MAIN_DB_FILENAME);
+	rmdir(WAL_FOLDER);
+	rmdir(RESOURCES_FOLDER);
+	if(chdir("/")==-1 || rmdir(dir)==-1) fatalError("rmdir() failed");
+	return 0;
+}
+
+
+
+/*
+ *  Writes the i-th key of the benchmark, all the keys are different,
+ *  and their order doesn't depend on 'i'.
+ *
+ *    'i' = the index of the key.
+ *    'dest' = pointer to a buffer of at least MAX_NAME_LEN+1 chars.
+ */
+
+void benchKey(unsigned long i, char *dest){
+	sprintf(dest, "bench %016lx", i * 0x9E3779B97F4A7C15UL);		//multiplying by an odd constant is a bijection
+}
+
+
+
+/*
+ *  Returns the next number of a xorshift generator.
+ *
+ *    'state' = pointer to the state of the generator, not 0.
+ */
+
+unsigned long benchRand(unsigned long *state){
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+
+
+/*
+ *  Mutes or restores the standard output, so that the messages
+ *  of the import and the recovery don't mix with the results.
+ *
+ *    'mute' = 1 to mute, 0 to restore.
+ */
+
+void muteStdout(int mute){
+	int fd;
+	fflush(stdout);
+	if(mute){
+		if((fd = open("/dev/null", O_WRONLY))==-1) fatalError("open() failed");
+		if(dup2(fd, STDOUT_FILENO)==-1) fatalError("dup2() failed");
+		close(fd);
+	}
+	else if(dup2(stdoutFd, STDOUT_FILENO)==-1) fatalError("dup2() failed");
+}
+
+
+
+/*
+ *  Prints the results of an operation, and resets its histogram.
+ *
+ *    'op' = the name of the operation.
+ *    'size' = the size of the dynamic array.
+ *    'hist' = the latencies of the operation, in nanoseconds.
+ */
+
+void benchReport(char *op, unsigned long size, histS *hist){
+	unsigned long total = atomic_load(&hist->total);
+	printf("op=%s size=%lu ops=%lu ns_op=%.1f p50_ns=%lu p90_ns=%lu p99_ns=%lu p999_ns=%lu max_ns=%lu\n", op, size, total, total ? (double) atomic_load(&hist->sum) / total : 0.0,
+		histPercentile(hist, 50), histPercentile(hist, 90), histPercentile(hist, 99), histPercentile(hist, 99.9), atomic_load(&hist->max));
+	fflush(stdout);
+	memset(hist, 0, sizeof(histS));
+}
+
+
+
+/*
+ *  Times all the operations on a dynamic array of 'size' records.
+ *
+ *    'size' = the number of records.
+ *    'hist' = pointer to a histogram, used for all the operations.
+ */
+
+void benchSize(unsigned long size, histS *hist){
+	char key[MAX_NAME_LEN+1], rec[MAX_MAIN_REC_STR_LEN+1];
+	unsigned long rnd = 0x2545F4914F6CDD1DUL + size, index, start, added;
+	unsigned long *order;
+	dArrS *dynArr;
+	memset(hist, 0, sizeof(histS));
+
+	/* appends, with the keys already sorted */
+	dynArr = initDynArr(0);
+	for(unsigned long i=0; i<size; i++){
+		sprintf(rec, "bench %016lu:%lu", i, i);						//the decimal keys with the same length are sorted as the numbers
+		start = getTimeNs();
+		if(addRecToDynArr(stringToRecord(rec), dynArr)) fatalError("addRecToDynArr() failed");
+		histRecord(hist, getTimeNs() - start);
+	}
+	benchReport("add_append", size, hist);
+	delDynArr(dynArr);
+
+	/* inserts in random positions, timed only in the second half, when the array is near 'size' */
+	if(!(order = malloc(size * sizeof(unsigned long)))) fatalError("malloc() failed");
+	for(unsigned long i=0; i<size; i++) order[i] = i;
+	for(unsigned long i=size-1; i>0; i--){							//shuffles the insertion order
+		unsigned long j = benchRand(&rnd) % (i+1), tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+	dynArr = initDynArr(0);
+	for(unsigned long i=0; i<size; i++){
+		benchKey(order[i], key);
+		sprintf(rec, "%s:%lu", key, order[i]);
+		start = getTimeNs();
+		if(addRecToDynArr(stringToRecord(rec), dynArr)) fatalError("addRecToDynArr() failed");
+		if(i>=size/2) histRecord(hist, getTimeNs() - start);
+	}
+	benchReport("add_random", size, hist);
+
+	/* overwrites of existing records */
+	for(unsigned long i=0; i<BENCH_OVERWRITES; i++){
+		index = benchRand(&rnd) % size;
+		benchKey(index, key);
+		sprintf(rec, "%s:%lu", key, i);
+		start = getTimeNs();
+		if(addRecToDynArr(stringToRecord(rec), dynArr)) fatalError("addRecToDynArr() failed");
+		histRecord(hist, getTimeNs() - start);
+	}
+	benchReport("add_overwrite", size, hist);
+
+	/* searches of existing and missing keys */
+	for(unsigned long i=0; i<BENCH_LOOKUPS; i++){
+		benchKey(benchRand(&rnd) % size, key);
+		start = getTimeNs();
+		if(!findIndexFromKey(key, dynArr, &index)) fatalError("findIndexFromKey() failed");
+		histRecord(hist, getTimeNs() - start);
+	}
+	benchReport("find_hit", size, hist);
+	for(unsigned long i=0; i<BENCH_LOOKUPS; i++){
+		benchKey(size + benchRand(&rnd) % size, key);
+		start = getTimeNs();
+		if(findIndexFromKey(key, dynArr, &index)) fatalError("findIndexFromKey() failed");
+		histRecord(hist, getTimeNs() - start);
+	}
+	benchReport("find_miss", size, hist);
+	benchBlockStore(dynArr, &rnd, hist);
+	benchSharedDb(dynArr, &rnd, hist);
+
+	/* exports and imports of the whole array */
+	for(int i=0; i<BENCH_FILE_RUNS; i++){
+		start = getTimeNs();
+		exportDynArr(dynArr, MAIN_DB_FILENAME);
+		histRecord(hist, getTimeNs() - start);
+	}
+	benchReport("export", size, hist);
+	muteStdout(1);
+	for(int i=0; i<BENCH_FILE_RUNS; i++){
+		start = getTimeNs();
+		dArrS *imported = importDynArr(MAIN_DB_FILENAME, MAIN_TYPE);
+		histRecord(hist, getTimeNs() - start);
+		if(imported->size!=size) fatalError("importDynArr() failed");
+		delDynArr(imported);
+	}
+	muteStdout(0);
+	benchReport("import", size, hist);
+
+	/* recoveries, from the export plus a WAL of size/BENCH_WAL_RATIO additions (overwrites, if the array is already at its maximum size) */
+	added = size + size/BENCH_WAL_RATIO <= DYNARR_MAX_POSSIBLE_SIZE ? size/BENCH_WAL_RATIO : 0;
+	nWalSegs = listWalSegments(&walSegs);
+	openWalSegment(1);
+	for(unsigned long i=0; i<size/BENCH_WAL_RATIO; i++){
+		benchKey(added ? size + i : order[i], key);
+		sprintf(rec, "%s:%lu", key, i);
+		appendWalRecord(i+1, WAL_ADD_OP, rec, strlen(rec));
+	}
+	flushWal();
+	if(close(walFd)==-1) fatalError("close() failed");
+	walFd = -1;
+	free(walSegs);
+	walSegs = NULL;
+	nWalSegs = 0;
+	muteStdout(1);
+	for(int i=0; i<BENCH_FILE_RUNS; i++){
+		initFeed(0);
+		start = getTimeNs();
+		dArrS *recovered = recoverMainDynArr(0);
+		histRecord(hist, getTimeNs() - start);
+		if(recovered->size!=size + added) fatalError("recoverMainDynArr() failed");
+		delDynArr(recovered);
+	}
+	muteStdout(0);
+	benchReport("recover", size, hist);
+	removeWal();
+
+	/* removals of random records, until half of the array is left */
+	for(unsigned long i=0; i<size/2; i++){
+		benchKey(order[i], key);
+		start = getTimeNs();
+		if(removeRecFromDynArr(key, dynArr)) fatalError("removeRecFromDynArr() failed");
+		histRecord(hist, getTimeNs() - start);
+	}
+	benchReport("remove", size, hist);
+
+	/* compaction of the half left, timing every batch (the time the write lock would be held) */
+	key[0] = '\0';
+	do{
+		start = getTimeNs();
+		index = compactDynArr(dynArr, key, DYNARR_COMPACT_BATCH);
+		histRecord(hist, getTimeNs() - start);
+	}while(!index);
+	benchReport("compact_batch", size, hist);
+
+	delDynArr(dynArr);
+	free(order);
+}
+
+
+
+/*
+ *  Times the builds, searches and scans of a block store of all the records of a dynamic array,
+ *  the scans also on the dynamic array, and prints the memory used by both.
+ *
+ *    'dynArr' = pointer to the dynamic array, with the keys of benchKey() from 0 to its size.
+ *    'rnd' = pointer to the state of the generator of the keys searched.
+ *    'hist' = pointer to a histogram, used for all the operations.
+ */
+
+void benchBlockStore(dArrS *dynArr, unsigned long *rnd, histS *hist){
+	char key[MAX_NAME_LEN+1], resp[BUFF_SIZE];
+	unsigned long size = dynArr->size, index, start;
+	size_t arrBytes, recBytes, sharedBytes = 0, storeBytes;
+	blockStoreS *store;
+	blockIterS it;
+
+	if(!(store = malloc(BLOCK_STORE_SIZE))) fatalError("malloc() failed");
+	for(int i=0; i<BENCH_FILE_RUNS; i++){
+		start = getTimeNs();
+		buildBlockStore(store, dynArr);
+		histRecord(hist, getTimeNs() - start);
+	}
+	benchReport("block_build", size, hist);
+
+	for(unsigned long i=0; i<BENCH_LOOKUPS; i++){
+		benchKey(benchRand(rnd) % size, key);
+		start = getTimeNs();
+		if(!searchBlockStore(store, key, resp)) fatalError("searchBlockStore() failed");
+		histRecord(hist, getTimeNs() - start);
+	}
+	benchReport("block_find_hit", size, hist);
+	for(unsigned long i=0; i<BENCH_LOOKUPS; i++){
+		benchKey(size + benchRand(rnd) % size, key);
+		start = getTimeNs();
+		if(searchBlockStore(store, key, resp)) fatalError("searchBlockStore() failed");
+		histRecord(hist, getTimeNs() - start);
+	}
+	benchReport("block_find_miss", size, hist);
+
+	/* scans, writing the response of every record, as a range request would */
+	for(unsigned long i=0; i<BENCH_SCANS; i++){
+		benchKey(benchRand(rnd) % size, key);
+		start = getTimeNs();
+		findIndexFromKey(key, dynArr, &index);
+		for(unsigned long j=index; j<index+BENCH_SCAN_LEN && j<size; j++) memcpy(resp, dynArrRec(dynArr, j)->resp, dynArrRec(dynArr, j)->respLen + 1);
+		histRecord(hist, getTimeNs() - start);
+	}
+	benchReport("scan", size, hist);
+	for(unsigned long i=0; i<BENCH_SCANS; i++){
+		benchKey(benchRand(rnd) % size, key);
+		start = getTimeNs();
+		seekBlockStore(store, key, &it);
+		for(unsigned long j=0; j<BENCH_SCAN_LEN && readBlockIter(&it); j++){
+			blockIterToResp(&it, resp);
+			advanceBlockIter(&it);
+		}
+		histRecord(hist, getTimeNs() - start);
+	}
+	benchReport("block_scan", size, hist);
+
+	/* the memory of the three layouts, the arena one with its index */
+	arrBytes = getDynArrMemory(dynArr, &recBytes);
+	for(unsigned long i=0; i<size; i++) sharedBytes += sharedRecSize(dynArrRec(dynArr, i)->respLen) + sizeof(unsigned long);
+	storeBytes = blockStoreBytes(store);
+	printf("mem=dynarr size=%lu bytes=%zu bytes_rec=%.1f\n", size, arrBytes + recBytes, (double) (arrBytes + recBytes) / size);
+	printf("mem=shared_arena size=%lu bytes=%zu bytes_rec=%.1f\n", size, sharedBytes, (double) sharedBytes / size);
+	printf("mem=block_store size=%lu bytes=%zu bytes_rec=%.1f\n", size, storeBytes, (double) storeBytes / size);
+	fflush(stdout);
+	free(store);
+}
+
+
+
+/*
+ *  Times the overwrites of random records of a dynamic array, each one copied in the shared segment
+ *  as the server does, while holding the write lock. All of them are reported as "shared_write",
+ *  and the ones that start or complete a merge of the delta also as "shared_write_merge",
+ *  since a spike there is hidden by the others in the percentiles.
+ *
+ *    'dynArr' = pointer to the dynamic array, with the keys of benchKey() from 0 to its size.
+ *    'rnd' = pointer to the state of the generator of the keys overwritten.
+ *    'hist' = pointer to a histogram, used for all the writes.
+ */
+
+void benchSharedDb(dArrS *dynArr, unsigned long *rnd, histS *hist){
+	char key[MAX_NAME_LEN+1], rec[MAX_MAIN_REC_STR_LEN+1];
+	unsigned long size = dynArr->size, start, ns, compactions;
+	int merging;
+	histS *merges;
+	recS *r;
+	if(!(merges = calloc(1, sizeof(histS)))) fatalError("calloc() failed");
+
+	mainDynArr = dynArr;
+	initSharedDb(dynArr);
+	for(unsigned long i=0; i<BENCH_SHARED_WRITES; i++){
+		benchKey(benchRand(rnd) % size, key);
+		sprintf(rec, "%s:%lu", key, i);
+		r = stringToRecord(rec);
+		r->version = i + 1;
+		merging = sharedDb->merging;
+		compactions = sharedDb->compactions;
+		start = getTimeNs();
+		if(addRecToDynArr(r, dynArr)) fatalError("addRecToDynArr() failed");
+		syncSharedRec(rec);
+		ns = getTimeNs() - start;
+		histRecord(hist, ns);
+		if(sharedDb->merging!=merging || sharedDb->compactions!=compactions) histRecord(merges, ns);
+	}
+	benchReport("shared_write", size, hist);
+	benchReport("shared_write_merge", size, merges);
+
+	if(munmap(sharedDb, SHARED_DB_SIZE)==-1) fatalError("munmap() failed");
+	sharedDb = NULL;
+	mainDynArr = NULL;
+	free(merges);
+}
+
+
+
+/*
+ *  Times the appends to a dynamic array growing from empty to DYNARR_MAX_POSSIBLE_SIZE records,
+ *  with the records already allocated, so that only the work of the array is timed.
+ *  All the appends are reported as "add_growth", and the ones done at a power of 2 size
+ *  also as "add_growth_boundary", since a spike there is hidden by the others in the percentiles.
+ *
+ *    'hist' = pointer to a histogram, used for all the appends.
+ */
+
+void benchGrowth(histS *hist){
+	char rec[MAX_MAIN_REC_STR_LEN+1];
+	unsigned long size = DYNARR_MAX_POSSIBLE_SIZE, start, ns;
+	histS *boundary;
+	recS **recs;
+	dArrS *dynArr;
+	if(!(boundary = calloc(1, sizeof(histS)))) fatalError("calloc() failed");
+	if(!(recs = malloc(size * sizeof(recS *)))) fatalError("malloc() failed");
+	memset(hist, 0, sizeof(histS));
+
+	for(int run=0; run<BENCH_GROWTH_RUNS; run++){
+		for(unsigned long i=0; i<size; i++){
+			sprintf(rec, "bench %016lu:%lu", i, i);
+			recs[i] = stringToRecord(rec);
+		}
+		dynArr = initDynArr(0);
+		for(unsigned long i=0; i<size; i++){
+			start = getTimeNs();
+			if(addRecToDynArr(recs[i], dynArr)) fatalError("addRecToDynArr() failed");
+			ns = getTimeNs() - start;
+			histRecord(hist, ns);
+			if(!(i & (i-1))) histRecord(boundary, ns);
+		}
+		delDynArr(dynArr);
+	}
+	benchReport("add_growth", size, hist);
+	benchReport("add_growth_boundary", size, boundary);
+
+	free(recs);
+	free(boundary);
+}
+
+
+
+/*
+ *  Times the validation, and the validation plus the conversion to a record, of a main-record string,
+ *  with the current functions and with the previous ones.
+ *
+ *    'rec' = a valid main-record string.
+ *    'hist' = pointer to a histogram, used for all the operations.
+ */
+
+void benchParse(char *rec, histS *hist){
+	char str[MAX_MAIN_REC_STR_LEN+1];
+	unsigned long start, size = strlen(rec);
+	recSliceS slice;
+	recS *recs[BENCH_PARSE_BATCH];
+	if(size>MAX_MAIN_REC_STR_LEN) fatalError("invalid benchmark record");
+	strcpy(str, rec);
+	memset(hist, 0, sizeof(histS));
+
+	for(int i=0; i<BENCH_PARSES; i++){
+		start = getTimeNs();
+		for(int j=0; j<BENCH_PARSE_BATCH; j++) if(legacyCheckRecordString(str)) fatalError("legacyCheckRecordString() failed");
+		histRecord(hist, (getTimeNs() - start) / BENCH_PARSE_BATCH);
+	}
+	benchReport("check_legacy", size, hist);
+	for(int i=0; i<BENCH_PARSES; i++){
+		start = getTimeNs();
+		for(int j=0; j<BENCH_PARSE_BATCH; j++) if(checkRecordString(str, MAIN_TYPE)) fatalError("checkRecordString() failed");
+		histRecord(hist, (getTimeNs() - start) / BENCH_PARSE_BATCH);
+	}
+	benchReport("check", size, hist);
+
+	for(int i=0; i<BENCH_PARSES; i++){
+		start = getTimeNs();
+		for(int j=0; j<BENCH_PARSE_BATCH; j++){
+			if(legacyCheckRecordString(str)) fatalError("legacyCheckRecordString() failed");
+			recs[j] = legacyStringToRecord(str);
+		}
+		histRecord(hist, (getTimeNs() - start) / BENCH_PARSE_BATCH);
+		for(int j=0; j<BENCH_PARSE_BATCH; j++) delRecord(recs[j]);
+	}
+	benchReport("parse_legacy", size, hist);
+	for(int i=0; i<BENCH_PARSES; i++){
+		start = getTimeNs();
+		for(int j=0; j<BENCH_PARSE_BATCH; j++){
+			if(parseRecordString(str, MAIN_TYPE, &slice)) fatalError("parseRecordString() failed");
+			recs[j] = sliceToRecord(&slice);
+		}
+		histRecord(hist, (getTimeNs() - start) / BENCH_PARSE_BATCH);
+		for(int j=0; j<BENCH_PARSE_BATCH; j++) delRecord(recs[j]);
+	}
+	benchReport("parse", size, hist);
+}
+
+
+
+/*
+ *  The previous implementation of checkGenericString(), the baseline of the parsing benchmark.
+ *  (a linear search of the charset for every non-alphanumeric character)
+ */
+
+int legacyCheckGenericString(char *str, const char *charset, size_t maxSize){
+	size_t l = strlen(str);
+	if(!l || l>maxSize) return 1;
+
+	char *p;
+	for(size_t i=0; i<l; i++){
+		if(!isalnum(str[i])){
+			p = (char *) charset;
+			while(*p!='\0' && str[i]!=*p) p++;
+			if(*p=='\0') return 1;
+		}
+	}
+	return 0;
+}
+
+
+
+/*
+ *  The previous implementation of checkNumsString(), that splits the numbers in place.
+ */
+
+int legacyCheckNumsString(char *nums){
+	size_t l = strlen(nums);
+	if(!l) return 0;
+	if(l>MAX_NUMS_LEN) return 1;
+
+	size_t numLen;
+	char *p1;
+	char *p2 = nums;
+	for(int i=0; i<MAX_N_NUMS; i++){
+		p1 = p2;
+		while(*p2!='\0' && *p2!=SINGLE_NUM_SEPARATOR) p2++;
+		numLen = p2 - p1;
+		if(!numLen || numLen>MAX_NUM_LEN) return 1;
+		for(size_t j=0; j<numLen; j++) if(!isdigit(p1[j]) && p1[j]!='+') return 1;
+		if(*p2++=='\0') return 0;
+	}
+	return 1;
+}
+
+
+
+/*
+ *  The previous implementation of checkRecordString(), for the main-records:
+ *  finds the separator, and then checks the two substrings, terminating the name in place.
+ */
+
+int legacyCheckRecordString(char *str){
+	size_t l = strlen(str);
+	if(!l || l>MAX_MAIN_REC_STR_LEN) return 1;
+
+	int res;
+	char *p = str;
+	while(*p!='\0' && *p!=KEY_VALUE_SEPARATOR) p++;
+	if(*p=='\0') return 1;
+	*p = '\0';
+	res = legacyCheckGenericString(str, NAME_CHARSET, MAX_NAME_LEN);
+	*p++ = KEY_VALUE_SEPARATOR;
+	return res || legacyCheckNumsString(p);
+}
+
+
+
+/*
+ *  The previous implementation of stringToRecord(), that measures and copies the key and the value with strlen() and strcpy().
+ */
+
+recS *legacyStringToRecord(char *str){
+	char *p = str;
+	while(*p!=KEY_VALUE_SEPARATOR && *p!='\0') p++;
+
+	size_t keyLen, valueLen;
+	*p = '\0';
+	keyLen = p - str;
+	valueLen = strlen(p+1);
+
+	char *key = malloc((keyLen + 1) * sizeof(char));
+	if(!key) fatalError("malloc() failed");
+	strcpy(key, str);
+	*p = KEY_VALUE_SEPARATOR;
+
+	char *value = NULL;
+	if(valueLen){
+		if(!(value = malloc((valueLen + 1) * sizeof(char)))) fatalError("malloc() failed");
+		strcpy(value, p+1);
+	}
+	return initRecord(key, value);
+}
@@ -0,0 +1,443 @@
+
+/*
+ *  Synthetic dataset generator, for benchmarking the import, the recovery and the lookups.
+ *
+ *  Writes in a folder the main_db.txt, priv_user_db.txt and norm_user_db.txt files,
+ *  in the same format of the ones of the server resources folder,
+ *  and optionally a query trace for the load generator (loadgen -f).
+ *  All the output depends only on the options and on the seed, so the same fixtures can be rebuilt anywhere.
+ *
+ *  The names are made of a surname, a first name and sometimes a middle name,
+ *  each picked with a Zipf distribution over a list of common names, so that
+ *  some surnames are very frequent, like in a real phone book.
+ *  The homonyms get a number at the end, to keep the keys unique. ("Rossi Mario 2")
+ *  Every record has from 0 to MAX_N_NUMS numbers, most of them one or two.
+ *
+ *  The query trace has one request per line, as "'type''data'",
+ *  with the keys picked with a Zipf distribution over all the names, in a random order of popularity.
+ */
+
+#include "../client_src/client_headers.h"
+#include <math.h>
+
+
+#define GEN_DEFAULT_RECORDS 100000
+#define GEN_DEFAULT_USERS 100
+#define GEN_DEFAULT_ZIPF 0.99										//the skew of the query trace
+#define GEN_DEFAULT_SEED 1
+#define GEN_DEFAULT_PASSWORD "password"
+#define GEN_NAMES_ZIPF 0.6											//the skew of the surnames and first names
+#define GEN_MIDDLE_NAME_PERCENT 25
+#define GEN_MISS_PERCENT 5											//the searches of the trace for names that don't exist
+#define GEN_MAIN_DB_FILENAME "main_db.txt"
+#define GEN_PRIV_USERS_DB_FILENAME "priv_user_db.txt"
+#define GEN_NORM_USERS_DB_FILENAME "norm_user_db.txt"
+#define GEN_TRACE_FILENAME "trace.txt"
+
+
+char *surnames[] = {"Rossi", "Russo", "Ferrari", "Esposito", "Bianchi", "Romano", "Colombo", "Ricci", "Marino", "Greco", "Bruno", "Gallo", "Conti", "De Luca", "Mancini",
+	"Costa", "Giordano", "Rizzo", "Lombardi", "Moretti", "Barbieri", "Fontana", "Santoro", "Mariani", "Rinaldi", "Caruso", "Ferrara", "Galli", "Martini", "Leone",
+	"Longo", "Gentile", "Martinelli", "Vitale", "Lombardo", "Serra", "Coppola", "De Santis", "D'Angelo", "Marchetti", "Parisi", "Villa", "Conte", "Ferraro", "Ferri",
+	"Fabbri", "Bianco", "Marini", "Grasso", "Valentini", "Messina", "Sala", "De Angelis", "Gatti", "Pellegrini", "Palumbo", "Sanna", "Farina", "Rizzi", "Monti",
+	"Cattaneo", "Morelli", "Amato", "Silvestri", "Mazza", "Testa", "Grassi", "Pellegrino", "Carbone", "Giuliani", "Benedetti", "Barone", "Rossetti", "Caputo", "Montanari",
+	"Guerra", "Palmieri", "Bernardi", "Martino", "Fiore", "De Rosa", "Ferretti", "Bellini", "Basile", "Riva", "Donati", "Piras", "Vitali", "Battaglia", "Sartori",
+	"Neri", "Costantini", "Milani", "Pagano", "Ruggiero", "Sorrentino", "D'Amico", "Orlando", "Damico", "Negri", "Dell'Acqua", "Lo Russo", "Di Stefano", "Fumagalli", "Cocco"};
+char *firstNames[] = {"Giuseppe", "Maria", "Giovanni", "Anna", "Antonio", "Giuseppina", "Mario", "Rosa", "Luigi", "Angela", "Francesco", "Giovanna", "Angelo", "Teresa", "Vincenzo",
+	"Lucia", "Pietro", "Carmela", "Salvatore", "Caterina", "Carlo", "Francesca", "Franco", "Anna Maria", "Domenico", "Antonietta", "Bruno", "Carla", "Paolo", "Elena",
+	"Michele", "Concetta", "Giorgio", "Rita", "Aldo", "Margherita", "Sergio", "Franca", "Luciano", "Paola", "Marco", "Laura", "Alessandro", "Giulia", "Andrea",
+	"Chiara", "Luca", "Sara", "Matteo", "Francesca Maria", "Lorenzo", "Alessia", "Davide", "Martina", "Simone", "Valentina", "Stefano", "Federica", "Roberto", "Silvia",
+	"Massimo", "Elisa", "Fabio", "Roberta", "Riccardo", "Monica", "Emanuele", "Cristina", "Daniele", "Alice", "Federico", "Sofia", "Gabriele", "Aurora", "Tommaso",
+	"Ginevra", "Leonardo", "Beatrice", "Edoardo", "Greta", "Nicola", "Ilaria", "Enrico", "Claudia", "Claudio", "Barbara", "Raffaele", "Daniela", "Alberto", "Patrizia",
+	"Filippo", "Simona", "Giacomo", "Emma", "Pasquale", "Noemi", "Gianluca", "Irene", "Dario", "Arianna", "Mattia", "Camilla", "Diego", "Viola", "Ettore"};
+#define N_SURNAMES ( sizeof(surnames) / sizeof(surnames[0]) )
+#define N_FIRST_NAMES ( sizeof(firstNames) / sizeof(firstNames[0]) )
+
+
+typedef struct homonymsStruct{
+	unsigned long hash;												//the hash of the name without the number, 0 for a free slot
+	unsigned long count;
+} homonymsS;
+
+
+unsigned long genRnd;												//the state of the generator, set from the seed
+
+
+
+unsigned long genRand(void);
+double genUniform(void);
+double *zipfCdf(unsigned long n, double s);
+unsigned long zipfPick(double *cdf, unsigned long n);
+unsigned long hashName(char *name);
+unsigned long countHomonym(homonymsS *table, unsigned long size, char *name);
+void genName(char *dest, double *surnameCdf, double *firstNameCdf, homonymsS *table, unsigned long tableSize);
+void genNums(char *dest);
+void genUsername(char *dest, homonymsS *table, unsigned long tableSize);
+int compareNames(const void *a, const void *b);
+FILE *openGenFile(char *dir, char *filename);
+void parseGenCmdLine(int argc, char **argv, char **dir, unsigned long *nRecords, unsigned long *nPrivUsers, unsigned long *nNormUsers, unsigned long *nQueries,
+	unsigned *mix, double *zipf, unsigned long *seed, char **password, int *shuffle);
+
+
+
+int main(int argc, char **argv){
+	char *dir = ".";
+	char *password = GEN_DEFAULT_PASSWORD;
+	unsigned long nRecords = GEN_DEFAULT_RECORDS, nPrivUsers = GEN_DEFAULT_USERS, nNormUsers = GEN_DEFAULT_USERS, nQueries = 0, seed = GEN_DEFAULT_SEED;
+	unsigned mix[3] = {90, 5, 5};									//percentages of searches, additions and removals of the trace
+	double zipf = GEN_DEFAULT_ZIPF;
+	int shuffle = 0;
+	parseGenCmdLine(argc, argv, &dir, &nRecords, &nPrivUsers, &nNormUsers, &nQueries, mix, &zipf, &seed, &password, &shuffle);
+	genRnd = seed * 0x9E3779B97F4A7C15UL + 0x2545F4914F6CDD1DUL;
+
+	char buff[MAX_REC_STR_LEN+2];
+	char hashStr[HASH_LEN+1];
+	char **names;
+	char *p;
+	FILE *f;
+
+	/* the names, generated in a random order and then sorted like an export of the server */
+	unsigned long tableSize = 1;
+	while(tableSize < 2 * (nRecords + nPrivUsers + nNormUsers)) tableSize <<= 1;
+	homonymsS *table = calloc(tableSize, sizeof(homonymsS));
+	double *surnameCdf = zipfCdf(N_SURNAMES, GEN_NAMES_ZIPF);
+	double *firstNameCdf = zipfCdf(N_FIRST_NAMES, GEN_NAMES_ZIPF);
+	if(!table || !(names = malloc(nRecords * sizeof(char *)))) error("malloc() failed");
+	for(unsigned long i=0; i<nRecords; i++){
+		genName(buff, surnameCdf, firstNameCdf, table, tableSize);
+		if(!(names[i] = strdup(buff))) error("strdup() failed");
+	}
+	if(!shuffle) qsort(names, nRecords, sizeof(char *), compareNames);
+
+	f = openGenFile(dir, GEN_MAIN_DB_FILENAME);
+	for(unsigned long i=0; i<nRecords; i++){
+		p = buff + sprintf(buff, "%s%c", names[i], KEY_VALUE_SEPARATOR);
+		genNums(p);
+		if(checkRecordString(buff, MAIN_TYPE)) fatalError("generated an invalid main record");
+		fprintf(f, "%s\n", buff);
+	}
+	if(fclose(f)) error("fclose() failed");
+
+	/* the users, all with the same password, so that it's hashed only once */
+	hash(password, hashStr);
+	memset(table, 0, tableSize * sizeof(homonymsS));
+	for(int type=0; type<2; type++){
+		f = openGenFile(dir, type ? GEN_NORM_USERS_DB_FILENAME : GEN_PRIV_USERS_DB_FILENAME);
+		for(unsigned long i=0; i<(type ? nNormUsers : nPrivUsers); i++){
+			genUsername(buff, table, tableSize);
+			sprintf(buff + strlen(buff), "%c%s", KEY_VALUE_SEPARATOR, hashStr);
+			if(checkRecordString(buff, USER_TYPE)) fatalError("generated an invalid user record");
+			fprintf(f, "%s\n", buff);
+		}
+		if(fclose(f)) error("fclose() failed");
+	}
+
+	/* the query trace, the popularity of the names doesn't depend on their alphabetical order */
+	if(nQueries && nRecords){
+		unsigned long *byRank, j, tmp, rank;
+		double *keyCdf = zipfCdf(nRecords, zipf);
+		if(!(byRank = malloc(nRecords * sizeof(unsigned long)))) error("malloc() failed");
+		for(unsigned long i=0; i<nRecords; i++) byRank[i] = i;
+		for(unsigned long i=nRecords-1; i>0; i--){
+			j = genRand() % (i+1);
+			tmp = byRank[i];
+			byRank[i] = byRank[j];
+			byRank[j] = tmp;
+		}
+
+		f = openGenFile(dir, GEN_TRACE_FILENAME);
+		for(unsigned long i=0; i<nQueries; i++){
+			rank = zipfPick(keyCdf, nRecords);
+			unsigned dice = genRand() % 100;
+			if(dice<mix[0]){
+				if(genRand() % 100 < GEN_MISS_PERCENT) fprintf(f, "%c%s Zz\n", SEARCH_REQ, names[byRank[rank]]); //a name that doesn't exist
+				else fprintf(f, "%c%s\n", SEARCH_REQ, names[byRank[rank]]);
+			}
+			else if(dice<mix[0]+mix[1]){
+				genNums(buff);
+				fprintf(f, "%c%s%c%s\n", ADD_REQ, names[byRank[rank]], KEY_VALUE_SEPARATOR, buff);
+			}
+			else fprintf(f, "%c%s\n", DEL_REQ, names[byRank[rank]]);
+		}
+		if(fclose(f)) error("fclose() failed");
+		free(byRank);
+		free(keyCdf);
+	}
+
+	printf("Generated %lu main records, %lu privileged users and %lu normal users (password '%s'), and %lu queries, in '%s'.\n", nRecords, nPrivUsers, nNormUsers, password, nQueries, dir);
+	for(unsigned long i=0; i<nRecords; i++) free(names[i]);
+	free(names);
+	free(table);
+	free(surnameCdf);
+	free(firstNameCdf);
+	exit(0);
+}
+
+
+
+/*
+ *  Returns the next number of a xorshift generator.
+ */
+
+unsigned long genRand(void){
+	genRnd ^= genRnd << 13;
+	genRnd ^= genRnd >> 7;
+	genRnd ^= genRnd << 17;
+	return genRnd;
+}
+
+
+
+/*
+ *  Returns a random number in [0, 1).
+ */
+
+double genUniform(void){
+	return (genRand() >> 11) * (1.0 / (1UL << 53));
+}
+
+
+
+/*
+ *  Builds the cumulative distribution of a Zipf distribution,
+ *  where the item of rank 'i' has a probability proportional to 1/(i+1)^s.
+ *
+ *    'n' = the number of items.
+ *    's' = the skew, 0 for a uniform distribution.
+ *
+ *    returns a newly allocated array of 'n' probabilities, the last one is 1.
+ */
+
+double *zipfCdf(unsigned long n, double s){
+	double *cdf, sum = 0;
+	if(!(cdf = malloc(n * sizeof(double)))) error("malloc() failed");
+	for(unsigned long i=0; i<n; i++) cdf[i] = sum += pow(i+1, -s);
+	for(unsigned long i=0; i<n; i++) cdf[i] /= sum;
+	cdf[n-1] = 1;
+	return cdf;
+}
+
+
+
+/*
+ *  Returns the rank of an item, picked with a distribution.
+ *
+ *    'cdf' = the cumulative distribution, returned by zipfCdf().
+ *    'n' = the number of items.
+ */
+
+unsigned long zipfPick(double *cdf, unsigned long n){
+	double u = genUniform();
+	unsigned long low = 0, high = n - 1, half;
+	while(low<high){												//the first item with a cumulative probability greater than 'u'
+		half = (low + high) / 2;
+		if(cdf[half]>u) high = half;
+		else low = half + 1;
+	}
+	return low;
+}
+
+
+
+/*
+ *  Returns a 64 bit FNV-1a hash of a string, never 0.
+ *
+ *    'name' = the string.
+ */
+
+unsigned long hashName(char *name){
+	unsigned long h = 0xCBF29CE484222325UL;
+	for(; *name!='\0'; name++) h = (h ^ (unsigned char) *name) * 0x100000001B3UL;
+	return h ? h : 1;
+}
+
+
+
+/*
+ *  Counts a name in a table of the names already generated.
+ *
+ *    'table' = open addressing hash table.
+ *    'size' = the number of slots of the table, a power of 2 greater than the names to generate.
+ *    'name' = the name, without the homonyms number.
+ *
+ *    returns how many times the name has been generated, including this one.
+ */
+
+unsigned long countHomonym(homonymsS *table, unsigned long size, char *name){
+	unsigned long h = hashName(name), i = h & (size-1);
+	while(table[i].hash && table[i].hash!=h) i = (i+1) & (size-1);
+	table[i].hash = h;
+	return ++table[i].count;
+}
+
+
+
+/*
+ *  Generates a unique name: "'surname' 'first name'", sometimes followed by a middle name,
+ *  and by a number from the second homonym on.
+ *
+ *    'dest' = pointer to a buffer of at least MAX_NAME_LEN+1 chars.
+ *    'surnameCdf' = the distribution of the surnames.
+ *    'firstNameCdf' = the distribution of the first and middle names.
+ *    'table' = the table of the names already generated.
+ *    'tableSize' = the number of slots of the table.
+ */
+
+void genName(char *dest, double *surnameCdf, double *firstNameCdf, homonymsS *table, unsigned long tableSize){
+	int l = sprintf(dest, "%s %s", surnames[zipfPick(surnameCdf, N_SURNAMES)], firstNames[zipfPick(firstNameCdf, N_FIRST_NAMES)]);
+	if(genRand() % 100 < GEN_MIDDLE_NAME_PERCENT) l += sprintf(dest+l, " %s", firstNames[zipfPick(firstNameCdf, N_FIRST_NAMES)]);
+	unsigned long n = countHomonym(table, tableSize, dest);
+	if(n>1) sprintf(dest+l, " %lu", n);
+	formatNameString(dest);
+}
+
+
+
+/*
+ *  Generates the numbers of a record: mobile numbers with the international prefix,
+ *  landline numbers and internal extensions.
+ *  Half of the records have one number, and every other number is less likely than the previous one.
+ *
+ *    'dest' = pointer to a buffer of at least MAX_NUMS_LEN+1 chars.
+ */
+
+void genNums(char *dest){
+	int n = 0;
+	while(n<MAX_N_NUMS && genRand() % 100 < (n ? 40 : 95)) n++;		//5% of the records don't have numbers
+	*dest = '\0';
+	for(int i=0; i<n; i++){
+		if(i) *dest++ = SINGLE_NUM_SEPARATOR;
+		switch(genRand() % 3){
+			case 0:
+				dest += sprintf(dest, "+393%09lu", genRand() % 1000000000);
+				break;
+			case 1:
+				dest += sprintf(dest, "0%lu%07lu", 1 + genRand() % 99, genRand() % 10000000);
+				break;
+			default:
+				dest += sprintf(dest, "%lu", 1000 + genRand() % 9000);
+		}
+	}
+}
+
+
+
+/*
+ *  Generates a unique username: "'first name'_'surname'", followed by a number from the second homonym on.
+ *
+ *    'dest' = pointer to a buffer of at least MAX_USERNAME_LEN+1 chars.
+ *    'table' = the table of the usernames already generated.
+ *    'tableSize' = the number of slots of the table.
+ */
+
+void genUsername(char *dest, homonymsS *table, unsigned long tableSize){
+	char *p;
+	int l = sprintf(dest, "%s_%s", firstNames[genRand() % N_FIRST_NAMES], surnames[genRand() % N_SURNAMES]);
+	for(p=dest; *p!='\0'; p++){										//only letters, digits, - and _
+		if(*p==' ') *p = '_';
+		else if(*p=='\'') *p = '-';
+		else *p = tolower((unsigned char) *p);
+	}
+	unsigned long n = countHomonym(table, tableSize, dest);
+	if(n>1) sprintf(dest+l, "%lu", n);
+}
+
+
+
+/*
+ *  Compares two names, in the same order of the dynamic arrays. (used by qsort())
+ */
+
+int compareNames(const void *a, const void *b){
+	return strcmp(*(char **) a, *(char **) b);
+}
+
+
+
+/*
+ *  Creates a file of the dataset, truncating it if it already exists.
+ *
+ *    'dir' = the folder of the dataset.
+ *    'filename' = the name of the file.
+ *
+ *    returns the opened file.
+ */
+
+FILE *openGenFile(char *dir, char *filename){
+	char path[strlen(dir) + strlen(filename) + 2];
+	FILE *f;
+	sprintf(path, "%s/%s", dir, filename);
+	if(!(f = fopen(path, "w"))) error("fopen() failed");
+	return f;
+}
+
+
+
+/*
+ *  Parses the command line arguments.
+ *
+ *    'argc' = the main argc variable.
+ *    'argv' = the main argv variable.
+ *    'dir' = pointer to where will be saved the output folder.
+ *    'nRecords' = pointer to where will be saved the number of main records.
+ *    'nPrivUsers' = pointer to where will be saved the number of privileged users.
+ *    'nNormUsers' = pointer to where will be saved the number of normal users.
+ *    'nQueries' = pointer to where will be saved the number of requests of the trace.
+ *    'mix' = pointer to the percentages of searches, additions and removals of the trace.
+ *    'zipf' = pointer to where will be saved the skew of the trace.
+ *    'seed' = pointer to where will be saved the seed.
+ *    'password' = pointer to where will be saved the password of the users.
+ *    'shuffle' = pointer to where will be saved 1, if the main records don't have to be sorted.
+ */
+
+void parseGenCmdLine(int argc, char **argv, char **dir, unsigned long *nRecords, unsigned long *nPrivUsers, unsigned long *nNormUsers, unsigned long *nQueries,
+	unsigned *mix, double *zipf, unsigned long *seed, char **password, int *shuffle){
+
+	for(int i=1; i<argc; i++){
+		if(argv[i][0]!='-' || argv[i][0]=='\0') continue;
+		switch(argv[i][1]){
+			case 'o':
+				if(i+1<argc) *dir = argv[i+1];
+				break;
+			case 'n':
+				if(i+1<argc) *nRecords = strtoul(argv[i+1], NULL, 10);
+				break;
+			case 'P':
+				if(i+1<argc) *nPrivUsers = strtoul(argv[i+1], NULL, 10);
+				break;
+			case 'N':
+				if(i+1<argc) *nNormUsers = strtoul(argv[i+1], NULL, 10);
+				break;
+			case 'q':
+				if(i+1<argc) *nQueries = strtoul(argv[i+1], NULL, 10);
+				break;
+			case 'm':
+				if(i+1>=argc || sscanf(argv[i+1], "%u,%u,%u", &mix[0], &mix[1], &mix[2])!=3 || mix[0]+mix[1]+mix[2]!=100){
+					printf("The mix has to be three percentages, of searches, additions and removals, that sum to 100. (e.g. 90,5,5)\n");
+					exit(1);
+				}
+				break;
+			case 'z':
+				if(i+1<argc) *zipf = atof(argv[i+1]);
+				if(*zipf<0) goto invalid;
+				break;
+			case 's':
+				if(i+1<argc) *seed = strtoul(argv[i+1], NULL, 10);
+				break;
+			case 'w':
+				if(i+1<argc) *password = argv[i+1];
+				break;
+			case 'r':
+				*shuffle = 1;
+				break;
+			case 'h':
+				printf("Options:\n\t-o (folder) where the files are written, default: the current one\n\t-n (n) main records, default: %d\n\t-P (n) privileged users, default: %d\n\t-N (n) normal users, default: %d\n\t-w (password) of all the users, default: " GEN_DEFAULT_PASSWORD "\n\t-q (n) requests of the query trace, default: 0 (no trace)\n\t-m (search,add,del) percentages of the operations of the trace, default: 90,5,5\n\t-z (s) skew of the Zipf distribution of the trace keys, default: %.2f\n\t-s (n) seed, default: %d\n\t-r write the main records in a random order, instead of sorted\n\t-h display this help and exit\n",
+					GEN_DEFAULT_RECORDS, GEN_DEFAULT_USERS, GEN_DEFAULT_USERS, GEN_DEFAULT_ZIPF, GEN_DEFAULT_SEED);
+				exit(0);
+			default:
+			invalid:
+				printf("Invalid option '%s', use -h for help.\n", argv[i]);
+				exit(1);
+		}
+		if(argv[i][2]!='\0') goto invalid;
+	}
+}
@@ -0,0 +1,312 @@
+
+/*
+ *  Load generator, that opens many concurrent sessions to the server
+ *  and drives a mix of searches, additions and removals, measuring their latencies.
+ *
+ *  Every session logins once, then sends its requests one at a time:
+ *  in closed-loop mode (the default) the next request is sent as soon as the response arrives,
+ *  while in open-loop mode (-r) the requests are sent at a fixed total rate, spread among the sessions.
+ *  In open-loop mode the latency is measured from when a request should have been sent,
+ *  so that a slow server can't hide its delays by slowing down the clients.
+ *  The requests can also be read from a query trace (-f), like the ones written by dataset_gen:
+ *  the sessions start from different points of the trace, and go through it in a loop.
+ *
+ *  The results are printed one per line, as "key=value" pairs, like the ones of database_bench:
+ *
+ *    op=search count=812345 failed=0 p50_us=95.2 p99_us=310.1 p999_us=802.8 max_us=2400.5
+ */
+
+#include "bench_headers.h"
+
+
+#define LOAD_DEFAULT_SESSIONS 8
+#define LOAD_DEFAULT_DURATION 10									//seconds
+#define LOAD_DEFAULT_KEYS 10000
+#define LOAD_MAX_SESSIONS 1024
+#define LOAD_MAX_NUM 1000000000000UL								//the numbers of the added records are smaller than this
+
+
+enum loadOps{
+	LOAD_SEARCH,
+	LOAD_ADD,
+	LOAD_DEL,
+	TOT_LOAD_OPS
+};
+
+
+unsigned nSessions = LOAD_DEFAULT_SESSIONS;
+unsigned duration = LOAD_DEFAULT_DURATION;
+double rate = 0;													//total requests per second, 0 for closed-loop mode
+unsigned mix[TOT_LOAD_OPS] = {90, 5, 5};							//percentages of searches, additions and removals
+unsigned long nKeys = LOAD_DEFAULT_KEYS;
+int preload = 0;													//1 if the sessions add all the keys, before the measured run
+char *traceText = NULL;												//the whole query trace, split in lines
+char **traceReqs = NULL;											//the requests of the query trace, as "'type''data'"
+unsigned long nTraceReqs = 0;
+
+pthread_barrier_t startBarrier;										//the run starts when all the sessions are logged in
+unsigned long startNs, endNs;
+
+histS latency[TOT_LOAD_OPS];										//nanoseconds from the send of a request to its response
+atomic_ulong opFails[TOT_LOAD_OPS];									//FAIL_RESP responses, for a missing record or a full database
+atomic_ulong errors;												//unexpected responses, and sessions closed by the server
+char *loadOpNames[TOT_LOAD_OPS] = {"search", "add", "del"};
+
+
+
+void loadTrace(char *filename);
+void *sessionThread(void *arg);
+void parseLoadCmdLine(int argc, char **argv, char **ip, int *port, char **username, char **password, int *printUser, char **traceFilename);
+
+
+
+int main(int argc, char **argv){
+	char *ip = DEFAULT_SERVER_IP;
+	int port = DEFAULT_SERVER_PORT;
+	char *username = NULL, *password = NULL;
+	char *traceFilename = NULL;
+	int printUser = 0;
+	pthread_t *threads;
+	unsigned long total = 0, totalNs;
+	parseLoadCmdLine(argc, argv, &ip, &port, &username, &password, &printUser, &traceFilename);
+
+	initSessions(ip, port, username, password);
+	if(printUser){													//prints the line of the users database file, to register the user
+		printf("%s\n", userRec);
+		exit(0);
+	}
+	if(traceFilename) loadTrace(traceFilename);
+
+	if(!(threads = malloc(nSessions * sizeof(pthread_t)))) error("malloc() failed");
+	if(pthread_barrier_init(&startBarrier, NULL, nSessions + 1)) error("pthread_barrier_init() failed");
+	for(unsigned long i=0; i<nSessions; i++){
+		if(pthread_create(&threads[i], NULL, sessionThread, (void *) i)) error("pthread_create() failed");
+	}
+
+	pthread_barrier_wait(&startBarrier);							//all the sessions are logged in, and the keys are added
+	startNs = getTimeNs();
+	endNs = startNs + duration * 1000000000UL;
+	pthread_barrier_wait(&startBarrier);
+	for(unsigned i=0; i<nSessions; i++) if(pthread_join(threads[i], NULL)) error("pthread_join() failed");
+	totalNs = getTimeNs() - startNs;
+
+	for(int i=0; i<TOT_LOAD_OPS; i++) total += atomic_load(&latency[i].total);
+	printf("mode=%s sessions=%u duration_s=%.2f requests=%lu throughput_rps=%.1f errors=%lu", rate?"open":"closed", nSessions, totalNs / 1e9, total, total / (totalNs / 1e9), atomic_load(&errors));
+	if(rate) printf(" target_rps=%.1f", rate);
+	printf("\n");
+	for(int i=0; i<TOT_LOAD_OPS; i++){
+		histS *h = &latency[i];
+		if(!atomic_load(&h->total)) continue;
+		printf("op=%s count=%lu failed=%lu p50_us=%.1f p99_us=%.1f p999_us=%.1f max_us=%.1f\n", loadOpNames[i], atomic_load(&h->total), atomic_load(&opFails[i]),
+			histPercentile(h, 50) / 1000.0, histPercentile(h, 99) / 1000.0, histPercentile(h, 99.9) / 1000.0, atomic_load(&h->max) / 1000.0);
+	}
+	fflush(stdout);
+
+	pthread_barrier_destroy(&startBarrier);
+	free(threads);
+	free(traceText);
+	free(traceReqs);
+	exit(atomic_load(&errors) ? 1 : 0);
+}
+
+
+
+/*
+ *  Reads all the requests of a query trace, one per line, as "'type''data'".
+ *  Only the searches, additions and removals are allowed.
+ *
+ *    'filename' = the name of the trace file.
+ */
+
+void loadTrace(char *filename){
+	if(!filename) error("NULL argument");
+	unsigned long max = 1024;
+	char *text, *p, *line;
+
+	if(!(traceReqs = malloc(max * sizeof(char *)))) error("malloc() failed");
+	text = readWholeFile(filename, NULL);
+	for(p=text; *p!='\0'; ){										//splits the lines in place
+		line = p;
+		while(*p!='\n' && *p!='\0') p++;
+		if(*p=='\n') *p++ = '\0';
+		if(*line=='\0') continue;
+		if((line[0]!=SEARCH_REQ && line[0]!=ADD_REQ && line[0]!=DEL_REQ) || strlen(line)>MAX_MAIN_REC_STR_LEN+1){
+			printf("Invalid request in the trace: '%s'\n", line);
+			exit(1);
+		}
+		if(nTraceReqs==max){
+			max <<= 1;
+			if(!(traceReqs = realloc(traceReqs, max * sizeof(char *)))) error("realloc() failed");
+		}
+		traceReqs[nTraceReqs++] = line;
+	}
+	if(!nTraceReqs){
+		printf("The trace '%s' is empty.\n", filename);
+		exit(1);
+	}
+	traceText = text;
+}
+
+
+
+/*
+ *  Runs a session: logins, adds its share of the keys if requested,
+ *  then sends requests until the end of the run.
+ *  The keys are chosen uniformly among 'nKeys', and the operations following 'mix',
+ *  unless the requests are read from a query trace.
+ *
+ *    'arg' = the index of the session.
+ */
+
+void *sessionThread(void *arg){
+	unsigned long id = (unsigned long) arg;
+	unsigned long rnd = 0x2545F4914F6CDD1DUL * (id + 1), interval = 0, next = 0, sent, key;
+	unsigned long tracePos = nTraceReqs * id / nSessions;
+	char token[SESSION_TOKEN_LEN+1];
+	char buff[BUFF_SIZE], resp[BUFF_SIZE];
+	char res;
+	unsigned op, dice;
+
+	int sock = connectSession(token);
+	char *data = buff + sprintf(buff, "x%s%c", token, QUERY_ITEMS_SEPARATOR);
+
+	if(preload){													//the keys are split among the sessions
+		buff[0] = ADD_REQ;
+		for(key=id; key<nKeys; key+=nSessions){
+			sprintf(data, "load %lu%c%lu", key, KEY_VALUE_SEPARATOR, key);
+			if(sendRequest(sock, buff, resp)!=SUCCESS_RESP) error("Preload failed");
+		}
+	}
+
+	pthread_barrier_wait(&startBarrier);
+	pthread_barrier_wait(&startBarrier);							//waits for the main thread to set the start time
+	if(rate){														//the sessions are staggered, so that the requests are evenly spread
+		interval = nSessions * 1e9 / rate;
+		next = startNs + id * interval / nSessions;
+	}
+
+	while(1){
+		if(rate){
+			if(next>=endNs) break;
+			sleepUntil(next);
+			sent = next;											//if the session is late, the delay is counted in the latency
+			next += interval;
+		}
+		else if((sent = getTimeNs())>=endNs) break;
+
+		if(traceReqs){
+			buff[0] = traceReqs[tracePos][0];
+			strcpy(data, traceReqs[tracePos]+1);
+			op = buff[0]==SEARCH_REQ ? LOAD_SEARCH : buff[0]==ADD_REQ ? LOAD_ADD : LOAD_DEL;
+			if(++tracePos==nTraceReqs) tracePos = 0;
+			goto send;
+		}
+
+		rnd ^= rnd << 13;											//xorshift
+		rnd ^= rnd >> 7;
+		rnd ^= rnd << 17;
+		key = (rnd >> 8) % nKeys;
+		dice = rnd % 100;
+		for(op=0; op<TOT_LOAD_OPS-1 && dice>=mix[op]; op++) dice -= mix[op];
+
+		if(op==LOAD_ADD){
+			buff[0] = ADD_REQ;
+			sprintf(data, "load %lu%c%lu", key, KEY_VALUE_SEPARATOR, (rnd >> 16) % LOAD_MAX_NUM);
+		}
+		else{
+			buff[0] = op==LOAD_SEARCH ? SEARCH_REQ : DEL_REQ;
+			sprintf(data, "load %lu", key);
+		}
+
+		send:
+		res = sendRequest(sock, buff, resp);
+		if(res==SUCCESS_RESP || res==FAIL_RESP){
+			histRecord(&latency[op], getTimeNs() - sent);
+			if(res==FAIL_RESP) atomic_fetch_add_explicit(&opFails[op], 1, memory_order_relaxed);
+		}
+		else{
+			atomic_fetch_add(&errors, 1);
+			if(!res) break;											//the connection has been closed
+		}
+	}
+
+	if(close(sock)==-1) error("close() failed");
+	return NULL;
+}
+
+
+
+/*
+ *  Parses the command line arguments.
+ *
+ *    'argc' = the main argc variable.
+ *    'argv' = the main argv variable.
+ *    'ip' = pointer to where will be saved the eventual ip.
+ *    'port' = a pointer where will be saved the eventual port.
+ *    'username' = pointer to where will be saved the username.
+ *    'password' = pointer to where will be saved the password.
+ *    'printUser' = pointer to where will be saved 1, if only the user record has to be printed.
+ *    'traceFilename' = pointer to where will be saved the eventual query trace.
+ */
+
+void parseLoadCmdLine(int argc, char **argv, char **ip, int *port, char **username, char **password, int *printUser, char **traceFilename){
+
+	for(int i=1; i<argc; i++){
+		if(argv[i][0]!='-' || argv[i][0]=='\0') continue;
+		switch(argv[i][1]){
+			case 'a':
+				if(i+1<argc) *ip = argv[i+1];
+				break;
+			case 'p':
+				if(i+1<argc) *port = atoi(argv[i+1]);
+				break;
+			case 'u':
+				if(i+1<argc) *username = argv[i+1];
+				break;
+			case 'w':
+				if(i+1<argc) *password = argv[i+1];
+				break;
+			case 'c':
+				if(i+1<argc) nSessions = atoi(argv[i+1]);
+				if(!nSessions || nSessions>LOAD_MAX_SESSIONS){
+					printf("The sessions have to be between 1 and %d.\n", LOAD_MAX_SESSIONS);
+					exit(1);
+				}
+				break;
+			case 'd':
+				if(i+1<argc) duration = atoi(argv[i+1]);
+				break;
+			case 'r':
+				if(i+1<argc) rate = atof(argv[i+1]);
+				if(rate<0) goto invalid;
+				break;
+			case 'm':
+				if(i+1>=argc || sscanf(argv[i+1], "%u,%u,%u", &mix[LOAD_SEARCH], &mix[LOAD_ADD], &mix[LOAD_DEL])!=3 || mix[LOAD_SEARCH]+mix[LOAD_ADD]+mix[LOAD_DEL]!=100){
+					printf("The mix has to be three percentages, of searches, additions and removals, that sum to 100. (e.g. 90,5,5)\n");
+					exit(1);
+				}
+				break;
+			case 'k':
+				if(i+1<argc) nKeys = strtoul(argv[i+1], NULL, 10);
+				if(!nKeys) goto invalid;
+				break;
+			case 'l':
+				preload = 1;
+				break;
+			case 'f':
+				if(i+1<argc) *traceFilename = argv[i+1];
+				break;
+			case 'e':
+				*printUser = 1;
+				break;
+			case 'h':
+				printf("Options:\n\t-a (ip addr)\n\t-p (port)\n\t-u (username) a privileged user, if the mix has writes\n\t-w (password)\n\t-c (n) concurrent sessions, default: %d\n\t-d (s) duration of the run, default: %d\n\t-r (req/s) total request rate, for an open-loop run. default: closed-loop\n\t-m (search,add,del) percentages of the operations, default: 90,5,5\n\t-k (n) number of different keys, default: %d\n\t-l add all the keys before the run\n\t-f (file) read the requests from a query trace, instead of -m and -k\n\t-e print the user record for the users database file, and exit\n\t-h display this help and exit\n", LOAD_DEFAULT_SESSIONS, LOAD_DEFAULT_DURATION, LOAD_DEFAULT_KEYS);
+				exit(0);
+			default:
+			invalid:
+				printf("Invalid option '%s', use -h for help.\n", argv[i]);
+				exit(1);
+		}
+		if(argv[i][2]!='\0') goto invalid;
+	}
+}
@@ -0,0 +1,288 @@
+
+/*
+ *  Replays a request capture of the server ('server -c') against a server,
+ *  at the original speed, N times faster, or as fast as possible.
+ *
+ *  Every captured session is replayed by its own connection, that sends its requests
+ *  in the same order, each one at its original time divided by the speed, if the previous one has been answered.
+ *  So the requests of different sessions interleave like in the capture, and contend for the same records.
+ *  All the sessions login with the same user, that has to be privileged to replay the writes.
+ *  (the subscriptions are skipped, since they don't end)
+ *
+ *  The results are printed one per line, as "key=value" pairs, like the ones of loadgen.
+ *  The lag is how late the requests have been sent, compared to when they should have been (0 if on time).
+ */
+
+#include "bench_headers.h"
+#include <semaphore.h>
+
+
+#define REPLAY_DEFAULT_SPEED 1
+#define REPLAY_DEFAULT_SESSIONS 256
+
+
+typedef struct replaySessionStruct{
+	pthread_t tid;
+	unsigned long first;											//the index of its first request, in 'reqs'
+	unsigned long n;
+} replaySessionS;
+
+typedef struct replayReqStruct{
+	captureRecS rec;
+	char *data;														//points inside the capture, not terminated
+	unsigned long pos;												//the position in the capture, to keep the order of a session
+} replayReqS;
+
+
+replayReqS *reqs;
+replaySessionS *sessions;
+double speed = REPLAY_DEFAULT_SPEED;								//0 to replay as fast as possible
+unsigned long startNs;
+uint64_t firstTime;													//the time of the first captured request
+sem_t sessionSlots;													//limits the sessions connected at the same time
+
+histS latency[TOT_REQ-TOKEN_REQ];
+histS lag;
+atomic_ulong skipped;
+atomic_ulong errors;
+char *replayReqNames[TOT_REQ-TOKEN_REQ] = {"token", "search", "add", "del", "cas_add", "cas_del", "txn", "subscribe", "durability", "stats"};
+
+
+
+unsigned long loadCapture(char *filename, char **capture);
+int compareReqs(const void *a, const void *b);
+int compareSessions(const void *a, const void *b);
+void *replaySessionThread(void *arg);
+void parseReplayCmdLine(int argc, char **argv, char **ip, int *port, char **username, char **password, char **filename, unsigned *maxSessions);
+
+
+
+int main(int argc, char **argv){
+	char *ip = DEFAULT_SERVER_IP;
+	int port = DEFAULT_SERVER_PORT;
+	char *username = NULL, *password = NULL, *filename = NULL;
+	unsigned maxSessions = REPLAY_DEFAULT_SESSIONS;
+	unsigned long nReqs, nSessions = 0, total = 0, totalNs;
+	char *capture;
+	parseReplayCmdLine(argc, argv, &ip, &port, &username, &password, &filename, &maxSessions);
+	if(!filename){
+		printf("A capture file is needed, use -h for help.\n");
+		exit(1);
+	}
+	initSessions(ip, port, username, password);
+
+	/* groups the requests by session, keeping their order, and sorts the sessions by start time */
+	nReqs = loadCapture(filename, &capture);
+	qsort(reqs, nReqs, sizeof(replayReqS), compareReqs);
+	if(!(sessions = malloc((nReqs + 1) * sizeof(replaySessionS)))) error("malloc() failed");
+	for(unsigned long i=0; i<nReqs; i++){
+		if(!i || reqs[i].rec.session!=reqs[i-1].rec.session){
+			sessions[nSessions].first = i;
+			sessions[nSessions++].n = 0;
+		}
+		sessions[nSessions-1].n++;
+	}
+	qsort(sessions, nSessions, sizeof(replaySessionS), compareSessions);
+	firstTime = nSessions ? reqs[sessions[0].first].rec.time : 0;
+
+	/* starts every session when its first request is due, so that only the overlapping ones are connected together */
+	if(sem_init(&sessionSlots, 0, maxSessions)==-1) error("sem_init() failed");
+	startNs = getTimeNs();
+	for(unsigned long i=0; i<nSessions; i++){
+		while(sem_wait(&sessionSlots)==-1) if(errno!=EINTR) error("sem_wait() failed");
+		if(speed) sleepUntil(startNs + (reqs[sessions[i].first].rec.time - firstTime) / speed);
+		if(pthread_create(&sessions[i].tid, NULL, replaySessionThread, &sessions[i])) error("pthread_create() failed");
+	}
+	for(unsigned long i=0; i<nSessions; i++) if(pthread_join(sessions[i].tid, NULL)) error("pthread_join() failed");
+	totalNs = getTimeNs() - startNs;
+
+	for(int i=0; i<TOT_REQ-TOKEN_REQ; i++) total += atomic_load(&latency[i].total);
+	printf("speed=%g sessions=%lu requests=%lu skipped=%lu duration_s=%.2f throughput_rps=%.1f errors=%lu", speed, nSessions, total, atomic_load(&skipped), totalNs / 1e9, total / (totalNs / 1e9), atomic_load(&errors));
+	if(speed) printf(" lag_p99_us=%.1f lag_max_us=%.1f", histPercentile(&lag, 99) / 1000.0, atomic_load(&lag.max) / 1000.0);
+	printf("\n");
+	for(int i=0; i<TOT_REQ-TOKEN_REQ; i++){
+		histS *h = &latency[i];
+		if(!atomic_load(&h->total)) continue;
+		printf("op=%s count=%lu p50_us=%.1f p99_us=%.1f p999_us=%.1f max_us=%.1f\n", replayReqNames[i], atomic_load(&h->total),
+			histPercentile(h, 50) / 1000.0, histPercentile(h, 99) / 1000.0, histPercentile(h, 99.9) / 1000.0, atomic_load(&h->max) / 1000.0);
+	}
+	fflush(stdout);
+
+	sem_destroy(&sessionSlots);
+	free(sessions);
+	free(reqs);
+	free(capture);
+	exit(atomic_load(&errors) ? 1 : 0);
+}
+
+
+
+/*
+ *  Reads all the requests of a capture.
+ *  A request truncated at the end of the file, by a server that didn't exit, is ignored.
+ *
+ *    'filename' = the name of the capture file.
+ *    'capture' = pointer to where will be saved the content of the file, where the data of the requests points.
+ *
+ *    returns the number of requests, saved in 'reqs'.
+ */
+
+unsigned long loadCapture(char *filename, char **capture){
+	if(!filename || !capture) error("NULL argument");
+	captureHeaderS header;
+	unsigned long n = 0, max = 1024;
+	size_t len, off = sizeof(header);
+
+	*capture = readWholeFile(filename, &len);
+	if(len<sizeof(header)) goto invalid;
+	memcpy(&header, *capture, sizeof(header));
+	if(header.magic!=CAPTURE_MAGIC) goto invalid;
+
+	if(!(reqs = malloc(max * sizeof(replayReqS)))) error("malloc() failed");
+	while(off + sizeof(captureRecS) <= len){
+		if(n==max){
+			max <<= 1;
+			if(!(reqs = realloc(reqs, max * sizeof(replayReqS)))) error("realloc() failed");
+		}
+		memcpy(&reqs[n].rec, *capture + off, sizeof(captureRecS));	//the records aren't aligned in the file
+		off += sizeof(captureRecS);
+		if(off + reqs[n].rec.len > len) break;
+		if(reqs[n].rec.type<=TOKEN_REQ || reqs[n].rec.type>=TOT_REQ || reqs[n].rec.len>=BUFF_SIZE-SESSION_TOKEN_LEN-2) goto invalid;
+		reqs[n].data = *capture + off;
+		reqs[n].pos = n;
+		off += reqs[n++].rec.len;
+	}
+	return n;
+
+	invalid:
+	printf("'%s' is not a valid capture file.\n", filename);
+	exit(1);
+}
+
+
+
+/*
+ *  Compares two requests by session, and then by position in the capture. (used by qsort())
+ */
+
+int compareReqs(const void *a, const void *b){
+	const replayReqS *r1 = a, *r2 = b;
+	if(r1->rec.session!=r2->rec.session) return r1->rec.session < r2->rec.session ? -1 : 1;
+	return r1->pos < r2->pos ? -1 : r1->pos > r2->pos;
+}
+
+
+
+/*
+ *  Compares two sessions by the time of their first request. (used by qsort())
+ */
+
+int compareSessions(const void *a, const void *b){
+	uint64_t t1 = reqs[((replaySessionS *) a)->first].rec.time, t2 = reqs[((replaySessionS *) b)->first].rec.time;
+	return t1 < t2 ? -1 : t1 > t2;
+}
+
+
+
+/*
+ *  Replays the requests of a session, over its own connection.
+ *  If the server closes the connection, the rest of the session is skipped.
+ *
+ *    'arg' = pointer to the session.
+ */
+
+void *replaySessionThread(void *arg){
+	replaySessionS *session = arg;
+	char token[SESSION_TOKEN_LEN+1];
+	char buff[BUFF_SIZE], resp[BUFF_SIZE];
+	unsigned long due, now;
+	replayReqS *req;
+	char res;
+
+	int sock = connectSession(token);
+	char *data = buff + sprintf(buff, "x%s%c", token, QUERY_ITEMS_SEPARATOR);
+
+	for(unsigned long i=0; i<session->n; i++){
+		req = &reqs[session->first + i];
+		if(req->rec.type==SUBSCRIBE_REQ){
+			atomic_fetch_add(&skipped, 1);
+			continue;
+		}
+		if(speed){
+			due = startNs + (req->rec.time - firstTime) / speed;
+			if((now = getTimeNs())<due) sleepUntil(due);
+			histRecord(&lag, now<due ? 0 : now - due);					//the requests sent on time count as no lag
+		}
+		buff[0] = req->rec.type;
+		memcpy(data, req->data, req->rec.len);
+		data[req->rec.len] = '\0';
+
+		now = getTimeNs();
+		if(!(res = sendRequest(sock, buff, resp))){					//the connection has been closed
+			atomic_fetch_add(&errors, 1);
+			atomic_fetch_add(&skipped, session->n - i - 1);
+			break;
+		}
+		histRecord(&latency[req->rec.type-TOKEN_REQ], getTimeNs() - now);
+		if(res==INV_REQ_RESP) atomic_fetch_add(&errors, 1);
+	}
+
+	if(close(sock)==-1) error("close() failed");
+	if(sem_post(&sessionSlots)==-1) error("sem_post() failed");
+	return NULL;
+}
+
+
+
+/*
+ *  Parses the command line arguments.
+ *
+ *    'argc' = the main argc variable.
+ *    'argv' = the main argv variable.
+ *    'ip' = pointer to where will be saved the eventual ip.
+ *    'port' = a pointer where will be saved the eventual port.
+ *    'username' = pointer to where will be saved the username.
+ *    'password' = pointer to where will be saved the password.
+ *    'filename' = pointer to where will be saved the capture file.
+ *    'maxSessions' = pointer to where will be saved the maximum number of sessions connected at the same time.
+ */
+
+void parseReplayCmdLine(int argc, char **argv, char **ip, int *port, char **username, char **password, char **filename, unsigned *maxSessions){
+
+	for(int i=1; i<argc; i++){
+		if(argv[i][0]!='-' || argv[i][0]=='\0') continue;
+		switch(argv[i][1]){
+			case 'a':
+				if(i+1<argc) *ip = argv[i+1];
+				break;
+			case 'p':
+				if(i+1<argc) *port = atoi(argv[i+1]);
+				break;
+			case 'u':
+				if(i+1<argc) *username = argv[i+1];
+				break;
+			case 'w':
+				if(i+1<argc) *password = argv[i+1];
+				break;
+			case 'f':
+				if(i+1<argc) *filename = argv[i+1];
+				break;
+			case 's':
+				if(i+1<argc) speed = atof(argv[i+1]);
+				if(speed<0) goto invalid;
+				break;
+			case 'c':
+				if(i+1<argc) *maxSessions = atoi(argv[i+1]);
+				if(!*maxSessions) goto invalid;
+				break;
+			case 'h':
+				printf("Options:\n\t-a (ip addr)\n\t-p (port)\n\t-u (username) a privileged user, if the capture has writes\n\t-w (password)\n\t-f (file) the capture, written by 'server -c'\n\t-s (n) replay n times faster than the capture, 0 for as fast as possible. default: %d\n\t-c (n) maximum sessions connected at the same time, default: %d\n\t-h display this help and exit\n", REPLAY_DEFAULT_SPEED, REPLAY_DEFAULT_SESSIONS);
+				exit(0);
+			default:
+			invalid:
+				printf("Invalid option '%s', use -h for help.\n", argv[i]);
+				exit(1);
+		}
+		if(argv[i][2]!='\0') goto invalid;
+	}
+}
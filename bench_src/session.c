@@ -0,0 +1,145 @@
+
+/*
+ *  The sessions of the load tools (loadgen and replay):
+ *  how they connect and login to the server, and send their requests.
+ */
+
+#include "bench_headers.h"
+
+
+struct sockaddr_in serverAddr;
+char userRec[MAX_USER_REC_STR_LEN+1];								//the "'username':'hash'" record sent to login
+
+
+
+/*
+ *  Sets the server and the user of all the sessions.
+ *
+ *    'ip' = the ip address of the server.
+ *    'port' = the port of the server.
+ *    'username' = the user with which the sessions login.
+ *    'password' = the password of the user, hashed like the client does.
+ */
+
+void initSessions(char *ip, int port, char *username, char *password){
+	if(!ip) error("NULL argument");
+	if(!username || !password || checkUsernameString(username)){
+		printf("A valid username and password are needed, use -h for help.\n");
+		exit(1);
+	}
+	sprintf(userRec, "%s%c", username, KEY_VALUE_SEPARATOR);
+	hash(password, userRec + strlen(userRec));
+
+	memset(&serverAddr, 0, sizeof(serverAddr));
+	serverAddr.sin_family = AF_INET;
+	serverAddr.sin_port = htons(port);
+	if(!inet_aton(ip, &serverAddr.sin_addr)) error("Invalid IP address.");
+}
+
+
+
+/*
+ *  Connects and logins to the server.
+ *  If the server isn't listening yet, retries for LOAD_CONNECT_TIMEOUT seconds.
+ *
+ *    'token' = pointer to a buffer of size SESSION_TOKEN_LEN+1, where will be saved the session token.
+ *
+ *    returns the socket connected to the server.
+ */
+
+int connectSession(char *token){
+	if(!token) error("NULL argument");
+	char buff[BUFF_SIZE];
+	int sock;
+
+	for(int i=0; ; i++){
+		if((sock = socket(AF_INET, SOCK_STREAM, 0))==-1) error("socket() failed");
+		if(!connect(sock, (struct sockaddr *) &serverAddr, sizeof(serverAddr))) break;
+		if(errno!=ECONNREFUSED || i>=LOAD_CONNECT_TIMEOUT*10) error("connect() failed");
+		if(close(sock)==-1) error("close() failed");
+		usleep(100000);
+	}
+
+	struct timeval t;
+	t.tv_usec = 0;
+	t.tv_sec = SOCKET_READ_TIMEOUT;
+	if(setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &t, sizeof(t))==-1) error("setsockopt() failed");
+	t.tv_sec = SOCKET_WRITE_TIMEOUT;
+	if(setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &t, sizeof(t))==-1) error("setsockopt() failed");
+
+	buff[0] = TOKEN_REQ;
+	strcpy(buff+1, userRec);
+	if(writeToSocket(buff, strlen(buff), sock) || !readFromSocket(buff, sock)) error("The connection has been closed by the server");
+	if(buff[0]!=SUCCESS_RESP) error("Login failed");
+	if(strlen(buff)!=SESSION_TOKEN_LEN+2 || checkTokenString(buff+2)) error("Invalid login response");
+	strcpy(token, buff+2);
+	return sock;
+}
+
+
+
+/*
+ *  Sends a request to the server, and reads its response.
+ *
+ *    'sock' = socket connected to the server.
+ *    'buff' = the request string.
+ *    'resp' = pointer to a buffer of size BUFF_SIZE, where will be saved the response.
+ *
+ *    returns the type of the response, or
+ *    returns 0 if the connection has been closed.
+ */
+
+char sendRequest(int sock, char *buff, char *resp){
+	if(writeToSocket(buff, strlen(buff), sock) || !readFromSocket(resp, sock)) return 0;
+	return resp[0];
+}
+
+
+
+/*
+ *  Sleeps until the monotonic clock reaches 'ns' nanoseconds.
+ *
+ *    'ns' = the time to wake up at, as returned by getTimeNs().
+ */
+
+void sleepUntil(unsigned long ns){
+	struct timespec t;
+	t.tv_sec = ns / 1000000000;
+	t.tv_nsec = ns % 1000000000;
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL)==EINTR);
+}
+
+
+
+/*
+ *  Reads a whole file in a newly allocated buffer.
+ *
+ *    'filename' = the name of the file.
+ *    'len' = an optional pointer, where will be saved the length of the file.
+ *
+ *    returns the content of the file, followed by a '\0'.
+ */
+
+char *readWholeFile(char *filename, size_t *len){
+	if(!filename) error("NULL argument");
+	struct stat st;
+	size_t l = 0;
+	ssize_t readed;
+	char *text;
+	int fd;
+
+	if((fd = open(filename, O_RDONLY))==-1) error("open() failed");
+	if(fstat(fd, &st)==-1) error("fstat() failed");
+	if(!(text = malloc(st.st_size + 1))) error("malloc() failed");
+	while(l<(size_t) st.st_size){
+		if((readed = read(fd, text+l, st.st_size-l))<0){
+			if(errno!=EINTR) error("read() failed");
+		}
+		else if(!readed) break;
+		else l += readed;
+	}
+	text[l] = '\0';
+	if(close(fd)==-1) error("close() failed");
+	if(len) *len = l;
+	return text;
+}
@@ -112,14 +112,16 @@ int main(int argc, char **argv){
 	char *p;
 	char cmdBuff[3];
 	char errStr[] = "Invalid command, try again.\n\n";
+	int durable = 0;												//if the writes are acknowledged only after being synced to disk
 	int tmp = sprintf(buff, "x%s%c", token, QUERY_ITEMS_SEPARATOR); //preset the buffer so that is ready for sending requests
 	char *data = buff + tmp;
 
 	/* the requests have this format: "'x''token';'data'" where 'x' is the type of request */
 
 	while(1){
-		printNow("\n\nAvailable commands:\n\t0: Exit\n\t1: Search record");
-		if(permission==READ_WRITE_PERM) printNow("\n\t2: Add or overwrite record\n\t3: Remove record");
+		printNow("\n\nAvailable commands:\n\t0: Exit\n\t1: Search record\n\t7: Follow changes");
+		if(permission==READ_WRITE_PERM) printNow("\n\t2: Add or overwrite record\n\t3: Remove record\n\t4: Conditionally add or overwrite record\n\t5: Conditionally remove record\n\t6: Transaction");
+		if(permission==READ_WRITE_PERM) printf("\n\t8: %s durable writes\n\t9: Server stats", durable?"Disable":"Enable");
 		while(!readLine("\n\nEnter command: ", errStr, 1, cmdBuff, NULL)) printf("%s", errStr);
 
 		switch(atoi(cmdBuff)){
@@ -138,6 +140,36 @@ int main(int argc, char **argv){
 				readNameString(data, NULL);
 				buff[0] = DEL_REQ;
 				break;
+			case 4:
+				tmp = sprintf(data, "%lu%c", readVersion(), QUERY_ITEMS_SEPARATOR);
+				readMainRecordString(data+tmp);
+				buff[0] = CAS_ADD_REQ;
+				break;
+			case 5:
+				tmp = sprintf(data, "%lu%c", readVersion(), QUERY_ITEMS_SEPARATOR);
+				readNameString(data+tmp, NULL);
+				buff[0] = CAS_DEL_REQ;
+				break;
+			case 6:
+				if(readTransaction(buff, data, sock)){
+					printNow(connClosed);
+					goto client_exit;
+				}
+				break;
+			case 7:
+				followChanges(buff, data, sock);
+				printNow(connClosed);
+				goto client_exit;
+			case 8:
+				data[0] = durable ? DURABILITY_OFF : DURABILITY_ON;
+				data[1] = '\0';
+				buff[0] = DURABILITY_REQ;
+				break;
+			case 9:
+				data[0] = STATS_KEEP;
+				data[1] = '\0';
+				buff[0] = STATS_REQ;
+				break;
 			default:
 				printf("%s", errStr);
 				continue;
@@ -156,7 +188,18 @@ int main(int argc, char **argv){
 		switch(respBuff[0]){
 			case SUCCESS_RESP:
 				printf("\n\n\nRequest successfully executed.\n");
-				if(len>1){
+				if(buff[0]==DURABILITY_REQ){
+					durable = data[0]==DURABILITY_ON;
+					printf("\nThe writes will be acknowledged %s.\n", durable?"only after being synced to disk":"as soon as they are applied");
+				}
+				else if(buff[0]==ADD_REQ || buff[0]==DEL_REQ || buff[0]==TXN_REQ){
+					if(durable) printf("\nThe changes are synced to disk.\n");
+				}
+				else if(buff[0]==STATS_REQ) printf("\n%s", respBuff+1);
+				else if(buff[0]==CAS_ADD_REQ || buff[0]==CAS_DEL_REQ){
+					if(len>1 && buff[0]==CAS_ADD_REQ) printf("\nThe new version of the record is %s\n", respBuff+1);
+				}
+				else if(len>1){
 					if(checkRecordString(respBuff+1, MAIN_TYPE)) error("Received invalid record string"); 
 					p = respBuff+1;
 					while(*p!='\0' && *p!=KEY_VALUE_SEPARATOR) p++;
@@ -170,6 +213,12 @@ int main(int argc, char **argv){
 			case FAIL_RESP: 
 				printf("\n\n\nRequest failed.\n");
 				break;
+			case READ_ONLY_RESP:
+				printf("\n\n\nRequest refused, the server is a read-only replica.\n");
+				break;
+			case VERSION_MISMATCH_RESP:
+				printf("\n\n\nRequest not executed, the current version of the record is %s\n", len>1?respBuff+1:"unknown");
+				break;
 			case INV_REQ_RESP:
 				error("The client did an invalid request.\n");
 			default:
@@ -186,6 +235,126 @@ int main(int argc, char **argv){
 
 
 
+/*
+ *  Reads the operations of a transaction from standard input.
+ *  Every time the buffer gets full, the operations readed so far are sent
+ *  to the server as a chunk of the transaction, while the last chunk
+ *  is left in the buffer, ready to be sent, to commit the transaction.
+ *
+ *    'buff' = pointer to the request buffer, of size BUFF_SIZE.
+ *    'data' = pointer to where the data of the request starts, inside 'buff'.
+ *    'sock' = socket connected to the server.
+ *
+ *    returns 0 if the last chunk is ready to be sent, or
+ *    returns 1 if the connection has been closed, or a chunk has been refused.
+ */
+
+int readTransaction(char *buff, char *data, int sock){
+	char op[MAX_REC_STR_LEN+2];
+	char respBuff[BUFF_SIZE];
+	char cmdBuff[3];
+	char errStr[] = "Invalid command, try again.\n\n";
+	size_t len;
+	char *p = data + 1;
+
+	buff[0] = TXN_REQ;
+	while(1){
+		printNow("\n\nTransaction commands:\n\t0: Commit\n\t1: Add or overwrite record\n\t2: Remove record");
+		while(!readLine("\n\nEnter command: ", errStr, 1, cmdBuff, NULL)) printf("%s", errStr);
+
+		switch(atoi(cmdBuff)){
+			case 0:
+				*data = TXN_COMMIT_FLAG;
+				*p = '\0';
+				return 0;
+			case 1:
+				op[0] = TXN_ADD_OP;
+				len = readMainRecordString(op+1) + 1;
+				break;
+			case 2:
+				op[0] = TXN_DEL_OP;
+				readNameString(op+1, &len);
+				len++;
+				break;
+			default:
+				printf("%s", errStr);
+				continue;
+		}
+
+		if((p - buff) + len + 1 >= BUFF_SIZE){						//the buffer is full, sends this chunk of the transaction
+			*data = TXN_MORE_FLAG;
+			*p = '\0';
+			if(writeToSocket(buff, p - buff, sock) || !readFromSocket(respBuff, sock)) return 1;
+			if(respBuff[0]!=SUCCESS_RESP) return 1;
+			p = data + 1;
+		}
+		strcpy(p, op);
+		p += len;
+		*p++ = TXN_OPS_SEPARATOR;
+	}
+}
+
+
+
+/*
+ *  Subscribes to the change feed of the server,
+ *  and prints every change pushed by it, until the connection is closed.
+ *
+ *    'buff' = pointer to the request buffer, of size BUFF_SIZE.
+ *    'data' = pointer to where the data of the request starts, inside 'buff'.
+ *    'sock' = socket connected to the server.
+ */
+
+void followChanges(char *buff, char *data, int sock){
+	char errStr[] = "ERROR: Sequence number not valid. (can contain only numeric characters)";
+	char seqBuff[MAX_VERSION_LEN+1];
+	char respBuff[BUFF_SIZE*2];
+	char *p1, *p2, *type, *rec;
+	size_t len, carry = 0;
+	int first = 1;
+
+	while(!readLine("Enter the last received sequence number (0 to receive only the new changes): ", errStr, MAX_VERSION_LEN, seqBuff, NULL) || checkSeqString(seqBuff)) printf("%s\n", errStr);
+	if(strtoul(seqBuff, NULL, 10)) sprintf(data, "%c%s", FEED_RESUME, seqBuff);
+	else sprintf(data, "%c", FEED_FROM_NOW);
+	buff[0] = SUBSCRIBE_REQ;
+	if(writeToSocket(buff, strlen(buff), sock)) return;
+
+	while((len = readStreamFromSocket(respBuff+carry, BUFF_SIZE-1, sock))){ //the pushed lines can be splitted between different reads
+		len += carry;
+		respBuff[len] = '\0';
+		p1 = respBuff;
+		while((p2 = strchr(p1, FEED_LINES_SEPARATOR))){
+			*p2 = '\0';
+			if(first){												//the first line is the response to the subscription
+				if(*p1!=SUCCESS_RESP){
+					printf("\nThe requested changes are no more available, the oldest valid sequence number is %s\n", p1+1);
+					return;
+				}
+				printf("\nSubscribed, the last committed change is the n°%s (CTRL+C to exit)\n\n", p1+1);
+				first = 0;
+			}
+			else{
+				if(!(type = strchr(p1, QUERY_ITEMS_SEPARATOR))) error("Invalid response");
+				*type++ = '\0';
+				if(!(type = strchr(type, QUERY_ITEMS_SEPARATOR))) error("Invalid response"); //skips the commit time
+				type++;
+				if(*type==FEED_ADD_LINE && (rec = strchr(type, QUERY_ITEMS_SEPARATOR))){
+					*rec++ = '\0';									//the added record is preceded by its version
+					printf("[%s] Added: %s (version %s)\n", p1, rec, type+1);
+				}
+				else if(*type==FEED_DEL_LINE) printf("[%s] Removed: %s\n", p1, type+1);
+			}
+			fflush(stdout);
+			p1 = p2 + 1;
+		}
+		carry = len - (p1 - respBuff);
+		memmove(respBuff, p1, carry);
+		if(carry>=BUFF_SIZE) error("Invalid response");
+	}
+}
+
+
+
 /*
  *  Parses the command line arguments.
  *  (if both the ip and hostname are specified,
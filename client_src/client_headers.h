@@ -15,4 +15,6 @@
 
 
 
+int readTransaction(char *buff, char *data, int sock);
+void followChanges(char *buff, char *data, int sock);
 void parseCmdLine(int argc, char **argv, char **ip, char **hostname, int *port);
@@ -11,6 +11,12 @@
 #include <sys/wait.h>
 #include <crypt.h>
 #include <termios.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#ifdef __SSE2__
+	#include <emmintrin.h>
+#endif
 
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -30,9 +36,19 @@
 #define PASSWORD_CHARSET "-_<'>?/#&@+-=()[]{}"
 #define HASH_CHARSET "./"
 
+//the classes of the characters in the charClasses table, one bit each (a character can belong to many)
+#define NAME_CHAR 0x01												//alphanumeric or NAME_CHARSET
+#define NUM_CHAR 0x02												//digit or +
+#define DIGIT_CHAR 0x04
+#define USERNAME_CHAR 0x08											//alphanumeric or USERNAME_CHARSET
+#define PASSWORD_CHAR 0x10											//alphanumeric or PASSWORD_CHARSET (the same of RAND_STR_FULL_CHARSET)
+#define HASH_CHAR 0x20												//alphanumeric or HASH_CHARSET
+
 #define SINGLE_NUM_SEPARATOR ','
 #define KEY_VALUE_SEPARATOR ':'
 #define QUERY_ITEMS_SEPARATOR ';'
+#define TXN_OPS_SEPARATOR '\n'
+#define FEED_LINES_SEPARATOR '\n'
 
 #define MAX_GENERIC_LEN 100
 #define MAX_NAME_LEN MAX_GENERIC_LEN
@@ -46,11 +62,19 @@
 #define MAX_NUMS_LEN ( (MAX_NUM_LEN + 1) * MAX_N_NUMS - 1 )
 #define MAX_MAIN_REC_STR_LEN ( MAX_NAME_LEN + 1 + MAX_NUMS_LEN )
 #define MAX_USER_REC_STR_LEN ( MAX_USERNAME_LEN + 1 + HASH_LEN )
+#define MAX_VERSION_LEN 20
+#define MAX_TXN_OPS 10000
 #define MAX_REC_STR_LEN ( MAX_MAIN_REC_STR_LEN > MAX_USER_REC_STR_LEN ? MAX_MAIN_REC_STR_LEN : MAX_USER_REC_STR_LEN )
 
 #define BUFF_SIZE 4096
 #define MIN_BUFF_SIZE ( MAX_REC_STR_LEN + 2 )
 
+#define HIST_SUB_BITS 5											//the latency histograms have a relative error less than 1/2^(HIST_SUB_BITS-1)
+#define HIST_MAX_VALUE_BITS 40										//the latencies are counted in nanoseconds, up to 2^HIST_MAX_VALUE_BITS
+#define HIST_BUCKETS ( (HIST_MAX_VALUE_BITS - HIST_SUB_BITS + 2) << (HIST_SUB_BITS - 1) )
+
+#define CAPTURE_MAGIC 0x50414345									//"ECAP" at the start of a request capture
+
 #define SESSION_TOKEN_LEN 80
 #define DEFAULT_SERVER_PORT 34334
 #define DEFAULT_SERVER_IP "127.0.0.1"
@@ -69,9 +93,55 @@ enum requestType{
 	SEARCH_REQ = '1',
 	ADD_REQ = '2',
 	DEL_REQ = '3',
+	CAS_ADD_REQ = '4',
+	CAS_DEL_REQ = '5',
+	TXN_REQ = '6',
+	SUBSCRIBE_REQ = '7',
+	DURABILITY_REQ = '8',
+	STATS_REQ = '9',
 	TOT_REQ
 };
 
+//the first char of a TXN_REQ data, tells if other chunks of the same transaction will follow
+enum txnFlags{
+	TXN_COMMIT_FLAG = '0',
+	TXN_MORE_FLAG = '1'
+};
+
+//the first char of a SUBSCRIBE_REQ data, tells from where the changes should be sent
+enum feedModes{
+	FEED_FROM_NOW = '0',
+	FEED_RESUME = '1',
+	FEED_SNAPSHOT = '2'
+};
+
+//the type of the lines pushed to a subscribed client, with this format: "'seq';'time';'type''data'\n"
+enum feedLineType{
+	FEED_DEL_LINE = '0',
+	FEED_ADD_LINE = '1',
+	FEED_HEARTBEAT_LINE = '2',
+	FEED_SNAPSHOT_END_LINE = '3'
+};
+
+//the data of a DURABILITY_REQ, tells if the following write requests of the session
+//have to be acknowledged only after they have been synced to disk
+enum durabilityModes{
+	DURABILITY_OFF = '0',
+	DURABILITY_ON = '1'
+};
+
+//the data of a STATS_REQ, tells if the counters have to be reset after being read
+enum statsModes{
+	STATS_KEEP = '0',
+	STATS_RESET = '1'
+};
+
+//the first char of every operation inside a TXN_REQ
+enum txnOpType{
+	TXN_DEL_OP = '0',
+	TXN_ADD_OP = '1'
+};
+
 enum responseType{
 	SUCCESS_RESP = '0',
 	FAIL_RESP = '1',
@@ -79,25 +149,67 @@ enum responseType{
 	INV_USERNAME_RESP = '3',
 	INV_PASSWORD_RESP = '4',
 	TOO_MANY_TRY_RESP = '5',
+	VERSION_MISMATCH_RESP = '6',
+	READ_ONLY_RESP = '7',
 	TOT_RESP
 };
 
 
+typedef struct histogramStruct{
+	atomic_ulong counts[HIST_BUCKETS];
+	atomic_ulong total;
+	atomic_ulong sum;
+	atomic_ulong max;
+} histS;
+
+//a request capture of the server ('server -c'), read by the replay tool, is a captureHeaderS
+//followed by a captureRecS for every request, each followed by the 'len' chars of the request data
+typedef struct captureHeaderStruct{
+	uint32_t magic;													//CAPTURE_MAGIC
+	uint32_t reserved;
+	uint64_t startTime;												//milliseconds since the epoch, when the capture started
+} captureHeaderS;
+
+typedef struct captureRecStruct{
+	uint64_t time;													//nanoseconds since the start of the capture
+	uint32_t session;												//the same for all the requests of a connection
+	uint16_t len;
+	uint8_t type;
+	uint8_t reserved;
+} captureRecS;
+
+typedef struct recordSliceStruct{
+	char *key;														//points inside the parsed string, not terminated
+	size_t keyLen;
+	char *value;													//the same, valueLen is 0 if the record has no value
+	size_t valueLen;
+} recSliceS;
+
+
+extern const unsigned char charClasses[256];
+
+
 //utility.c
 void clearStdin(void);
 char *readLine(char *askStr, char *errStr, int maxLen, char *optionalDest, size_t *optionalTotChars);
 char *randomString(size_t length, char *optionalDest);
 int isFileFinished(int fd);
 int readLineFromFile(int fd, char *buff, char **p1, char **p2);
-int checkGenericString(char *str, const char *charset, size_t maxSize);
+char *skipClass(const char *str, unsigned char class);
+int checkClassString(char *str, unsigned char class, size_t maxSize);
 int checkNameString(char *name);
 int checkNumString(char *num);
+char *scanNumsString(char *nums);
 int checkNumsString(char *nums);
 int checkUsernameString(char *username);
 int checkPasswordString(char *psw);
 int checkHashString(char *hash);
 int checkTokenString(char *token);
+int checkVersionString(char *version);
+int checkSeqString(char *seq);
+int parseRecordString(char *str, unsigned char recType, recSliceS *slice);
 int checkRecordString(char *str, unsigned char recType);
+int checkTxnOpString(char *op);
 void formatNameString(char *name);
 char *readNameString(char *optionalDest, size_t *optionalTotChars);
 char *readNumsString(char *optionalDest, size_t *optionalTotChars);
@@ -106,6 +218,13 @@ char *hash(char *str, char *optionalDest);
 char *readPassword(char *optionalDest);
 size_t readMainRecordString(char *dest);
 size_t readUserRecordString(char *dest);
+unsigned long readVersion(void);
 unsigned long countFileLines(char *filename);
 int writeToSocket(char *str, size_t len, int sockFd);
 size_t readFromSocket(char *dest, int sockFd);
+size_t readStreamFromSocket(char *dest, size_t maxLen, int sockFd);
+unsigned long getTimeNs(void);
+unsigned histIndex(unsigned long value);
+unsigned long histValue(unsigned index);
+void histRecord(histS *hist, unsigned long value);
+unsigned long histPercentile(histS *hist, double percentile);
@@ -208,35 +208,96 @@ int readLineFromFile(int fd, char *buff, char **p1, char **p2){
 
 
 
+/*
+ *  The classes of all the characters, so that every validation
+ *  costs a single table lookup per character. (see the *_CHAR defines)
+ *  The non-ASCII characters don't belong to any class.
+ */
+
+const unsigned char charClasses[256] = {
+	['0' ... '9'] = NAME_CHAR | NUM_CHAR | DIGIT_CHAR | USERNAME_CHAR | PASSWORD_CHAR | HASH_CHAR,
+	['a' ... 'z'] = NAME_CHAR | USERNAME_CHAR | PASSWORD_CHAR | HASH_CHAR,
+	['A' ... 'Z'] = NAME_CHAR | USERNAME_CHAR | PASSWORD_CHAR | HASH_CHAR,
+	[' '] = NAME_CHAR,
+	['\''] = NAME_CHAR | PASSWORD_CHAR,
+	['+'] = NUM_CHAR | PASSWORD_CHAR,
+	['-'] = USERNAME_CHAR | PASSWORD_CHAR,
+	['_'] = USERNAME_CHAR | PASSWORD_CHAR,
+	['.'] = HASH_CHAR,
+	['/'] = PASSWORD_CHAR | HASH_CHAR,
+	['<'] = PASSWORD_CHAR, ['>'] = PASSWORD_CHAR, ['?'] = PASSWORD_CHAR, ['#'] = PASSWORD_CHAR,
+	['&'] = PASSWORD_CHAR, ['@'] = PASSWORD_CHAR, ['='] = PASSWORD_CHAR, ['('] = PASSWORD_CHAR,
+	[')'] = PASSWORD_CHAR, ['['] = PASSWORD_CHAR, [']'] = PASSWORD_CHAR, ['{'] = PASSWORD_CHAR,
+	['}'] = PASSWORD_CHAR
+};
+
+
+
+/*
+ *  Skips all the characters of 'str' that belong to 'class'.
+ *  The classes made of the alphanumeric characters plus two others (names, usernames and hashes)
+ *  are checked 16 characters at a time with SSE2, when available.
+ *  (the loads are aligned, so they never cross a page, even when they go past the end of the string)
+ *
+ *    'str' = string to scan.
+ *    'class' = one of the *_CHAR classes.
+ *
+ *    returns a pointer to the first character of 'str' not in 'class' (at worst the terminator).
+ */
+
+char *skipClass(const char *str, unsigned char class){
+	if(!str) error("NULL argument");
+	const char *p = str;
+
+#ifdef __SSE2__
+	char extra1, extra2;
+	switch(class){
+		case NAME_CHAR: extra1 = ' '; extra2 = '\''; break;
+		case USERNAME_CHAR: extra1 = '-'; extra2 = '_'; break;
+		case HASH_CHAR: extra1 = '.'; extra2 = '/'; break;
+		default: extra1 = extra2 = '\0';
+	}
+	if(extra1){
+		for(; (uintptr_t) p & 15; p++) if(!(charClasses[(unsigned char) *p] & class)) return (char *) p;
+		const __m128i lowerLim = _mm_set1_epi8('a' - 1), upperLim = _mm_set1_epi8('z' + 1);
+		const __m128i digitLow = _mm_set1_epi8('0' - 1), digitUp = _mm_set1_epi8('9' + 1);
+		const __m128i caseBit = _mm_set1_epi8(0x20), e1 = _mm_set1_epi8(extra1), e2 = _mm_set1_epi8(extra2);
+		__m128i v, l, in;
+		unsigned mask;
+		for(;; p += 16){											//the signed compares exclude the non-ASCII characters
+			v = _mm_load_si128((const __m128i *) p);
+			l = _mm_or_si128(v, caseBit);							//lowercase, for the letters
+			in = _mm_and_si128(_mm_cmpgt_epi8(l, lowerLim), _mm_cmplt_epi8(l, upperLim));
+			in = _mm_or_si128(in, _mm_and_si128(_mm_cmpgt_epi8(v, digitLow), _mm_cmplt_epi8(v, digitUp)));
+			in = _mm_or_si128(in, _mm_or_si128(_mm_cmpeq_epi8(v, e1), _mm_cmpeq_epi8(v, e2)));
+			if((mask = _mm_movemask_epi8(in))!=0xFFFF) return (char *) p + __builtin_ctz(~mask);
+		}
+	}
+#endif
+
+	while(charClasses[(unsigned char) *p] & class) p++;
+	return (char *) p;
+}
+
+
+
 /*
  *  Checks if 'str' is a valid string:
  *  (it's not empty, has <= 'maxSize' chars,
- *  and contains only alphanumeric characters,
- *  or any of the characters in the string pointed by 'charset').
+ *  and contains only characters of 'class')
  *
  *    'str' = string to check.
- *    'charset' = string containing the additional valid characters,
- *      other than the alphanumeric ones.
+ *    'class' = one of the *_CHAR classes.
  *    'maxSize' = the maximum valid size of the string.
  *
  *    returns 0 if 'str' is valid, else
  *    returns 1
  */
 
-int checkGenericString(char *str, const char *charset, size_t maxSize){
+int checkClassString(char *str, unsigned char class, size_t maxSize){
 	if(!str) error("NULL argument");
-	size_t l = strlen(str);
-	if(!l || l>maxSize) return 1;
-
-	char *p;
-	for(size_t i=0; i<l; i++){
-		if(!isalnum(str[i])){
-			p = (char *) charset;
-			while(*p!='\0' && str[i]!=*p) p++;
-			if(*p=='\0') return 1;
-		}
-	}
-	return 0;
+	char *p = skipClass(str, class);
+	return *p!='\0' || p==str || (size_t) (p - str)>maxSize;
 }
 
 
@@ -253,7 +314,7 @@ int checkGenericString(char *str, const char *charset, size_t maxSize){
  */
 
 int checkNameString(char *name){
-	return checkGenericString(name, NAME_CHARSET, MAX_NAME_LEN);
+	return checkClassString(name, NAME_CHAR, MAX_NAME_LEN);
 }
 
 
@@ -269,11 +330,34 @@ int checkNameString(char *name){
  */
 
 int checkNumString(char *num){
-	if(!num) error("NULL argument");
-	size_t l = strlen(num);
-	if(!l || l>MAX_NUM_LEN) return 1;
-	for(size_t i=0; i<l; i++) if(!isdigit(num[i]) && num[i]!='+') return 1;
-	return 0;
+	return checkClassString(num, NUM_CHAR, MAX_NUM_LEN);
+}
+
+
+
+/*
+ *  Scans the multiple-numbers string at the start of 'nums',
+ *  up to the first character that can't be part of it.
+ *  (contains <= MAX_N_NUMS valid single numbers, so it has <= MAX_NUMS_LEN chars)
+ *
+ *    'nums' = string to scan.
+ *
+ *    returns a pointer to the character after the numbers (the same 'nums' if there are none), or
+ *    returns NULL if the numbers are invalid.
+ */
+
+char *scanNumsString(char *nums){
+	if(!nums) error("NULL argument");
+	char *p = nums, *num;
+	if(!(charClasses[(unsigned char) *p] & NUM_CHAR)) return p;
+	for(int i=0; i<MAX_N_NUMS; i++){
+		num = p;
+		while(charClasses[(unsigned char) *p] & NUM_CHAR) p++;
+		if(p==num || p - num>MAX_NUM_LEN) return NULL;
+		if(*p!=SINGLE_NUM_SEPARATOR) return p;
+		p++;
+	}
+	return NULL;
 }
 
 
@@ -291,24 +375,8 @@ int checkNumString(char *num){
 
 int checkNumsString(char *nums){
 	if(!nums) return 0;
-	size_t l = strlen(nums);
-	if(!l) return 0;
-	if(l>MAX_NUMS_LEN) return 1;
-	
-	int res;
-	char *p1;
-	char *p2 = nums;
-	for(int i=0; i<MAX_N_NUMS; i++){
-		p1 = p2;
-		while(*p2!='\0' && *p2!=SINGLE_NUM_SEPARATOR) p2++;
-		if(*p2=='\0') return checkNumString(p1);
-
-		*p2 = '\0';
-		res = checkNumString(p1);
-		*p2++ = SINGLE_NUM_SEPARATOR;
-		if(res) return 1;
-	}
-	return 1;
+	char *end = scanNumsString(nums);
+	return !end || *end!='\0';
 }
 
 
@@ -325,7 +393,7 @@ int checkNumsString(char *nums){
  */
 
 int checkUsernameString(char *username){
-	return checkGenericString(username, USERNAME_CHARSET, MAX_USERNAME_LEN);
+	return checkClassString(username, USERNAME_CHAR, MAX_USERNAME_LEN);
 }
 
 
@@ -344,7 +412,7 @@ int checkUsernameString(char *username){
 int checkPasswordString(char *psw){
 	if(!psw) error("NULL argument");
 	if(strlen(psw)<MIN_PASSWORD_LEN) return 1;
-	return checkGenericString(psw, PASSWORD_CHARSET, MAX_PASSWORD_LEN);
+	return checkClassString(psw, PASSWORD_CHAR, MAX_PASSWORD_LEN);
 }
 
 
@@ -361,8 +429,8 @@ int checkPasswordString(char *psw){
  */
 int checkHashString(char *hash){
 	if(!hash) error("NULL argument");
-	if(strlen(hash)!=HASH_LEN) return 1;
-	return checkGenericString(hash, HASH_CHARSET, HASH_LEN);
+	char *p = skipClass(hash, HASH_CHAR);
+	return *p!='\0' || p - hash!=HASH_LEN;
 }
 
 
@@ -380,63 +448,126 @@ int checkHashString(char *hash){
 
 int checkTokenString(char *token){
 	if(!token) error("NULL argument");
-	if(strlen(token)!=SESSION_TOKEN_LEN) return 1;
-	return checkGenericString(token, RAND_STR_FULL_CHARSET, SESSION_TOKEN_LEN);
+	char *p = skipClass(token, PASSWORD_CHAR);						//the same characters of RAND_STR_FULL_CHARSET
+	return *p!='\0' || p - token!=SESSION_TOKEN_LEN;
+}
+
+
+
+/*
+ *  Checks if 'version' is a valid record version string:
+ *  (it's not empty, has <= MAX_VERSION_LEN chars,
+ *  and contains only numeric characters)
+ *
+ *    'version' = string to check.
+ *
+ *    returns 0 if 'version' is valid, else
+ *    returns 1
+ */
+
+int checkVersionString(char *version){
+	return checkClassString(version, DIGIT_CHAR, MAX_VERSION_LEN);
+}
+
+
+
+/*
+ *  Checks if 'seq' is a valid sequence number string:
+ *  (same format of a version string)
+ *
+ *    'seq' = string to check.
+ *
+ *    returns 0 if 'seq' is valid, else
+ *    returns 1
+ */
+
+int checkSeqString(char *seq){
+	return checkVersionString(seq);
 }
 
 
 
 /*
- *  Checks if 'str' is a valid 'recType'-record string:
+ *  Validates a 'recType'-record string, and splits it into its key and value, in a single scan:
  *    If the record is a main-record:
- *      It's not empty, has <= MAX_MAIN_REC_STR_LEN chars,
- *      both it's name and nums substrings are valid,
- *      and there is only one KEY_VALUE_SEPARATOR.
+ *      Its name is valid, followed by a KEY_VALUE_SEPARATOR,
+ *      and by a valid (maybe empty) nums string up to the end.
  *    Else, if the record is a user-record:
- *      It's not empty, has <= MAX_USER_REC_STR_LEN chars,
- *      both it's username and hash substrings are valid, 
- *      and there is only one KEY_VALUE_SEPARATOR.
+ *      Its username is valid, followed by a KEY_VALUE_SEPARATOR,
+ *      and by a valid hash up to the end.
+ *  (so it's not empty, and has <= MAX_MAIN_REC_STR_LEN or MAX_USER_REC_STR_LEN chars)
+ *  The string isn't modified, the slice points inside it.
  *
- *  This function, utilizes function pointers, to set the correct ones
- *  that will later be used to check the two substrings.
- *
- *    'str' = string to check.
+ *    'str' = string to parse.
  *    'recType' = the type of record (only valid options are MAIN_TYPE or USER_TYPE).
+ *    'slice' = pointer to where will be saved the key and the value, if the string is valid.
  *
  *	  returns 0 if 'str' is valid, else
  *    returns 1
  */
 
-int checkRecordString(char *str, unsigned char recType){
-	if(!str) error("NULL argument");
+int parseRecordString(char *str, unsigned char recType, recSliceS *slice){
+	if(!str || !slice) error("NULL argument");
+	char *p = str;
 
-	size_t maxLen, l;
-	int (*checkStr1)(char *str);
-	int (*checkStr2)(char *str);
 	if(recType==MAIN_TYPE){
-		maxLen = MAX_MAIN_REC_STR_LEN;
-		checkStr1 = checkNameString;
-		checkStr2 = checkNumsString;
+		p = skipClass(str, NAME_CHAR);
+		if(*p!=KEY_VALUE_SEPARATOR || p==str || p - str>MAX_NAME_LEN) return 1;
+		slice->key = str;
+		slice->keyLen = p - str;
+		slice->value = ++p;
+		if(!(p = scanNumsString(p)) || *p!='\0') return 1;
 	}
 	else if(recType==USER_TYPE){
-		maxLen = MAX_USER_REC_STR_LEN;
-		checkStr1 = checkUsernameString;
-		checkStr2 = checkHashString;
+		p = skipClass(str, USERNAME_CHAR);
+		if(*p!=KEY_VALUE_SEPARATOR || p==str || p - str>MAX_USERNAME_LEN) return 1;
+		slice->key = str;
+		slice->keyLen = p - str;
+		slice->value = ++p;
+		p = skipClass(p, HASH_CHAR);
+		if(*p!='\0' || p - slice->value!=HASH_LEN) return 1;
 	}
 	else error("invalid record type");
 
-	l = strlen(str);
-	if(!l || l>maxLen) return 1;
-	
-	int res;
-	char *p = str;
+	slice->valueLen = p - slice->value;
+	return 0;
+}
 
-	while(*p!='\0' && *p!=KEY_VALUE_SEPARATOR) p++;
-	if(*p=='\0') return 1;
-	*p = '\0';
-	res = checkStr1(str);
-	*p++ = KEY_VALUE_SEPARATOR;
-	return res || checkStr2(p);
+
+
+/*
+ *  Checks if 'str' is a valid 'recType'-record string. (see parseRecordString())
+ *
+ *    'str' = string to check.
+ *    'recType' = the type of record (only valid options are MAIN_TYPE or USER_TYPE).
+ *
+ *	  returns 0 if 'str' is valid, else
+ *    returns 1
+ */
+
+int checkRecordString(char *str, unsigned char recType){
+	recSliceS slice;
+	return parseRecordString(str, recType, &slice);
+}
+
+
+
+/*
+ *  Checks if 'op' is a valid transaction operation string:
+ *    If it starts with TXN_ADD_OP, the rest has to be a valid main-record string.
+ *    Else, if it starts with TXN_DEL_OP, the rest has to be a valid name string.
+ *
+ *    'op' = string to check.
+ *
+ *	  returns 0 if 'op' is valid, else
+ *    returns 1
+ */
+
+int checkTxnOpString(char *op){
+	if(!op) error("NULL argument");
+	if(op[0]==TXN_ADD_OP) return checkRecordString(op+1, MAIN_TYPE);
+	if(op[0]==TXN_DEL_OP) return checkNameString(op+1);
+	return 1;
 }
 
 
@@ -730,6 +861,26 @@ size_t readUserRecordString(char *dest){
 
 
 
+/*
+ *  Reads from the linux standard input a valid record version.
+ *
+ *  (usefull for sending conditional requests from a client)
+ *
+ *    returns the readed version.
+ */
+
+unsigned long readVersion(void){
+	char askStr[] = "Enter expected version (0 if the record should not exist): ";
+	char longStrErr[] = "ERROR: Version too long.\n";
+	char invalidStrErr[] = "ERROR: Version not valid. (can contain only numeric characters)";
+	char buff[MAX_VERSION_LEN+1];
+
+	while(!readLine(askStr, longStrErr, MAX_VERSION_LEN, buff, NULL) || checkVersionString(buff)) printf("%s\n", invalidStrErr);
+	return strtoul(buff, NULL, 10);
+}
+
+
+
 /*
  *  Returns how many lines are in a file.
  *  Creating oneother process that will execve to the "wc" program,
@@ -838,3 +989,117 @@ size_t readFromSocket(char *dest, int sockFd){
 	dest[readed] = '\0';
 	return readed;
 }
+
+
+
+/*
+ *  Reads from a valid, already opened socket, used as a stream,
+ *  (so, unlike readFromSocket(), a read that fills the buffer is valid)
+ *  at most 'maxLen' characters, saving them to the buffer pointed by 'dest'.
+ *  (assumes that an eventual socket read timeout is
+ *  already been configured with the setsockopt() function)
+ *
+ *    'dest' = pointer to a char buffer of size at least 'maxLen'+1
+ *    'maxLen' = the maximum number of characters to read.
+ *
+ *    returns 0 if the connection has been closed or timed out, or
+ *    returns the number of readed characters.
+ */
+
+size_t readStreamFromSocket(char *dest, size_t maxLen, int sockFd){
+	if(!dest) error("NULL argument");
+	ssize_t readed;
+
+	while((readed = read(sockFd, dest, maxLen))<0){
+		if(errno==EAGAIN || errno==EWOULDBLOCK) return 0;			//return 0 if timed out
+		if(errno!=EINTR) error("read() failed");
+	}
+	dest[readed] = '\0';
+	return readed;
+}
+
+
+
+/*
+ *  Returns the monotonic time in nanoseconds, used to measure the latencies.
+ */
+
+unsigned long getTimeNs(void){
+	struct timespec t;
+	if(clock_gettime(CLOCK_MONOTONIC, &t)==-1) fatalError("clock_gettime() failed");
+	return (unsigned long) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+
+
+/*
+ *  Returns the bucket of a histogram where a value is counted.
+ *  The values smaller than 2^HIST_SUB_BITS have a bucket each,
+ *  then every power of two is divided in 2^(HIST_SUB_BITS-1) buckets of the same width,
+ *  so that the relative error is always less than 2^-(HIST_SUB_BITS-1).
+ *
+ *    'value' = the value, saturated to 2^HIST_MAX_VALUE_BITS - 1.
+ */
+
+unsigned histIndex(unsigned long value){
+	if(value>>HIST_MAX_VALUE_BITS) value = (1UL<<HIST_MAX_VALUE_BITS) - 1;
+	if(value < (1UL<<HIST_SUB_BITS)) return value;
+	unsigned shift = 63 - __builtin_clzl(value) - HIST_SUB_BITS + 1;
+	return (shift<<(HIST_SUB_BITS-1)) + (value>>shift);
+}
+
+
+
+/*
+ *  Returns the smallest value counted in a bucket of a histogram.
+ *
+ *    'index' = the bucket.
+ */
+
+unsigned long histValue(unsigned index){
+	if(index < (1U<<HIST_SUB_BITS)) return index;
+	unsigned shift = (index>>(HIST_SUB_BITS-1)) - 1;
+	return (unsigned long) (index - (shift<<(HIST_SUB_BITS-1))) << shift;
+}
+
+
+
+/*
+ *  Counts a value in a histogram.
+ *  (can be called concurrently by any thread or process)
+ *
+ *    'hist' = pointer to the histogram.
+ *    'value' = the value to count.
+ */
+
+void histRecord(histS *hist, unsigned long value){
+	if(!hist) error("NULL argument");
+	atomic_fetch_add_explicit(&hist->counts[histIndex(value)], 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&hist->total, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&hist->sum, value, memory_order_relaxed);
+	unsigned long max = atomic_load_explicit(&hist->max, memory_order_relaxed);
+	while(value>max && !atomic_compare_exchange_weak_explicit(&hist->max, &max, value, memory_order_relaxed, memory_order_relaxed));
+}
+
+
+
+/*
+ *  Returns a percentile of the values counted in a histogram,
+ *  as the highest value of the bucket where it falls.
+ *
+ *    'hist' = pointer to the histogram.
+ *    'percentile' = the percentile, between 0 and 100.
+ */
+
+unsigned long histPercentile(histS *hist, double percentile){
+	if(!hist) error("NULL argument");
+	unsigned long total = atomic_load(&hist->total), count = 0, max = atomic_load(&hist->max);
+	unsigned long target = (unsigned long) (percentile / 100.0 * total + 0.5);
+	if(!total) return 0;
+	if(!target) target = 1;
+	for(unsigned i=0; i<HIST_BUCKETS; i++){
+		count += atomic_load_explicit(&hist->counts[i], memory_order_relaxed);
+		if(count>=target) return histValue(i+1) - 1 < max ? histValue(i+1) - 1 : max;
+	}
+	return max;
+}
@@ -0,0 +1,406 @@
+
+#include "server_headers.h"
+
+
+
+/*
+ *  Builds a block store with all the records of a main dynamic array.
+ *
+ *  The records are packed in key order in blocks of BLOCK_STORE_BLOCK_SIZE bytes,
+ *  that start with the number of their entries (2 bytes), followed by the entries:
+ *
+ *    [prefix len][suffix len][key suffix][value len][value]
+ *
+ *  where the key is front-coded, storing only the part not shared with the previous key of the block
+ *  (so the first key of every block is complete), and the value is packed by encodeNums().
+ *  The first 8 bytes of the first key of every block are kept in a small index,
+ *  as big endian integers, so that the binary search rarely touches the blocks.
+ *  The store contains no pointers, so it can be placed in a shared segment.
+ *  (assumes that no other processes or threads are using the store, or modifying the dynamic array)
+ *
+ *    'store' = pointer to a memory area of BLOCK_STORE_SIZE bytes.
+ *    'dynArr' = pointer to the main dynamic array.
+ */
+
+void buildBlockStore(blockStoreS *store, dArrS *dynArr){
+	if(!store || !dynArr) error("NULL argument");
+	unsigned char value[BLOCK_STORE_MAX_VALUE_SIZE];
+	blockBuilderS builder;
+	recS *rec;
+
+	startBlockStore(&builder, store);
+	for(unsigned long i=0; i<dynArr->size; i++){
+		rec = dynArrRec(dynArr, i);
+		appendBlockStore(&builder, rec->key, strlen(rec->key), value, rec->value ? encodeNums(rec->value, value) : 0);
+	}
+	finishBlockStore(&builder);
+}
+
+
+
+/*
+ *  Starts building a block store, a record at a time. (see buildBlockStore())
+ *  The store can be built a few records at a time, while another one is searched,
+ *  but it can't be searched until finishBlockStore() has been called.
+ *
+ *    'builder' = pointer to the state of the build.
+ *    'store' = pointer to a memory area of BLOCK_STORE_SIZE bytes.
+ */
+
+void startBlockStore(blockBuilderS *builder, blockStoreS *store){
+	if(!builder || !store) error("NULL argument");
+	builder->store = store;
+	builder->block = NULL;
+	builder->nEntries = 0;
+	builder->used = 0;
+	builder->prevLen = 0;
+	store->nRecs = 0;
+	store->nBlocks = 0;
+}
+
+
+
+/*
+ *  Adds a record at the end of a block store being built.
+ *  (the records have to be added in key order)
+ *
+ *    'builder' = pointer to the state of the build, started by startBlockStore().
+ *    'key' = the key string.
+ *    'keyLen' = the length of the key.
+ *    'value' = the value, already packed by encodeNums().
+ *    'valueLen' = the length of the packed value.
+ */
+
+void appendBlockStore(blockBuilderS *builder, char *key, size_t keyLen, unsigned char *value, size_t valueLen){
+	if(!builder || !key || !value) error("NULL argument");
+	unsigned char entry[BLOCK_STORE_MAX_ENTRY_SIZE];
+	blockStoreS *store = builder->store;
+	size_t prefix, entryLen;
+
+	for(prefix=0; prefix<keyLen && prefix<builder->prevLen && key[prefix]==builder->prev[prefix]; prefix++);
+	entryLen = encodeBlockEntry(key, keyLen, prefix, value, valueLen, entry);
+	if(!builder->block || builder->used + entryLen > BLOCK_STORE_BLOCK_SIZE){	//starts a new block, with the whole key
+		if(store->nBlocks>=BLOCK_STORE_MAX_BLOCKS) fatalError("This error should never occur");
+		if(builder->block) memcpy(builder->block, &builder->nEntries, sizeof(builder->nEntries));
+		builder->block = getStoreBlock(store, store->nBlocks);
+		store->firstKeys[store->nBlocks++] = keyPrefix(key, keyLen);
+		builder->nEntries = 0;
+		builder->used = sizeof(builder->nEntries);
+		entryLen = encodeBlockEntry(key, keyLen, 0, value, valueLen, entry);
+	}
+	memcpy(builder->block + builder->used, entry, entryLen);
+	builder->used += entryLen;
+	builder->nEntries++;
+	memcpy(builder->prev + prefix, key + prefix, keyLen - prefix);
+	builder->prevLen = keyLen;
+	store->nRecs++;
+}
+
+
+
+/*
+ *  Completes a block store built by appendBlockStore(), so that it can be searched.
+ *
+ *    'builder' = pointer to the state of the build.
+ */
+
+void finishBlockStore(blockBuilderS *builder){
+	if(!builder) error("NULL argument");
+	if(builder->block) memcpy(builder->block, &builder->nEntries, sizeof(builder->nEntries));
+}
+
+
+
+/*
+ *  Encodes an entry of a block.
+ *
+ *    'key' = the key string.
+ *    'keyLen' = the length of the key.
+ *    'prefix' = the length of the prefix shared with the previous key of the block.
+ *    'value' = the value, already packed by encodeNums().
+ *    'valueLen' = the length of the packed value.
+ *    'dest' = pointer to a buffer of BLOCK_STORE_MAX_ENTRY_SIZE bytes.
+ *
+ *    returns the length of the entry.
+ */
+
+size_t encodeBlockEntry(char *key, size_t keyLen, size_t prefix, unsigned char *value, size_t valueLen, unsigned char *dest){
+	if(!key || !value || !dest) error("NULL argument");
+	if(keyLen>MAX_NAME_LEN || prefix>keyLen || valueLen>BLOCK_STORE_MAX_VALUE_SIZE) error("invalid string");	//this error should never occur
+	dest[0] = prefix;
+	dest[1] = keyLen - prefix;
+	memcpy(dest + 2, key + prefix, keyLen - prefix);
+	unsigned char *p = dest + 2 + keyLen - prefix;
+	p[0] = valueLen;
+	memcpy(p + 1, value, valueLen);
+	return 1 + p + valueLen - dest;
+}
+
+
+
+/*
+ *  Packs a valid numbers string, two characters per byte:
+ *  every number is stored as its length (1 byte), followed by its characters,
+ *  a digit or a '+' for every half byte (padded with 0xF), without the separators.
+ *
+ *    'nums' = the numbers string.
+ *    'dest' = pointer to a buffer of at least BLOCK_STORE_MAX_VALUE_SIZE bytes.
+ *
+ *    returns the length of the packed numbers.
+ */
+
+size_t encodeNums(char *nums, unsigned char *dest){
+	if(!nums || !dest) error("NULL argument");
+	unsigned char *p = dest, *len = NULL, nibble = 0;
+	int half = 0;
+
+	for(char *c=nums; *c!='\0'; c++){
+		if(!len || *c==SINGLE_NUM_SEPARATOR){						//starts a new number
+			if(half) *p++ |= 0x0F;
+			half = 0;
+			len = p++;
+			*len = 0;
+			if(*c==SINGLE_NUM_SEPARATOR) continue;
+		}
+		if(*c>='0' && *c<='9') nibble = *c - '0';
+		else if(*c=='+') nibble = 0x0A;
+		else error("invalid string");								//this error should never occur
+		if(half) *p++ |= nibble;
+		else *p = nibble << 4;
+		half = !half;
+		(*len)++;
+	}
+	if(half) *p++ |= 0x0F;
+	return p - dest;
+}
+
+
+
+/*
+ *  Unpacks the numbers packed by encodeNums(), separating them with SINGLE_NUM_SEPARATOR.
+ *
+ *    'src' = the packed numbers.
+ *    'len' = the length of the packed numbers.
+ *    'dest' = pointer to a buffer of at least MAX_NUMS_LEN+1 chars, where the numbers will be written, terminated.
+ *
+ *    returns the length of the numbers string.
+ */
+
+size_t decodeNums(unsigned char *src, size_t len, char *dest){
+	if(!src || !dest) error("NULL argument");
+	unsigned char *end = src + len;
+	char *p = dest;
+	unsigned n;
+
+	while(src<end){
+		if(p!=dest) *p++ = SINGLE_NUM_SEPARATOR;
+		n = *src++;
+		for(unsigned i=0; i<n; i+=2, src++){							//two characters at a time, the padding is overwritten by what follows
+			p[i] = "0123456789+?????"[*src >> 4];
+			p[i+1] = "0123456789+?????"[*src & 0x0F];
+		}
+		p += n;
+	}
+	*p = '\0';
+	return p - dest;
+}
+
+
+
+/*
+ *  Returns the first 8 bytes of a key, as a big endian integer,
+ *  so that the integers have the same order of the keys. (shorter keys are padded with zeros)
+ *
+ *    'key' = the key string.
+ *    'keyLen' = the length of the key.
+ */
+
+uint64_t keyPrefix(char *key, size_t keyLen){
+	uint64_t prefix = 0;
+	for(size_t i=0; i<8; i++) prefix = prefix << 8 | (i<keyLen ? (unsigned char) key[i] : 0);
+	return prefix;
+}
+
+
+
+/*
+ *  Returns a pointer to the i-th block of a block store.
+ */
+
+unsigned char *getStoreBlock(blockStoreS *store, unsigned long i){
+	return (unsigned char *) (store + 1) + i * BLOCK_STORE_BLOCK_SIZE;
+}
+
+
+
+/*
+ *  Finds the block where a key is, or should be.
+ *  (a binary search of the first keys, comparing the whole key only when the first 8 bytes are equal)
+ *
+ *    'store' = pointer to a block store.
+ *    'key' = the key string.
+ *    'keyLen' = the length of the key.
+ *
+ *    returns the index of the last block whose first key is <= 'key', or 0.
+ */
+
+unsigned long findStoreBlock(blockStoreS *store, char *key, size_t keyLen){
+	uint64_t prefix = keyPrefix(key, keyLen);
+	unsigned long p1 = 0, p2 = store->nBlocks, half;
+	unsigned char *first;
+	int cmp;
+	while(p1<p2){													//finds the first block whose first key is > 'key'
+		half = p1 + ((p2 - p1)>>1);
+		if(store->firstKeys[half]!=prefix) cmp = store->firstKeys[half] > prefix ? 1 : -1;
+		else{
+			first = getStoreBlock(store, half) + sizeof(uint16_t);		//the first entry has no prefix
+			cmp = memcmp(first + 2, key, first[1] < keyLen ? first[1] : keyLen);
+			if(!cmp) cmp = (first[1] > keyLen) - (first[1] < keyLen);
+		}
+		if(cmp>0) p2 = half;
+		else p1 = half + 1;
+	}
+	return p1 ? p1 - 1 : 0;
+}
+
+
+
+/*
+ *  Positions an iterator on the first record of a block store with key >= 'key'.
+ *  The keys of the block are compared without decoding them: 'match' is how much of 'key'
+ *  the previous key shares, so a key that shares less of the previous one is greater than 'key',
+ *  one that shares more is smaller, and only one that shares the same is compared, from there.
+ *  (assumes that the store isn't being rebuilt)
+ *
+ *    'store' = pointer to a block store.
+ *    'key' = pointer to a valid key string.
+ *    'it' = pointer to the iterator.
+ *
+ *    returns 1 if the record has key 'key', or
+ *    returns 0 if it has a greater key, or if there aren't more records. (see readBlockIter())
+ */
+
+int seekBlockStore(blockStoreS *store, char *key, blockIterS *it){
+	if(!store || !key || !it) error("NULL argument");
+	size_t keyLen = strlen(key), match = 0, n, i;
+	unsigned char *p;
+	int cmp;
+	it->store = store;
+	it->block = findStoreBlock(store, key, keyLen);
+	it->entry = 0;
+	it->pos = sizeof(uint16_t);
+
+	while(it->block<store->nBlocks){
+		p = getStoreBlock(store, it->block) + it->pos;
+		if(p[0]<match) cmp = 1;
+		else if(p[0]>match) cmp = -1;
+		else{
+			n = p[1] < keyLen - match ? p[1] : keyLen - match;
+			for(i=0; i<n && p[2+i]==(unsigned char) key[match+i]; i++);
+			if(i<n) cmp = p[2+i] > (unsigned char) key[match+i] ? 1 : -1;
+			else cmp = (p[1] > keyLen - match) - (p[1] < keyLen - match);
+			match += i;
+		}
+		if(cmp>=0){
+			memcpy(it->key, key, p[0]);								//the key shares its prefix with 'key'
+			readBlockIter(it);
+			return !cmp;
+		}
+		it->valueLen = p[2 + p[1]];
+		it->value = p + 3 + p[1];
+		advanceBlockIter(it);
+	}
+	return 0;
+}
+
+
+
+/*
+ *  Decodes the key of the record where an iterator is positioned.
+ *
+ *    'it' = pointer to the iterator.
+ *
+ *    returns 1 if the iterator is on a record, or
+ *    returns 0 if there aren't more records.
+ */
+
+int readBlockIter(blockIterS *it){
+	if(it->block>=it->store->nBlocks) return 0;
+	unsigned char *p = getStoreBlock(it->store, it->block) + it->pos;
+	memcpy(it->key + p[0], p + 2, p[1]);							//the prefix is already there, from the previous key
+	it->keyLen = p[0] + p[1];
+	it->key[it->keyLen] = '\0';
+	it->valueLen = p[2 + p[1]];
+	it->value = p + 3 + p[1];
+	return 1;
+}
+
+
+
+/*
+ *  Moves an iterator to the next record, without decoding it.
+ *
+ *    'it' = pointer to the iterator, positioned on a record.
+ */
+
+void advanceBlockIter(blockIterS *it){
+	unsigned char *block = getStoreBlock(it->store, it->block);
+	uint16_t nEntries;
+	memcpy(&nEntries, block, sizeof(nEntries));
+	it->pos = it->value + it->valueLen - block;
+	if(++it->entry>=nEntries){
+		it->block++;
+		it->entry = 0;
+		it->pos = sizeof(uint16_t);
+	}
+}
+
+
+
+/*
+ *  Writes the search response of the record where an iterator is positioned:
+ *  a SUCCESS_RESP followed by the "key:value" string.
+ *
+ *    'it' = pointer to the iterator, positioned and read on a record.
+ *    'dest' = pointer to a buffer of at least MIN_BUFF_SIZE chars.
+ *
+ *    returns the size of the response.
+ */
+
+size_t blockIterToResp(blockIterS *it, char *dest){
+	if(!it || !dest) error("NULL argument");
+	dest[0] = SUCCESS_RESP;
+	memcpy(dest + 1, it->key, it->keyLen);
+	dest[1 + it->keyLen] = KEY_VALUE_SEPARATOR;
+	return 2 + it->keyLen + decodeNums(it->value, it->valueLen, dest + 2 + it->keyLen);
+}
+
+
+
+/*
+ *  Searches a record in a block store, and writes its search response in 'dest'.
+ *  (assumes that the store isn't being rebuilt)
+ *
+ *    'store' = pointer to a block store.
+ *    'key' = pointer to a valid key string. (can be in 'dest')
+ *    'dest' = pointer to a buffer of at least MIN_BUFF_SIZE chars.
+ *
+ *    returns the size of the response, or
+ *    returns 0 if the record hasn't been found.
+ */
+
+size_t searchBlockStore(blockStoreS *store, char *key, char *dest){
+	blockIterS it;
+	if(!seekBlockStore(store, key, &it)) return 0;
+	return blockIterToResp(&it, dest);
+}
+
+
+
+/*
+ *  Returns the bytes used by a block store: its header, its index and its blocks.
+ */
+
+size_t blockStoreBytes(blockStoreS *store){
+	return offsetof(blockStoreS, firstKeys) + store->nBlocks * (sizeof(uint64_t) + BLOCK_STORE_BLOCK_SIZE);
+}
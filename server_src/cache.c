@@ -0,0 +1,285 @@
+
+#include "server_headers.h"
+
+
+respCacheS *respCache;												//the cache of the search responses, shared by the server process and the read workers
+
+__thread unsigned long hotKeySample = 0;							//the searches of the thread since the last one counted in the sketch, 0 if not yet started
+
+
+
+/*
+ *  Creates the shared memory segment of the response cache and of the hot keys.
+ *  (has to be called before forking the other processes, so that they inherit the mapping)
+ *
+ *  The cache is direct mapped: every key can be only in the entry chosen by its hash.
+ *  Every entry is protected by a sequence number (a seqlock), odd while the entry is being written:
+ *  a search copies the entry without any lock, and uses the copy only if the sequence number didn't change.
+ *  The entries are filled by the searches that missed, while holding the main read lock,
+ *  and are invalidated by the writes, while holding the main write lock,
+ *  so an entry can never be filled with a response older than the last write of its key.
+ */
+
+void initRespCache(void){
+	if((respCache = mmap(NULL, sizeof(respCacheS), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0))==MAP_FAILED) fatalError("mmap() failed");
+	atomic_flag_clear(&respCache->hotLock);
+}
+
+
+
+/*
+ *  Returns the hash of a key. (64 bits FNV-1a, never 0, that marks the empty entries)
+ *
+ *    'key' = the key string.
+ *    'keyLen' = the length of the key.
+ */
+
+unsigned long hashKey(char *key, size_t keyLen){
+	unsigned long h = 0xCBF29CE484222325UL;
+	for(size_t i=0; i<keyLen; i++){
+		h ^= (unsigned char) key[i];
+		h *= 0x100000001B3UL;
+	}
+	return h ? h : 1;
+}
+
+
+
+/*
+ *  Searches the response of the record with key 'key' in the cache.
+ *  (doesn't need any lock)
+ *
+ *    'key' = the key string.
+ *    'keyLen' = the length of the key.
+ *    'hash' = the hash of the key, returned by hashKey().
+ *    'dest' = pointer to a buffer of size BUFF_SIZE, where the response will be saved, terminated.
+ *      (can overlap 'key')
+ *
+ *    returns the length of the response, or
+ *    returns 0 if it isn't in the cache.
+ */
+
+size_t lookupRespCache(char *key, size_t keyLen, unsigned long hash, char *dest){
+	if(!key || !dest) error("NULL argument");
+	respCacheEntryS *entry = &respCache->entries[hash & (RESP_CACHE_SLOTS-1)];
+	char resp[RESP_CACHE_MAX_LEN+1];
+	unsigned seq = atomic_load_explicit(&entry->seq, memory_order_acquire);
+	size_t len = atomic_load_explicit(&entry->respLen, memory_order_relaxed);
+
+	if((seq & 1) || atomic_load_explicit(&entry->keyHash, memory_order_relaxed)!=hash || len>RESP_CACHE_MAX_LEN) goto miss;
+	memcpy(resp, entry->resp, len);
+	atomic_thread_fence(memory_order_acquire);
+	if(atomic_load_explicit(&entry->seq, memory_order_relaxed)!=seq) goto miss;	//the entry changed while being copied
+	if(len<keyLen+2 || memcmp(resp+1, key, keyLen) || resp[keyLen+1]!=KEY_VALUE_SEPARATOR) goto miss;	//another key with the same hash
+
+	memcpy(dest, resp, len);
+	dest[len] = '\0';
+	atomic_fetch_add_explicit(&stats->cacheHits, 1, memory_order_relaxed);
+	return len;
+
+	miss:
+	atomic_fetch_add_explicit(&stats->cacheMisses, 1, memory_order_relaxed);
+	return 0;
+}
+
+
+
+/*
+ *  Saves the response of a search in the cache, replacing the one with the same hash.
+ *  If another search is filling the same entry, gives up.
+ *  (has to be called while holding the main read lock, right after finding the record)
+ *
+ *    'hash' = the hash of the key, returned by hashKey().
+ *    'resp' = the response, SUCCESS_RESP followed by "key:value".
+ *    'respLen' = the length of the response.
+ */
+
+void fillRespCache(unsigned long hash, char *resp, size_t respLen){
+	if(!resp) error("NULL argument");
+	if(respLen>RESP_CACHE_MAX_LEN) return;
+	respCacheEntryS *entry = &respCache->entries[hash & (RESP_CACHE_SLOTS-1)];
+	unsigned seq = atomic_load_explicit(&entry->seq, memory_order_relaxed);
+	if((seq & 1) || !atomic_compare_exchange_strong_explicit(&entry->seq, &seq, seq+1, memory_order_relaxed, memory_order_relaxed)) return;
+	atomic_thread_fence(memory_order_release);
+
+	atomic_store_explicit(&entry->keyHash, hash, memory_order_relaxed);
+	atomic_store_explicit(&entry->respLen, respLen, memory_order_relaxed);
+	memcpy(entry->resp, resp, respLen);
+	atomic_store_explicit(&entry->seq, seq+2, memory_order_release);
+}
+
+
+
+/*
+ *  Invalidates the cached response of a record that has been changed.
+ *  (has to be called after every change of the main dynamic array,
+ *  while still holding the main write lock)
+ *
+ *    'rec' = the changed record string, or its key.
+ */
+
+void invalidateRespCache(char *rec){
+	if(!rec) error("NULL argument");
+	unsigned long hash = hashKey(rec, strcspn(rec, (char[2]){KEY_VALUE_SEPARATOR, '\0'}));
+	respCacheEntryS *entry = &respCache->entries[hash & (RESP_CACHE_SLOTS-1)];
+	if(atomic_load_explicit(&entry->keyHash, memory_order_relaxed)!=hash) return;
+
+	atomic_fetch_add_explicit(&entry->seq, 1, memory_order_relaxed);	//no search can be filling it, they need the read lock
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&entry->keyHash, 0, memory_order_relaxed);
+	atomic_fetch_add_explicit(&entry->seq, 1, memory_order_release);
+	atomic_fetch_add_explicit(&stats->cacheInvalidations, 1, memory_order_relaxed);
+}
+
+
+
+/*
+ *  Invalidates all the cached responses.
+ *  (has to be called when the whole main dynamic array is replaced, while holding the main write lock)
+ */
+
+void clearRespCache(void){
+	for(unsigned long i=0; i<RESP_CACHE_SLOTS; i++){
+		respCacheEntryS *entry = &respCache->entries[i];
+		if(!atomic_load_explicit(&entry->keyHash, memory_order_relaxed)) continue;
+		atomic_fetch_add_explicit(&entry->seq, 1, memory_order_relaxed);
+		atomic_thread_fence(memory_order_release);
+		atomic_store_explicit(&entry->keyHash, 0, memory_order_relaxed);
+		atomic_fetch_add_explicit(&entry->seq, 1, memory_order_release);
+	}
+}
+
+
+
+/*
+ *  Counts a search of 'key' in the count-min sketch,
+ *  and updates the hot keys, if its estimated count is now one of the HOT_KEYS_TOP highest.
+ *  To keep the shared counters out of most searches, every thread counts
+ *  only one search every HOT_KEYS_SKETCH_SAMPLE, as HOT_KEYS_SKETCH_SAMPLE searches
+ *  (starting from a random one, so that short connections are counted too),
+ *  and to keep the lock of the hot keys rare, it's taken only
+ *  every HOT_KEYS_SAMPLE counted searches of the same key.
+ *  (the counts are estimates, good only for the keys searched much more than HOT_KEYS_SKETCH_SAMPLE times)
+ *
+ *    'key' = the key string.
+ *    'keyLen' = the length of the key, <= MAX_NAME_LEN.
+ *    'hash' = the hash of the key, returned by hashKey().
+ */
+
+void countHotKey(char *key, size_t keyLen, unsigned long hash){
+	if(!key) error("NULL argument");
+	unsigned long count = ULONG_MAX, c;
+	unsigned long h1 = hash & 0xFFFFFFFF, h2 = (hash >> 32) | 1;		//the rows use different combinations of the two halves
+	if(!hotKeySample) hotKeySample = getTimeNs();
+	if(++hotKeySample & (HOT_KEYS_SKETCH_SAMPLE-1)) return;
+	for(unsigned long i=0; i<HOT_KEYS_SKETCH_DEPTH; i++){
+		c = atomic_fetch_add_explicit(&respCache->sketch[i][(h1 + i * h2) & (HOT_KEYS_SKETCH_WIDTH-1)], HOT_KEYS_SKETCH_SAMPLE, memory_order_relaxed) + HOT_KEYS_SKETCH_SAMPLE;
+		if(c<count) count = c;
+	}
+	if(count & (HOT_KEYS_SAMPLE*HOT_KEYS_SKETCH_SAMPLE-1) || count<=atomic_load_explicit(&respCache->hotMin, memory_order_relaxed)) return;
+
+	while(atomic_flag_test_and_set_explicit(&respCache->hotLock, memory_order_acquire));
+	updateHotKeys(key, keyLen, count);
+	atomic_flag_clear_explicit(&respCache->hotLock, memory_order_release);
+}
+
+
+
+/*
+ *  Updates the count of a key in the min-heap of the hot keys,
+ *  adding it, or replacing the coldest one, if it's not already there.
+ *  (has to be called while holding the lock of the hot keys)
+ *
+ *    'key' = the key string.
+ *    'keyLen' = the length of the key, <= MAX_NAME_LEN.
+ *    'count' = the new estimated count of the key.
+ */
+
+void updateHotKeys(char *key, size_t keyLen, unsigned long count){
+	hotKeyS *hot = respCache->hot, tmp;
+	unsigned i, child;
+
+	for(i=0; i<respCache->nHot; i++) if(!strncmp(hot[i].key, key, keyLen) && hot[i].key[keyLen]=='\0') break;
+	if(i==respCache->nHot){
+		if(respCache->nHot<HOT_KEYS_TOP){							//adds it as a leaf, and moves it up
+			i = respCache->nHot++;
+			for(; i && hot[(i-1)/2].count>count; i = (i-1)/2) hot[i] = hot[(i-1)/2];
+			hot[i].count = count;
+			memcpy(hot[i].key, key, keyLen);
+			hot[i].key[keyLen] = '\0';
+			goto done;
+		}
+		if(count<=hot[0].count) return;
+		i = 0;														//replaces the coldest one
+		memcpy(hot[0].key, key, keyLen);
+		hot[0].key[keyLen] = '\0';
+	}
+	hot[i].count = count;
+
+	while((child = 2*i + 1) < respCache->nHot){						//the count only grows, so it can only move down
+		if(child+1<respCache->nHot && hot[child+1].count<hot[child].count) child++;
+		if(hot[i].count<=hot[child].count) break;
+		tmp = hot[i];
+		hot[i] = hot[child];
+		hot[child] = tmp;
+		i = child;
+	}
+
+	done:
+	atomic_store_explicit(&respCache->hotMin, respCache->nHot<HOT_KEYS_TOP ? 0 : hot[0].count, memory_order_relaxed);
+}
+
+
+
+/*
+ *  Forgets all the counts of the searched keys.
+ *  (the searches counted concurrently can be lost, or counted only partially)
+ */
+
+void resetHotKeys(void){
+	for(unsigned long i=0; i<HOT_KEYS_SKETCH_DEPTH; i++){
+		for(unsigned long j=0; j<HOT_KEYS_SKETCH_WIDTH; j++) atomic_store_explicit(&respCache->sketch[i][j], 0, memory_order_relaxed);
+	}
+	while(atomic_flag_test_and_set_explicit(&respCache->hotLock, memory_order_acquire));
+	respCache->nHot = 0;
+	atomic_store(&respCache->hotMin, 0);
+	atomic_flag_clear_explicit(&respCache->hotLock, memory_order_release);
+}
+
+
+
+/*
+ *  Compares two hot keys by count, from the highest. (used by qsort())
+ */
+
+int compareHotKeys(const void *a, const void *b){
+	unsigned long c1 = ((hotKeyS *) a)->count, c2 = ((hotKeyS *) b)->count;
+	return c1 > c2 ? -1 : c1 < c2;
+}
+
+
+
+/*
+ *  Prints the stats of the response cache, and the hot keys, from the hottest.
+ */
+
+void printRespCacheStats(void){
+	hotKeyS hot[HOT_KEYS_TOP];
+	unsigned n, used = 0;
+	unsigned long hits = atomic_load(&stats->cacheHits), misses = atomic_load(&stats->cacheMisses);
+
+	for(unsigned long i=0; i<RESP_CACHE_SLOTS; i++) if(atomic_load_explicit(&respCache->entries[i].keyHash, memory_order_relaxed)) used++;
+	while(atomic_flag_test_and_set_explicit(&respCache->hotLock, memory_order_acquire));
+	n = respCache->nHot;
+	memcpy(hot, respCache->hot, n * sizeof(hotKeyS));
+	atomic_flag_clear_explicit(&respCache->hotLock, memory_order_release);
+	qsort(hot, n, sizeof(hotKeyS), compareHotKeys);
+
+	printf("\nResponse cache: %u/%d entries used\n", used, RESP_CACHE_SLOTS);
+	printf("Hits = %lu,   Misses = %lu,   Hit rate = %.1f%%,   Invalidations = %lu\n", hits, misses, hits+misses ? 100.0 * hits / (hits+misses) : 0.0, atomic_load(&stats->cacheInvalidations));
+	printf("\nHot keys (estimated searches, since the last stats reset):\n");
+	if(!n) printf("None yet.\n");
+	for(unsigned i=0; i<n; i++) printf("%2u. '%s'   ~%lu\n", i+1, hot[i].key, hot[i].count);
+	printf("\n");
+	fflush(stdout);
+}
@@ -0,0 +1,126 @@
+
+#include "server_headers.h"
+
+
+int captureFd = -1;													//the file of the request capture, -1 if the capture is disabled
+unsigned long captureStartNs;
+
+__thread char *captureBuff = NULL;									//the requests captured by the thread, not yet written
+__thread size_t captureLen = 0;
+__thread long long captureFlushTime;								//when the buffered requests have to be written anyway
+
+
+
+/*
+ *  Starts capturing all the requests received by the server, except the logins,
+ *  so that they can be replayed later with the replay tool.
+ *  Every thread buffers its requests, and writes them with a single append,
+ *  so the requests of the different sessions can be out of order in the file,
+ *  but the ones of the same session are always in order.
+ *  (has to be called before forking the other processes, so that they share the file)
+ *
+ *    'filename' = the name of the capture file, truncated if it already exists.
+ */
+
+void initCapture(char *filename){
+	if(!filename) fatalError("NULL argument");
+	captureHeaderS header;
+	memset(&header, 0, sizeof(header));
+	header.magic = CAPTURE_MAGIC;
+	header.startTime = getTimeMs();
+
+	if((captureFd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0600))==-1) fatalError("open() failed");
+	if(write(captureFd, &header, sizeof(header))!=sizeof(header)) fatalError("write() failed");
+	captureStartNs = getTimeNs();
+}
+
+
+
+/*
+ *  Adds a request to the capture buffer of the current thread,
+ *  writing the buffer if it's full, or if its oldest request has waited CAPTURE_FLUSH_INTERVAL_MS.
+ *
+ *    'session' = the id of the session that sent the request.
+ *    'type' = the type of the request.
+ *    'data' = the data of the request, after the token.
+ *    'time' = when the request has been received, returned by getTimeNs().
+ */
+
+void captureRequest(unsigned long session, char type, char *data, unsigned long time){
+	if(!data) error("NULL argument");
+	captureRecS rec;
+	size_t len = strlen(data);
+
+	if(!captureBuff && !(captureBuff = malloc(CAPTURE_BUFF_SIZE))) error("malloc() failed");
+	if(captureLen + sizeof(rec) + len > CAPTURE_BUFF_SIZE) flushCapture();
+	if(!captureLen) captureFlushTime = getTimeMs() + CAPTURE_FLUSH_INTERVAL_MS;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.time = time - captureStartNs;
+	rec.session = session;
+	rec.len = len;
+	rec.type = type;
+	memcpy(captureBuff + captureLen, &rec, sizeof(rec));			//the records aren't aligned in the buffer
+	memcpy(captureBuff + captureLen + sizeof(rec), data, len);
+	captureLen += sizeof(rec) + len;
+
+	if(getTimeMs()>=captureFlushTime) flushCapture();
+}
+
+
+
+/*
+ *  Writes the capture buffer of the current thread to the capture file.
+ *  (with O_APPEND a single write() is never mixed with the ones of the other threads and processes)
+ */
+
+void flushCapture(void){
+	ssize_t written;
+	if(!captureLen) return;
+	while((written = write(captureFd, captureBuff, captureLen))==-1) if(errno!=EINTR) error("write() failed");
+	if((size_t) written!=captureLen) error("write() failed");
+	captureLen = 0;
+}
+
+
+
+/*
+ *  Waits for the next request on a socket, while the thread has captured requests not yet written,
+ *  and writes them if the request doesn't arrive before their CAPTURE_FLUSH_INTERVAL_MS expires,
+ *  so that they aren't held by an idle connection.
+ *  (called before blocking on the read of a request)
+ *
+ *    'socket' = the socket of the connection.
+ */
+
+void waitCapture(int socket){
+	struct pollfd pIn;
+	long long wait;
+	int ret;
+	if(!captureLen) return;
+	pIn.fd = socket;
+	pIn.events = POLLIN;
+	wait = captureFlushTime - getTimeMs();
+	if(wait>0){
+		while((ret = poll(&pIn, 1, (int) wait))<0){
+			if(errno!=EINTR) error("poll() failed");
+			if((wait = captureFlushTime - getTimeMs())<=0) break;
+		}
+		if(ret>0) return;
+	}
+	flushCapture();
+}
+
+
+
+/*
+ *  Writes the last captured requests of the current thread, and frees its buffer.
+ *  (called when a connection is closed)
+ */
+
+void closeCapture(void){
+	if(!captureBuff) return;
+	flushCapture();
+	free(captureBuff);
+	captureBuff = NULL;
+}
@@ -20,6 +20,10 @@ recS *initRecord(char *key, char *value){
 	
 	newRec->key = key;
 	newRec->value = value;
+	newRec->resp = NULL;
+	newRec->respLen = 0;
+	newRec->version = 0;
+	newRec->slab = NULL;
 	return newRec;
 }
 
@@ -29,14 +33,27 @@ recS *initRecord(char *key, char *value){
  *  Deletes a record.
  *  Deallocating both its key and value strings,
  *  and then the record itself.
+ *  (unless the strings are stored inline, after the record, see sliceToRecord())
+ *  If the record is in a slab, the slab is freed with its last record,
+ *  unless a compaction is still filling it.
  *
  *    'rec' = pointer to the record to delete
  */
 
 void delRecord(recS *rec){
 	if(!rec) error("NULL argument");
-	free(rec->key);
-	if(rec->value) free(rec->value);
+	slabS *slab = rec->slab;
+	if(slab){
+		if(!--slab->live && slab!=slab->dynArr->slab){
+			slab->dynArr->slabBytes -= sizeof(slabS) + slab->size;
+			free(slab);
+		}
+		return;
+	}
+	if(rec->key!=(char *) (rec + 1)){
+		free(rec->key);
+		if(rec->value) free(rec->value);
+	}
 	free(rec);
 }
 
@@ -62,6 +79,11 @@ recS **initArr(unsigned power){
 /*
  *  Initializes a dynamic array,
  *  already capable of holding 2^'power' records.
+ *  (or DYNARR_MAX_POSSIBLE_SIZE, if it's less)
+ *
+ *  The records are stored in segments of DYNARR_SEGMENT_SIZE pointers,
+ *  so the array grows allocating a single new segment,
+ *  without ever moving the records already stored.
  *  
  *    'power' = the power of 2 from which the starting size of the array will be calculated
  *  
@@ -71,9 +93,9 @@ recS **initArr(unsigned power){
 dArrS *initDynArr(unsigned power){
 	dArrS *newDynArr = calloc(1, sizeof(dArrS));
 	if(!newDynArr) error("calloc() failed");
-	newDynArr->arr = initArr(power);
-	newDynArr->maxSize = twoPow(power);								//set 'maxSize' to 2^'power'
-	newDynArr->power = power;
+	if(power>DYNARR_MAX_POSSIBLE_POWER) power = DYNARR_MAX_POSSIBLE_POWER;
+	do growDynArr(newDynArr);
+	while(newDynArr->maxSize < twoPow(power));
 	return newDynArr;
 }
 
@@ -82,7 +104,7 @@ dArrS *initDynArr(unsigned power){
 /*
  *  Deletes a Dynamic Array.
  *  Deallocating all of its records,
- *  the array, and the dynamicArrayStruct itself.
+ *  the segments, and the dynamicArrayStruct itself.
  *  (assumes that no other processes or threads are modifying the dynamic array)  
  *
  *    'dynArr' = pointer to the Dynamic Array to delete
@@ -90,13 +112,96 @@ dArrS *initDynArr(unsigned power){
 
 void delDynArr(dArrS *dynArr){
 	if(!dynArr) error("NULL argument");
-	for(unsigned long i=0; i<dynArr->size; i++) delRecord(dynArr->arr[i]);
-	free(dynArr->arr);
+	for(unsigned long i=0; i<dynArr->size; i++) delRecord(dynArrRec(dynArr, i));
+	for(unsigned i=0; i<dynArr->nSegs; i++) free(dynArr->segs[i]);
+	free(dynArr->slab);												//empty, since all its records have been deleted
 	free(dynArr);
 }
 
 
 
+/*
+ *  Expands a dynamic array by DYNARR_SEGMENT_SIZE records, allocating a new segment.
+ *  (assumes that no other processes or threads are modifying the dynamic array)  
+ *
+ *    'dynArr' = pointer to a dynamic array.
+ *
+ *    returns 0 if the array has been expanded, or
+ *    returns 1 if the maximum size of the dynamic array has been reached.
+ */
+
+int growDynArr(dArrS *dynArr){
+	if(!dynArr) error("NULL argument");
+	if(dynArr->nSegs>=DYNARR_MAX_SEGMENTS) return 1;				//check for limit size
+	dynArr->segs[dynArr->nSegs++] = initArr(DYNARR_SEGMENT_POWER);
+	dynArr->maxSize += DYNARR_SEGMENT_SIZE;
+	return 0;
+}
+
+
+
+/*
+ *  Shrinks a dynamic array by DYNARR_SEGMENT_SIZE records, freeing its last segment.
+ *  (assumes that the last segment is empty,
+ *  and that no other processes or threads are modifying the dynamic array)
+ *
+ *    'dynArr' = pointer to a dynamic array.
+ */
+
+void shrinkDynArr(dArrS *dynArr){
+	if(!dynArr) error("NULL argument");
+	if(dynArr->nSegs<=1 || dynArr->size > dynArr->maxSize - DYNARR_SEGMENT_SIZE) error("the last segment isn't empty");	//this error should never occur
+	free(dynArr->segs[--dynArr->nSegs]);
+	dynArr->maxSize -= DYNARR_SEGMENT_SIZE;
+}
+
+
+
+/*
+ *  Moves of one position forward all the records from index 'index',
+ *  segment by segment, carrying the last record of every segment to the next one.
+ *  (assumes that the dynamic array has space for one more record,
+ *  and that no other processes or threads are modifying it)
+ *
+ *    'dynArr' = pointer to a dynamic array.
+ *    'index' = the index left free, <= the size of the array.
+ */
+
+void openDynArrGap(dArrS *dynArr, unsigned long index){
+	unsigned long first = index >> DYNARR_SEGMENT_POWER, last = dynArr->size >> DYNARR_SEGMENT_POWER;
+	unsigned long from, to;
+	for(unsigned long s=last+1; s-- > first; ){						//from the last segment, so nothing is overwritten
+		from = s==first ? index & (DYNARR_SEGMENT_SIZE-1) : 0;
+		to = s==last ? dynArr->size & (DYNARR_SEGMENT_SIZE-1) : DYNARR_SEGMENT_SIZE-1;
+		memmove(dynArr->segs[s]+from+1, dynArr->segs[s]+from, (to-from)*sizeof(recS *));
+		if(s!=first) dynArr->segs[s][0] = dynArr->segs[s-1][DYNARR_SEGMENT_SIZE-1];
+	}
+}
+
+
+
+/*
+ *  Moves of one position backward all the records after index 'index', overwriting it,
+ *  segment by segment, carrying the first record of every segment to the previous one.
+ *  (assumes that no other processes or threads are modifying the dynamic array)
+ *
+ *    'dynArr' = pointer to a dynamic array.
+ *    'index' = the index to overwrite, < the size of the array.
+ */
+
+void closeDynArrGap(dArrS *dynArr, unsigned long index){
+	unsigned long first = index >> DYNARR_SEGMENT_POWER, last = (dynArr->size-1) >> DYNARR_SEGMENT_POWER;
+	unsigned long from, to;
+	for(unsigned long s=first; s<=last; s++){
+		from = s==first ? index & (DYNARR_SEGMENT_SIZE-1) : 0;
+		to = s==last ? (dynArr->size-1) & (DYNARR_SEGMENT_SIZE-1) : DYNARR_SEGMENT_SIZE-1;
+		memmove(dynArr->segs[s]+from, dynArr->segs[s]+from+1, (to-from)*sizeof(recS *));
+		if(s!=last) dynArr->segs[s][DYNARR_SEGMENT_SIZE-1] = dynArr->segs[s+1][0];
+	}
+}
+
+
+
 /*
  *  Appends a record to a Dynamic Array.
  *  (checking if the array needs to be expanded)
@@ -111,16 +216,8 @@ void delDynArr(dArrS *dynArr){
 
 int appendRecToDynArr(recS *rec, dArrS *dynArr){
 	if(!rec || !dynArr) error("NULL argument");
-	if(dynArr->size+1 > dynArr->maxSize){							//checks if the dynamic array needs to be expanded
-		if(dynArr->power>=DYNARR_MAX_POSSIBLE_POWER) return 1;		//check for limit size
-		recS **newArr = initArr(dynArr->power+1);					//initialize an array double the size of the current one
-		memcpy(newArr, dynArr->arr, dynArr->maxSize * sizeof(recS *)); //move all the records to the new array
-		free(dynArr->arr);
-		dynArr->arr = newArr;
-		dynArr->power++;
-		dynArr->maxSize <<= 1;
-	}
-	dynArr->arr[dynArr->size] = rec;								//append the record
+	if(dynArr->size+1 > dynArr->maxSize && growDynArr(dynArr)) return 1;	//checks if the dynamic array needs to be expanded
+	dynArrRec(dynArr, dynArr->size) = rec;							//append the record
 	dynArr->size++;
 	return 0;
 }
@@ -157,19 +254,19 @@ int findIndexFromKeyRecursive(char *key, dArrS *dynArr, unsigned long *retVal, u
 		if(diff<=0){
 			if(diff<0) error("This error should never occur");
 			*retVal = p1;
-			return !strcmp(key, dynArr->arr[p1]->key);
+			return !strcmp(key, dynArrRec(dynArr, p1)->key);
 		}
-		cmp = strcmp(key, dynArr->arr[p1]->key);
+		cmp = strcmp(key, dynArrRec(dynArr, p1)->key);
 		if(cmp>0){
 			*retVal = p2;
-			return !strcmp(key, dynArr->arr[p2]->key);
+			return !strcmp(key, dynArrRec(dynArr, p2)->key);
 		}
 		*retVal = p1;
 		return !cmp;
 	}
 
 	unsigned long half = (diff>>1) + p1;							//assign to 'half', the index between 'p1' and 'p2'
-	cmp = strcmp(key, dynArr->arr[half]->key);
+	cmp = strcmp(key, dynArrRec(dynArr, half)->key);
 	if(cmp<0) p2 = half;											//if 'key' is "less" than the one at index 'half', 'p2' = 'half'
 	else if(cmp>0) p1 = half;										//else if it's "bigger", 'p1' = 'half'
 	else{															//if it's equal, the result has been found
@@ -197,7 +294,7 @@ int findIndexFromKey(char *key, dArrS *dynArr, unsigned long *retVal){
 	if(!key || !dynArr || !retVal) error("NULL argument");
 	*retVal = 0;
 	if(!dynArr->size) return 0;
-	if(strcmp(key, dynArr->arr[dynArr->size-1]->key)>0){
+	if(strcmp(key, dynArrRec(dynArr, dynArr->size-1)->key)>0){
 		*retVal = dynArr->size;
 		return 0;
 	}	
@@ -209,6 +306,8 @@ int findIndexFromKey(char *key, dArrS *dynArr, unsigned long *retVal){
 /*
  *  Adds a record to a dynamic array.
  *  (checking if the array needs to be expanded)
+ *  If a record with the same key already exists it's overwritten.
+ *  (the version of the record has to be already set by the caller)
  *  (assumes that no other processes or threads are modifying the dynamic array)  
  *
  *    'rec' = pointer to an already allocated valid record.
@@ -222,28 +321,19 @@ int addRecToDynArr(recS *rec, dArrS *dynArr){
 	if(!rec || !dynArr) error("NULL argument");
 
 	/* if the dynamic array is empty or the record should be placed last, append the record */
-	if(!dynArr->size || strcmp(rec->key, dynArr->arr[dynArr->size-1]->key)>0)
+	if(!dynArr->size || strcmp(rec->key, dynArrRec(dynArr, dynArr->size-1)->key)>0)
 		return appendRecToDynArr(rec, dynArr);
 
 	unsigned long index;
 	if(findIndexFromKey(rec->key, dynArr, &index)){					//if there's already a record with the same key, overwrites it
-		delRecord(dynArr->arr[index]);
-		dynArr->arr[index] = rec;
+		delRecord(dynArrRec(dynArr, index));
+		dynArrRec(dynArr, index) = rec;
 		return 0;
 	}
 
-	if(dynArr->size+1 > dynArr->maxSize){							//check if the dynamic array needs to be expanded
-		if(dynArr->power>=DYNARR_MAX_POSSIBLE_POWER) return 1;		//check for limit size
-		recS **newArr = initArr(dynArr->power+1);					//initialize an array double the size of the current one
-		memcpy(newArr, dynArr->arr, index*sizeof(recS *));			//correctly move all the records
-		memcpy(newArr+index+1, dynArr->arr+index, (dynArr->size-index)*sizeof(recS *));
-		free(dynArr->arr);
-		dynArr->arr = newArr;
-		dynArr->power++;
-		dynArr->maxSize <<= 1;
-	}																//move of one position, the records after where the new one will be placed
-	else memmove(dynArr->arr+index+1, dynArr->arr+index, (dynArr->size-index)*sizeof(recS *));
-	dynArr->arr[index] = rec;																
+	if(dynArr->size+1 > dynArr->maxSize && growDynArr(dynArr)) return 1;	//check if the dynamic array needs to be expanded
+	openDynArrGap(dynArr, index);									//move of one position, the records after where the new one will be placed
+	dynArrRec(dynArr, index) = rec;
 	dynArr->size++;
 	return 0;
 }
@@ -252,8 +342,9 @@ int addRecToDynArr(recS *rec, dArrS *dynArr){
 
 /*
  *  Removes and deletes the record with key string 'key' from a dynamic array.
- *  (the dimensions of the dynamic array will not be eventually halfed,
- *  because it assumes that the space will later be re-used)
+ *  When two whole segments at the end are empty, the last one is freed:
+ *  keeping one empty segment, the array doesn't shrink and grow again
+ *  when a record is repeatedly removed and added at a segment boundary.
  *  (assumes that no other processes or threads are modifying the dynamic array)  
  *
  *  'key' = the key of the record that has to be removed.
@@ -267,16 +358,91 @@ int removeRecFromDynArr(char *key, dArrS *dynArr){
 	unsigned long index;
 	if(!findIndexFromKey(key, dynArr, &index)) return 1;			//if there's not a record with the string key 'key' return 1
 
-	delRecord(dynArr->arr[index]);									//delete record
-	if(index+1<dynArr->size) memmove(dynArr->arr+index, dynArr->arr+index+1, (dynArr->size-index-1)*sizeof(recS *)); 
+	delRecord(dynArrRec(dynArr, index));							//delete record
+	if(index+1<dynArr->size) closeDynArrGap(dynArr, index);
 	else if(index+1>dynArr->size) fatalError("This error should never occur"); //paranoic error
 
 	dynArr->size--;
+	if(dynArr->nSegs>1 && dynArr->size + 2*DYNARR_SEGMENT_SIZE <= dynArr->maxSize) shrinkDynArr(dynArr);
 	return 0;
 }
 
 
 
+/*
+ *  Returns the version of the record with key string 'key'.
+ *  (assumes that no other processes or threads are modifying the dynamic array)  
+ *
+ *    'key' = pointer to a valid key string.
+ *    'dynArr' = pointer to a dynamic array.
+ *
+ *    returns the version of the record, or
+ *    returns 0 if there isn't a record with key string 'key'.
+ */
+
+unsigned long getRecVersion(char *key, dArrS *dynArr){
+	unsigned long index;
+	if(!findIndexFromKey(key, dynArr, &index)) return 0;
+	return dynArrRec(dynArr, index)->version;
+}
+
+
+
+/*
+ *  Adds a record to a dynamic array, only if the version of the record
+ *  currently stored with the same key is 'expVersion'.
+ *  (0 means that a record with the same key should not exist)
+ *  (assumes that no other processes or threads are modifying the dynamic array)  
+ *
+ *    'rec' = pointer to an already allocated valid record.
+ *    'dynArr' = pointer to a dynamic array.
+ *    'expVersion' = the expected version.
+ *    'curVersion' = pointer to a variable where the version
+ *      of the stored record will be saved, after the call.
+ *
+ *    returns 0 if the record has been successfully added,
+ *    returns 1 if the maximum size of the dynamic array has been reached, or
+ *    returns 2 if the versions don't match (and the record has not been added).
+ */
+
+int addRecToDynArrIfVersion(recS *rec, dArrS *dynArr, unsigned long expVersion, unsigned long *curVersion){
+	if(!rec || !dynArr || !curVersion) error("NULL argument");
+	*curVersion = getRecVersion(rec->key, dynArr);
+	if(*curVersion!=expVersion) return 2;
+	if(addRecToDynArr(rec, dynArr)) return 1;
+	*curVersion = rec->version;
+	return 0;
+}
+
+
+
+/*
+ *  Removes and deletes the record with key string 'key' from a dynamic array,
+ *  only if its version is 'expVersion'.
+ *  (assumes that no other processes or threads are modifying the dynamic array)  
+ *
+ *    'key' = the key of the record that has to be removed.
+ *    'dynArr' = the dynamic array from which has to be removed.
+ *    'expVersion' = the expected version.
+ *    'curVersion' = pointer to a variable where the current version
+ *      of the record will be saved. (0 if it doesn't exist)
+ *
+ *    returns 0 the record has been successfully removed,
+ *    returns 1 if there isn't a record with key string 'key', or
+ *    returns 2 if the versions don't match (and the record has not been removed).
+ */
+
+int removeRecFromDynArrIfVersion(char *key, dArrS *dynArr, unsigned long expVersion, unsigned long *curVersion){
+	if(!key || !dynArr || !curVersion) error("NULL argument");
+	*curVersion = getRecVersion(key, dynArr);
+	if(!*curVersion) return 1;
+	if(*curVersion!=expVersion) return 2;
+	*curVersion = 0;
+	return removeRecFromDynArr(key, dynArr);
+}
+
+
+
 /*
  *  Prints a dynamic array, and its stats.
  *
@@ -285,14 +451,142 @@ int removeRecFromDynArr(char *key, dArrS *dynArr){
 
 void printDynArr(dArrS *dynArr){
 	if(!dynArr) error("NULL argument");
-	printf("\nSize = %lu,   Max Size = %lu,   Power = %u\n\n", dynArr->size, dynArr->maxSize, dynArr->power);
-	for(unsigned long i=0; i<dynArr->size; i++) printf("[%lu] Key: \"%s\",  Value: \"%s\"\n", i, dynArr->arr[i]->key, dynArr->arr[i]->value);
+	printf("\nSize = %lu,   Max Size = %lu,   Segments = %u\n\n", dynArr->size, dynArr->maxSize, dynArr->nSegs);
+	for(unsigned long i=0; i<dynArr->size; i++) printf("[%lu] Key: \"%s\",  Value: \"%s\",  Version: %lu\n", i, dynArrRec(dynArr, i)->key, dynArrRec(dynArr, i)->value, dynArrRec(dynArr, i)->version);
 	printf("\n\n");
 	fflush(stdout);
 }
 
 
 
+/*
+ *  Copies a record in the slab being filled by the compaction of a dynamic array,
+ *  with the same layout of sliceToRecord(), and deletes the original one.
+ *  A new slab is allocated when the current one is full, big enough for
+ *  the records left to relocate, estimated from this one, up to DYNARR_SLAB_SIZE bytes.
+ *  (assumes that no other processes or threads are using the dynamic array)
+ *
+ *    'rec' = pointer to a record of 'dynArr'.
+ *    'dynArr' = pointer to the dynamic array being compacted.
+ *    'left' = the records left to relocate, including this one.
+ *
+ *    returns a pointer to the relocated record, that has to replace 'rec' in the array.
+ */
+
+recS *relocateRecord(recS *rec, dArrS *dynArr, unsigned long left){
+	if(!rec || !dynArr) error("NULL argument");
+	size_t keyLen = strlen(rec->key), valueLen = rec->value ? strlen(rec->value) : 0;
+	size_t size = (sizeof(recS) + keyLen + 1 + 1 + keyLen + 1 + valueLen + 1 + 7) & ~7UL;	//the next record has to be aligned
+	slabS *slab = dynArr->slab;
+
+	if(!slab || slab->used + size > slab->size){
+		dynArr->slab = NULL;
+		if(slab && !slab->live){									//all its records have been deleted while it was being filled
+			dynArr->slabBytes -= sizeof(slabS) + slab->size;
+			free(slab);
+		}
+		size_t slabSize = left < DYNARR_SLAB_SIZE / size ? left * size : DYNARR_SLAB_SIZE;
+		if(slabSize<size) slabSize = size;
+		if(!(slab = malloc(sizeof(slabS) + slabSize))) error("malloc() failed");
+		slab->dynArr = dynArr;
+		slab->size = slabSize;
+		slab->used = 0;
+		slab->live = 0;
+		dynArr->slab = slab;
+		dynArr->slabBytes += sizeof(slabS) + slabSize;
+	}
+	recS *newRec = (recS *) (slab->data + slab->used);
+	slab->used += size;
+	slab->live++;
+
+	char *p = (char *) (newRec + 1);
+	memcpy(p, rec->key, keyLen + 1);
+	newRec->key = p;
+	p += keyLen + 1;
+	p[0] = SUCCESS_RESP;
+	memcpy(p + 1, rec->key, keyLen);
+	p[1 + keyLen] = KEY_VALUE_SEPARATOR;
+	if(valueLen) memcpy(p + 1 + keyLen + 1, rec->value, valueLen);
+	p[1 + keyLen + 1 + valueLen] = '\0';
+	newRec->resp = p;
+	newRec->respLen = 1 + keyLen + 1 + valueLen;
+	newRec->value = valueLen ? p + 1 + keyLen + 1 : NULL;
+	newRec->version = rec->version;
+	newRec->slab = slab;
+
+	delRecord(rec);
+	return newRec;
+}
+
+
+
+/*
+ *  Compacts a dynamic array, a batch of records at a time:
+ *  relocates the records in slabs, densely and in key order,
+ *  so that the heap holes left by the deleted records can be reused or returned,
+ *  and frees the empty segments beyond the one kept by removeRecFromDynArr().
+ *  Between two batches the array can be modified, the cursor keeps the position by key.
+ *  (assumes that no other processes or threads are using the dynamic array)
+ *
+ *    'dynArr' = pointer to a dynamic array.
+ *    'cursor' = pointer to a buffer of MAX_NAME_LEN+1 chars, with the last key relocated
+ *      by the previous batch, or an empty string to start the compaction, updated after the call.
+ *    'n' = the maximum number of records to relocate, > 0.
+ *
+ *    returns 0 if there are still records to relocate, or
+ *    returns 1 if the compaction is complete.
+ */
+
+int compactDynArr(dArrS *dynArr, char *cursor, unsigned long n){
+	if(!dynArr || !cursor) error("NULL argument");
+	if(!n) error("invalid batch size");
+	unsigned long index = 0;
+	if(*cursor!='\0' && findIndexFromKey(cursor, dynArr, &index)) index++;
+
+	for(; n && index<dynArr->size; n--, index++) dynArrRec(dynArr, index) = relocateRecord(dynArrRec(dynArr, index), dynArr, dynArr->size - index);
+	if(index<dynArr->size){
+		strcpy(cursor, dynArrRec(dynArr, index-1)->key);
+		return 0;
+	}
+
+	slabS *slab = dynArr->slab;										//the last slab is no more being filled
+	dynArr->slab = NULL;
+	if(slab && !slab->live){
+		dynArr->slabBytes -= sizeof(slabS) + slab->size;
+		free(slab);
+	}
+	while(dynArr->nSegs>1 && dynArr->size + 2*DYNARR_SEGMENT_SIZE <= dynArr->maxSize) shrinkDynArr(dynArr);
+	return 1;
+}
+
+
+
+/*
+ *  Calculates the memory used by a dynamic array.
+ *  (assumes that no other processes or threads are modifying the dynamic array)
+ *
+ *    'dynArr' = pointer to a dynamic array.
+ *    'recBytes' = pointer to where will be saved the bytes of the records:
+ *      their allocations, and the slabs where they have been relocated.
+ *
+ *    returns the bytes of the array itself, its struct and its segments.
+ */
+
+size_t getDynArrMemory(dArrS *dynArr, size_t *recBytes){
+	if(!dynArr || !recBytes) error("NULL argument");
+	recS *rec;
+	*recBytes = dynArr->slabBytes;
+	for(unsigned long i=0; i<dynArr->size; i++){
+		rec = dynArrRec(dynArr, i);
+		if(rec->slab) continue;
+		*recBytes += malloc_usable_size(rec);
+		if(rec->key!=(char *) (rec + 1)) *recBytes += malloc_usable_size(rec->key) + (rec->value ? malloc_usable_size(rec->value) : 0);
+	}
+	return sizeof(dArrS) + dynArr->nSegs * DYNARR_SEGMENT_SIZE * sizeof(recS *);
+}
+
+
+
 /*
  *  Calculates the minimum needed power
  *  of the dynamic array to store 'n' records.
@@ -351,9 +645,51 @@ size_t recordToString(recS *rec, char *dest){
 
 
 /*
- *  Converts a valid generic record string to a record.
+ *  Converts a record slice to a record, with a single allocation:
+ *  after the record struct are copied its key, and its search response,
+ *  a SUCCESS_RESP followed by the "key:value" bytes, where the value points.
+ *  So a search can send the response as it is, without building it every time.
  *
  *  (usefull for receiving records from clients, or importing them)
+ *
+ *    'slice' = pointer to the slice, filled by parseRecordString(),
+ *      with the value right after the key and its separator.
+ *
+ *    returns a pointer to the newly allocated record
+ */
+
+recS *sliceToRecord(recSliceS *slice){
+	if(!slice) error("NULL argument");
+	if(slice->value!=slice->key + slice->keyLen + 1) error("invalid slice");	//this error should never occur
+	size_t len = slice->keyLen + 1 + slice->valueLen;
+	if(len>MAX_REC_STR_LEN) error("invalid string");				//superfluous, this error should never occur
+
+	recS *newRec = malloc(sizeof(struct recordStruct) + slice->keyLen + 1 + len + 2);
+	if(!newRec) error("malloc() failed");
+	char *p = (char *) (newRec + 1);
+	memcpy(p, slice->key, slice->keyLen);
+	p[slice->keyLen] = '\0';
+	newRec->key = p;
+
+	p += slice->keyLen + 1;
+	p[0] = SUCCESS_RESP;
+	memcpy(p + 1, slice->key, len);
+	p[1 + slice->keyLen] = KEY_VALUE_SEPARATOR;
+	p[1 + len] = '\0';
+	newRec->resp = p;
+	newRec->respLen = 1 + len;
+
+	newRec->value = slice->valueLen ? p + 1 + slice->keyLen + 1 : NULL;
+	newRec->version = 0;
+	newRec->slab = NULL;
+	return newRec;
+}
+
+
+
+/*
+ *  Converts a valid generic record string to a record.
+ *
  *  (assumes that the record string it's already been checked and it's valid)
  *
  *    'str' = string to convert.
@@ -363,40 +699,46 @@ size_t recordToString(recS *rec, char *dest){
 
 recS *stringToRecord(char *str){
 	if(!str) error("NULL argument");
+	recSliceS slice;
+
+	char *p = strchr(str, KEY_VALUE_SEPARATOR);
+	if(!p) error("invalid string");									//this error should never occur
+	slice.key = str;
+	slice.keyLen = p - str;
+	slice.value = p + 1;
+	slice.valueLen = strlen(p + 1);
+	return sliceToRecord(&slice);
+}
+
 
-	char *p = str;
-	while(*p!=KEY_VALUE_SEPARATOR && *p!='\0') p++;
-	if(*p=='\0') error("invalid string");							//this error should never occur
-	
-	size_t keyLen, valueLen;
-	*p = '\0';
-	keyLen = p - str;
-	valueLen = strlen(p+1);
-	if(keyLen+valueLen+1>MAX_REC_STR_LEN) error("invalid string");	//superfluous, this error should never occur
-	
-	char *key = malloc((keyLen + 1) * sizeof(char));
-	if(!key) error("malloc() failed"); 
-	strcpy(key, str);
-	*p = KEY_VALUE_SEPARATOR;
-
-	char *value;
-	if(!valueLen){
-		value = NULL;
-		*++p = '\0';
-	}
-	else{
-		value = malloc((valueLen + 1) * sizeof(char));
-		if(!value) error("malloc() failed");
-		strcpy(value, p+1);
-	}
 
-	return initRecord(key, value);	
+/*
+ *  Writes the response to a search of 'rec' in 'dest':
+ *  a SUCCESS_RESP followed by the "key:value" string.
+ *  (copies the response stored with the record, or builds it, if the record doesn't have one)
+ *  (assumes that the buffer pointed by 'dest' has a size of BUFF_SIZE)
+ *
+ *    'rec' = a pointer to a main-record.
+ *    'dest' = a pointer to a buffer where the response will be saved.
+ *
+ *    returns the size of the response.
+ */
+
+size_t recordToResp(recS *rec, char *dest){
+	if(!rec || !dest) fatalError("NULL argument");
+	if(!rec->resp){
+		dest[0] = SUCCESS_RESP;
+		return recordToString(rec, dest+1) + 1;
+	}
+	memcpy(dest, rec->resp, rec->respLen + 1);
+	return rec->respLen;
 }
 
 
 
 /*
  *  Exports the dynamic array pointed by 'dynArr' to a file named 'filename'.
+ *  Every record is written as a "key:value" line, preceded by "version;" if it has a version.
  *  Writes the data to a temporary file, and then "renames" it to the final one,
  *  so that if exporting fails, the last export is still valid.
  *  (overwrites the file, if it already exists)
@@ -418,9 +760,12 @@ void exportDynArr(dArrS *dynArr, char *filename){
 	char *p;
 	ssize_t writed;
 	size_t recordSize, toWrite;
-	char buff[BUFF_SIZE];
+	char buff[BUFF_SIZE+MAX_VERSION_LEN+1];
+	recS *rec;
 	for(unsigned long i=0; i<dynArr->size; i++){
-		recordSize = recordToString(dynArr->arr[i], buff);
+		rec = dynArrRec(dynArr, i);
+		recordSize = rec->version ? sprintf(buff, "%lu%c", rec->version, QUERY_ITEMS_SEPARATOR) : 0;
+		recordSize += recordToString(rec, buff + recordSize);
 		buff[recordSize++] = '\n';
 		buff[recordSize] = '\0';
 
@@ -432,17 +777,18 @@ void exportDynArr(dArrS *dynArr, char *filename){
 			p += writed;
 		}
 	}
+	if(fsync(fd)==-1) fatalError("fsync() failed");					//the export has to be complete on disk, before replacing the old one
 	if(close(fd)==-1) fatalError("close() failed");
 
-	if(unlink(filename)==-1 && errno!=ENOENT) fatalError("unlink() failed");
-	if(link(tmpFilename, filename)==-1) fatalError("link() failed");
-	if(unlink(tmpFilename)==-1) fatalError("unlink() failed");
+	if(rename(tmpFilename, filename)==-1) fatalError("rename() failed");
 }
 
 
 
 /*
- *  Imports a dynamic array from a file.
+ *  Imports a dynamic array from a file, written by exportDynArr().
+ *  The main records without a version (written by hand) get IMPORTED_REC_VERSION,
+ *  that is never the version of a write.
  *  (assumes that no other processes or threads are modifying the file)
  *
  *  'filename' = the name of the file frow which will be imported the dynamic array.
@@ -464,12 +810,29 @@ dArrS *importDynArr(char *filename, unsigned char dynArrType){
 
 	char *p1;
 	char *p2 = NULL;
+	char *sep;
 	char buff[BUFF_SIZE];
+	recSliceS slice;
+	recS *rec;
+	unsigned long version;
 	while(readLineFromFile(fd, buff, &p1, &p2)!=-1){				//read all the lines of the file
-		if(!checkRecordString(p1, dynArrType)){						//if the record is valid, add it to the dynamic array
-			if(addRecToDynArr(stringToRecord(p1), dynArr)) fatalError("Maximum size of dynamic array reached while importing it.");
+		version = dynArrType==MAIN_TYPE ? IMPORTED_REC_VERSION : 0;
+		if(dynArrType==MAIN_TYPE && (sep = strchr(p1, QUERY_ITEMS_SEPARATOR))){	//the separator can't be in a main record
+			*sep = '\0';
+			if(checkVersionString(p1) || !(version = strtoul(p1, NULL, 10))){
+				*sep = QUERY_ITEMS_SEPARATOR;
+				goto invalid;
+			}
+			p1 = sep + 1;
+		}
+		if(!parseRecordString(p1, dynArrType, &slice)){				//if the record is valid, add it to the dynamic array
+			rec = sliceToRecord(&slice);
+			rec->version = version;
+			if(addRecToDynArr(rec, dynArr)) fatalError("Maximum size of dynamic array reached while importing it.");
+			continue;
 		}
-		else printf("Tried importing an invalid %s-record: '%s'\n", dynArrType==MAIN_TYPE?"main":"user", p1);
+		invalid:
+		printf("Tried importing an invalid %s-record: '%s'\n", dynArrType==MAIN_TYPE?"main":"user", p1);
 	}
 
 	close(fd);
@@ -478,43 +841,81 @@ dArrS *importDynArr(char *filename, unsigned char dynArrType){
 
 
 
+/*
+ *  Exports a sequence number to a file named 'filename'.
+ *  Writes the data to a temporary file, and then "renames" it to the final one,
+ *  so that if exporting fails, the last export is still valid.
+ *
+ *    'seq' = the sequence number to export.
+ *    'filename' = the name of the file where will be exported 'seq'.
+ */
+
+void exportSeq(unsigned long seq, char *filename){
+	if(!filename) fatalError("NULL argument");
+	char tmpFilename[strlen(filename)+5];
+	sprintf(tmpFilename, "%s.tmp", filename);
+
+	int fd;
+	if((fd = open(tmpFilename, O_WRONLY | O_CREAT | O_TRUNC, 0600))==-1) fatalError("open() failed");
+
+	char buff[MAX_VERSION_LEN+2];
+	int l = sprintf(buff, "%lu\n", seq);
+	while(write(fd, buff, l)!=l) if(errno!=EINTR) fatalError("write() failed");
+	if(fsync(fd)==-1) fatalError("fsync() failed");
+	if(close(fd)==-1) fatalError("close() failed");
+
+	if(rename(tmpFilename, filename)==-1) fatalError("rename() failed");
+}
+
+
+
+/*
+ *  Imports a sequence number from a file.
+ *
+ *    'filename' = the name of the file from which will be imported the sequence number.
+ *
+ *    returns the imported sequence number, or
+ *    returns 0 if the file doesn't exist or it's not valid.
+ */
+
+unsigned long importSeq(char *filename){
+	if(!filename) error("NULL argument");
+	int fd;
+	if((fd = open(filename, O_RDONLY))==-1){
+		if(errno==ENOENT) return 0;
+		error("open() failed");
+	}
+
+	char *p1;
+	char *p2 = NULL;
+	char buff[BUFF_SIZE];
+	unsigned long seq = 0;
+	if(readLineFromFile(fd, buff, &p1, &p2)>0 && !checkSeqString(p1)) seq = strtoul(p1, NULL, 10);
+	else printf("Tried importing an invalid sequence number from '%s'\n", filename);
+
+	close(fd);
+	return seq;
+}
+
+
+
 /*
  *  This function will be called if a fatal error happened the last time the program was run.
  *  Recovers the main dynamic array, starting by importing the last valid export,
- *  and then replaying the actions done before the fatal-error.
+ *  and then replaying the WAL records of the actions done after it, and before the fatal-error.
+ *  Every replayed change is also appended to the change feed,
+ *  so that the subscribers can resume from a position covered by the WAL.
  *  (assumes that no other processes or threads are modifying the files)
  *
+ *  'fromLsn' = the log sequence number of the last WAL record included in the export.
+ *
  *  returns the recovered dynamic array.
  */
 
-dArrS *recoverMainDynArr(void){
+dArrS *recoverMainDynArr(unsigned long fromLsn){
 	printNow("Recovering main dynamic array.\n");
 	dArrS *dynArr = importDynArr(MAIN_DB_FILENAME, MAIN_TYPE);		//import the last valid export
-	
-	int fd;
-	if((fd = open(RECOVERY_DATA_FILENAME, O_RDONLY | O_CREAT, 0600))==-1) error("open() failed");
-
-	char *p;
-	char *p1;
-	char *p2 = NULL;
-	char buff[BUFF_SIZE];
-	size_t readed;
-	while((readed = readLineFromFile(fd, buff, &p1, &p2))!=-1){		//read all the lines of the file
-		if(readed>0 && !checkRecordString(p1+1, MAIN_TYPE)){		//checks if the record is valid
-			if(p1[0]=='1'){											//if the first character of the line is '1', add the record
-				if(addRecToDynArr(stringToRecord(p1+1), dynArr)) fatalError("Maximum size of dynamic array reached while recovering it.")
-				continue;
-			}
-			else if(p1[0]=='0'){									//else if it's '0' remove the record
-				p = p1 + 1;
-				while(*p!=KEY_VALUE_SEPARATOR && *p!='\0') p++;
-				*p = '\0';
-				removeRecFromDynArr(p1+1, dynArr);
-				continue;
-			}
-		}
-		printf("Tried recovering an invalid main-record: '%s'\n", p1);
-	}
+	replayWal(dynArr, fromLsn);
 	printNow("Successfully recovered main dynamic array.\n");
 	return dynArr;
 }
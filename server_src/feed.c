@@ -0,0 +1,200 @@
+
+#include "server_headers.h"
+
+
+feedEntryS feedHistory[FEED_HISTORY_LEN];							//circular buffer with the last committed changes
+unsigned long feedFirstSeq, feedLastSeq;
+pthread_mutex_t feedMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t feedCond = PTHREAD_COND_INITIALIZER;
+
+
+
+/*
+ *  Returns the current time, in milliseconds since the epoch.
+ */
+
+long long getTimeMs(void){
+	struct timespec t;
+	if(clock_gettime(CLOCK_REALTIME, &t)==-1) fatalError("clock_gettime() failed");
+	return (long long) t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+
+
+/*
+ *  Initializes, or resets, the change feed.
+ *  (has to be called before any other feed function)
+ *  The eventual subscribers that can't continue from 'lastSeq', will be disconnected.
+ *
+ *    'lastSeq' = the sequence number of the last change
+ *      already included in the last valid export.
+ */
+
+void initFeed(unsigned long lastSeq){
+	if(pthread_mutex_lock(&feedMutex)) fatalError("pthread_mutex_lock() failed");
+	feedLastSeq = lastSeq;
+	feedFirstSeq = lastSeq + 1;
+	if(pthread_cond_broadcast(&feedCond)) fatalError("pthread_cond_broadcast() failed");
+	if(pthread_mutex_unlock(&feedMutex)) fatalError("pthread_mutex_unlock() failed");
+}
+
+
+
+/*
+ *  Appends a committed change of the main dynamic array to the feed,
+ *  assigning it the next sequence number, and wakes up the subscribers.
+ *  (has to be called while holding the main write lock,
+ *  so that the sequence numbers follow the commit order)
+ *
+ *    'type' = FEED_ADD_LINE or FEED_DEL_LINE.
+ *    'rec' = the added record string, or the key of the removed record.
+ *    'version' = the version of the added record.
+ *
+ *    returns the sequence number of the change.
+ */
+
+unsigned long appendToFeed(char type, char *rec, unsigned long version){
+	if(!rec) error("NULL argument");
+	if(pthread_mutex_lock(&feedMutex)) fatalError("pthread_mutex_lock() failed");
+
+	feedEntryS *entry = &feedHistory[++feedLastSeq % FEED_HISTORY_LEN];
+	entry->seq = feedLastSeq;
+	entry->time = getTimeMs();
+	entry->type = type;
+	entry->version = version;
+	strncpy(entry->rec, rec, MAX_MAIN_REC_STR_LEN);
+	entry->rec[MAX_MAIN_REC_STR_LEN] = '\0';
+	unsigned long seq = feedLastSeq;
+
+	if(pthread_cond_broadcast(&feedCond)) fatalError("pthread_cond_broadcast() failed");
+	if(pthread_mutex_unlock(&feedMutex)) fatalError("pthread_mutex_unlock() failed");
+	return seq;
+}
+
+
+
+/*
+ *  Returns the sequence number of the last committed change.
+ */
+
+unsigned long getFeedLastSeq(void){
+	if(pthread_mutex_lock(&feedMutex)) fatalError("pthread_mutex_lock() failed");
+	unsigned long seq = feedLastSeq;
+	if(pthread_mutex_unlock(&feedMutex)) fatalError("pthread_mutex_unlock() failed");
+	return seq;
+}
+
+
+
+/*
+ *  Returns the sequence number of the oldest change still in the feed history.
+ *  (assumes that the feed mutex is already locked)
+ */
+
+unsigned long getFeedOldestSeq(void){
+	if(feedLastSeq>=FEED_HISTORY_LEN && feedLastSeq-FEED_HISTORY_LEN+1 > feedFirstSeq) return feedLastSeq - FEED_HISTORY_LEN + 1;
+	return feedFirstSeq;
+}
+
+
+
+/*
+ *  Sends to a subscribed client, in commit order, every change committed after 'lastSeq',
+ *  and then keeps pushing the new ones, until the connection is closed.
+ *  Every change is sent as a "'seq';'time';'type''data'\n" line,
+ *  where the data of an added record is "'version';'record'", and the one of a removed record is its key,
+ *  and, if nothing is committed for FEED_HEARTBEAT_INTERVAL seconds,
+ *  a FEED_HEARTBEAT_LINE with the last sequence number is sent.
+ *
+ *  The first line sent is SUCCESS_RESP followed by the last committed sequence number,
+ *  or FAIL_RESP followed by the oldest sequence number from which is possible to resume,
+ *  if the changes after 'lastSeq' are no more in the feed history.
+ *
+ *  If a snapshot is requested, before the changes are sent all the records
+ *  of the main dynamic array, as FEED_ADD_LINE lines, followed by a FEED_SNAPSHOT_END_LINE.
+ *  (all with the sequence number of the last change included in the snapshot)
+ *
+ *    'sockFd' = socket connected to the client.
+ *    'mode' = FEED_FROM_NOW, to send only the changes committed from now on,
+ *      FEED_RESUME to send the changes committed after 'lastSeq', or
+ *      FEED_SNAPSHOT to send a snapshot, and then the changes committed after it.
+ *    'lastSeq' = the last sequence number received by the client.
+ */
+
+void subscribeToFeed(int sockFd, char mode, unsigned long lastSeq){
+	char buff[BUFF_SIZE];
+	char *p;
+	feedEntryS *entry;
+	unsigned long nextSeq;
+	struct timespec t;
+	int ret, snapshotSent = 0;
+
+	if(mode==FEED_SNAPSHOT){
+		startMainRead();											//the writers are excluded, so the feed can't change
+		lastSeq = getFeedLastSeq();
+		long long now = getTimeMs();
+		char *snapshot = malloc(mainDynArr->size * (MAX_MAIN_REC_STR_LEN + MAX_VERSION_LEN*3 + 6) + BUFF_SIZE);
+		if(!snapshot) error("malloc() failed");
+		p = snapshot + sprintf(snapshot, "%c%lu%c", SUCCESS_RESP, lastSeq, FEED_LINES_SEPARATOR);
+		for(unsigned long i=0; i<mainDynArr->size; i++){
+			p += sprintf(p, "%lu%c%lld%c%c%lu%c", lastSeq, QUERY_ITEMS_SEPARATOR, now, QUERY_ITEMS_SEPARATOR, FEED_ADD_LINE, dynArrRec(mainDynArr, i)->version, QUERY_ITEMS_SEPARATOR);
+			p += recordToString(dynArrRec(mainDynArr, i), p);
+			*p++ = FEED_LINES_SEPARATOR;
+		}
+		endMainRead();
+		p += sprintf(p, "%lu%c%lld%c%c%c", lastSeq, QUERY_ITEMS_SEPARATOR, now, QUERY_ITEMS_SEPARATOR, FEED_SNAPSHOT_END_LINE, FEED_LINES_SEPARATOR);
+
+		size_t toWrite;												//sends the snapshot, in chunks smaller than BUFF_SIZE
+		for(char *chunk=snapshot; chunk<p; chunk+=toWrite){
+			toWrite = p - chunk < BUFF_SIZE-1 ? p - chunk : BUFF_SIZE-1;
+			if(writeToSocket(chunk, toWrite, sockFd)){
+				free(snapshot);
+				return;
+			}
+		}
+		free(snapshot);
+		snapshotSent = 1;
+		mode = FEED_RESUME;
+	}
+
+	if(pthread_mutex_lock(&feedMutex)) fatalError("pthread_mutex_lock() failed");
+	if(mode==FEED_FROM_NOW) nextSeq = feedLastSeq + 1;
+	else nextSeq = lastSeq + 1;
+	if(nextSeq<getFeedOldestSeq() || nextSeq>feedLastSeq+1){			//the requested position is not covered anymore
+		p = buff + sprintf(buff, "%c%lu%c", FAIL_RESP, getFeedOldestSeq()-1, FEED_LINES_SEPARATOR);
+		if(pthread_mutex_unlock(&feedMutex)) fatalError("pthread_mutex_unlock() failed");
+		writeToSocket(buff, p - buff, sockFd);
+		return;
+	}
+	p = buff;
+	if(!snapshotSent) p += sprintf(buff, "%c%lu%c", SUCCESS_RESP, feedLastSeq, FEED_LINES_SEPARATOR);
+
+	while(1){
+		while(nextSeq>feedLastSeq && p==buff){						//waits for new changes, or for the heartbeat timeout
+			if(clock_gettime(CLOCK_REALTIME, &t)==-1) fatalError("clock_gettime() failed");
+			t.tv_sec += FEED_HEARTBEAT_INTERVAL;
+			while((ret = pthread_cond_timedwait(&feedCond, &feedMutex, &t))==EINTR);
+			if(ret==ETIMEDOUT){
+				p += sprintf(p, "%lu%c%lld%c%c%c", feedLastSeq, QUERY_ITEMS_SEPARATOR, getTimeMs(), QUERY_ITEMS_SEPARATOR, FEED_HEARTBEAT_LINE, FEED_LINES_SEPARATOR);
+				break;
+			}
+			if(ret) fatalError("pthread_cond_timedwait() failed");
+		}
+		if(nextSeq<getFeedOldestSeq() || nextSeq>feedLastSeq+1) break; //the client is too slow and missed some changes, or the feed has been resetted
+
+		while(nextSeq<=feedLastSeq){								//fills the buffer with the changes not yet sent
+			entry = &feedHistory[nextSeq % FEED_HISTORY_LEN];
+			if((p - buff) + strlen(entry->rec) + MAX_VERSION_LEN*3 + 6 >= BUFF_SIZE) break;
+			p += sprintf(p, "%lu%c%lld%c%c", entry->seq, QUERY_ITEMS_SEPARATOR, entry->time, QUERY_ITEMS_SEPARATOR, entry->type);
+			if(entry->type==FEED_ADD_LINE) p += sprintf(p, "%lu%c", entry->version, QUERY_ITEMS_SEPARATOR);
+			p += sprintf(p, "%s%c", entry->rec, FEED_LINES_SEPARATOR);
+			nextSeq++;
+		}
+		if(pthread_mutex_unlock(&feedMutex)) fatalError("pthread_mutex_unlock() failed");
+
+		if(writeToSocket(buff, p - buff, sockFd)) return;
+		p = buff;
+		if(pthread_mutex_lock(&feedMutex)) fatalError("pthread_mutex_lock() failed");
+	}
+	if(pthread_mutex_unlock(&feedMutex)) fatalError("pthread_mutex_unlock() failed");
+}
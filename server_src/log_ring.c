@@ -0,0 +1,242 @@
+
+#include "server_headers.h"
+
+
+logRingS *logRing;													//the ring buffer of the messages sent to the logger process
+
+
+
+/*
+ *  Creates the shared memory ring buffer, between all the processes
+ *  that send messages and the logger process.
+ *  (has to be called before forking the other processes, so that they inherit the mapping)
+ *
+ *  It's a bounded multi-producer single-consumer queue, where every slot has a sequence number:
+ *  a producer reserves a position incrementing 'tail' with a compare and swap,
+ *  copies the message in the slot, and then publishes it setting the slot sequence to position+1.
+ *  The logger reads the slots in order, and frees them setting their sequence to position+LOG_RING_SLOTS.
+ *  So sending a message doesn't need any syscall, unless the logger is sleeping and has to be woken up.
+ */
+
+void initLogRing(void){
+	if((logRing = mmap(NULL, sizeof(logRingS), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0))==MAP_FAILED) fatalError("mmap() failed");
+	for(unsigned long i=0; i<LOG_RING_SLOTS; i++) atomic_init(&logRing->slots[i].seq, i);
+}
+
+
+
+/*
+ *  Waits on a futex, until it's woken up, or 'timeoutMs' milliseconds pass.
+ *  (the futex is shared between processes)
+ *
+ *    'addr' = pointer to the futex word.
+ *    'val' = the value that the futex word should have, to start waiting.
+ *    'timeoutMs' = the maximum time to wait, or -1 to wait without timeout.
+ */
+
+void futexWait(atomic_uint *addr, unsigned val, long long timeoutMs){
+	struct timespec t;
+	t.tv_sec = timeoutMs / 1000;
+	t.tv_nsec = (timeoutMs % 1000) * 1000000;
+	if(syscall(SYS_futex, addr, FUTEX_WAIT, val, timeoutMs<0?NULL:&t, NULL, 0)==-1 && errno!=EAGAIN && errno!=EINTR && errno!=ETIMEDOUT) fatalError("futex() failed");
+}
+
+
+
+/*
+ *  Wakes up the processes or threads waiting on a futex.
+ *
+ *    'addr' = pointer to the futex word.
+ *    'n' = the maximum number of waiters to wake up.
+ */
+
+void futexWake(atomic_uint *addr, int n){
+	atomic_fetch_add(addr, 1);
+	if(syscall(SYS_futex, addr, FUTEX_WAKE, n, NULL, NULL, 0)==-1) fatalError("futex() failed");
+}
+
+
+
+/*
+ *  Sends a message to the logger process, through the ring buffer.
+ *  (see logRingPushText())
+ *
+ *    'msg' = pointer to the message to send.
+ *    'lsn' = the log sequence number of a recovery message, or 0 for the other messages.
+ *    'forceSync' = 1 if the message is a recovery message, that has to be synced
+ *      even if the recovery data class is not selected, else 0.
+ */
+
+void logRingPush(msgS *msg, unsigned long lsn, int forceSync){
+	if(!msg) fatalError("NULL argument");
+	logRingPushText(msg->type, msg->txt, strlen(msg->txt), lsn, forceSync);
+}
+
+
+
+/*
+ *  Sends a message to the logger process, through the ring buffer,
+ *  copying its text straight into the slot.
+ *  If the ring buffer is full, the diagnostic messages (errors, warnings and infos)
+ *  are dropped, while the others wait until there's a free slot.
+ *
+ *    'type' = the type of the message.
+ *    'txt' = the text of the message, doesn't need to be terminated.
+ *    'len' = the length of the text, < BUFF_SIZE.
+ *    'lsn' = the log sequence number of a recovery message, or 0 for the other messages.
+ *    'forceSync' = 1 if the message is a recovery message, that has to be synced
+ *      even if the recovery data class is not selected, else 0.
+ */
+
+void logRingPushText(long type, const char *txt, size_t len, unsigned long lsn, int forceSync){
+	if(!txt) fatalError("NULL argument");
+	if(len>=BUFF_SIZE) fatalError("message too long");
+	traceBegin(TRACE_LOG_MSG);
+	unsigned long pos = atomic_load_explicit(&logRing->tail, memory_order_relaxed);
+	unsigned long seq, depth, maxDepth;
+	logSlotS *slot;
+	unsigned wake;
+	int stalled = 0;
+
+	while(1){														//reserves a position
+		slot = &logRing->slots[pos & (LOG_RING_SLOTS-1)];
+		seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		if(seq==pos){
+			if(atomic_compare_exchange_weak_explicit(&logRing->tail, &pos, pos+1, memory_order_relaxed, memory_order_relaxed)) break;
+		}
+		else if((long) (seq - pos) < 0){							//the ring buffer is full
+			if(type<SUCCESSFULL_SAFE_SHUTDOWN){
+				atomic_fetch_add_explicit(&logRing->drops, 1, memory_order_relaxed);
+				traceEnd(TRACE_LOG_MSG);
+				return;
+			}
+			if(!stalled) atomic_fetch_add_explicit(&logRing->stalls, 1, memory_order_relaxed);
+			stalled = 1;
+			wake = atomic_load(&logRing->spaceWake);
+			atomic_fetch_add(&logRing->producersWaiting, 1);
+			if(atomic_load(&slot->seq)==seq) futexWait(&logRing->spaceWake, wake, LOG_RING_STALL_TIMEOUT_MS);
+			atomic_fetch_sub(&logRing->producersWaiting, 1);
+			pos = atomic_load_explicit(&logRing->tail, memory_order_relaxed);
+		}
+		else pos = atomic_load_explicit(&logRing->tail, memory_order_relaxed);
+	}
+
+	slot->entry.lsn = lsn;											//copies and publishes the message
+	slot->entry.forceSync = forceSync;
+	slot->entry.msg.type = type;
+	slot->entry.len = len;
+	memcpy(slot->entry.msg.txt, txt, len);
+	slot->entry.msg.txt[len] = '\0';
+	atomic_store_explicit(&slot->seq, pos+1, memory_order_release);
+
+	depth = pos + 1 - atomic_load_explicit(&logRing->head, memory_order_relaxed);
+	maxDepth = atomic_load_explicit(&logRing->maxDepth, memory_order_relaxed);
+	while((long) depth > 0 && depth>maxDepth && !atomic_compare_exchange_weak_explicit(&logRing->maxDepth, &maxDepth, depth, memory_order_relaxed, memory_order_relaxed));
+	atomic_fetch_add_explicit(&logRing->pushed, 1, memory_order_relaxed);
+
+	atomic_thread_fence(memory_order_seq_cst);						//pairs with the fence of the logger, before going to sleep
+	if(atomic_load_explicit(&logRing->loggerSleeping, memory_order_relaxed)) futexWake(&logRing->loggerWake, 1);
+	traceEnd(TRACE_LOG_MSG);
+}
+
+
+
+/*
+ *  Waits for the next message of the ring buffer, and returns it without copying it,
+ *  the slot stays reserved until logRingRelease() is called.
+ *  (has to be called only by the logger process)
+ *
+ *    'timeoutMs' = for how long to wait if the ring buffer is empty,
+ *      0 to not wait, or -1 to wait until a message arrives.
+ *
+ *    returns a pointer to the message, with its log sequence number and if it has to be synced anyway, or
+ *    returns NULL if the ring buffer is still empty after the timeout.
+ */
+
+logEntryS *logRingPeek(long long timeoutMs){
+	long long deadline = timeoutMs>0 ? getTimeMs() + timeoutMs : 0;
+	unsigned long pos = atomic_load_explicit(&logRing->head, memory_order_relaxed);
+	logSlotS *slot = &logRing->slots[pos & (LOG_RING_SLOTS-1)];
+	unsigned wake;
+
+	while(atomic_load_explicit(&slot->seq, memory_order_acquire)!=pos+1){
+		if(timeoutMs>0 && (timeoutMs = deadline - getTimeMs())<=0) timeoutMs = 0;
+		if(!timeoutMs) return NULL;
+
+		wake = atomic_load(&logRing->loggerWake);					//goes to sleep, until a producer wakes it up
+		atomic_store(&logRing->loggerSleeping, 1);
+		atomic_thread_fence(memory_order_seq_cst);
+		if(atomic_load_explicit(&slot->seq, memory_order_acquire)!=pos+1) futexWait(&logRing->loggerWake, wake, timeoutMs);
+		atomic_store(&logRing->loggerSleeping, 0);
+	}
+	return &slot->entry;
+}
+
+
+
+/*
+ *  Frees the slot of the message returned by logRingPeek(),
+ *  and wakes up the producers waiting for space.
+ *  (has to be called only by the logger process)
+ */
+
+void logRingRelease(void){
+	unsigned long pos = atomic_load_explicit(&logRing->head, memory_order_relaxed);
+	logSlotS *slot = &logRing->slots[pos & (LOG_RING_SLOTS-1)];
+	atomic_store_explicit(&slot->seq, pos+LOG_RING_SLOTS, memory_order_release); //frees the slot
+	atomic_store_explicit(&logRing->head, pos+1, memory_order_relaxed);
+
+	atomic_thread_fence(memory_order_seq_cst);
+	if(atomic_load_explicit(&logRing->producersWaiting, memory_order_relaxed)) futexWake(&logRing->spaceWake, INT_MAX);
+}
+
+
+
+/*
+ *  Publishes that all the recovery messages before 'lsn' are synced to disk,
+ *  and wakes up the durable writes waiting for them.
+ *  (has to be called only by the logger process)
+ *
+ *    'lsn' = the log sequence number of the first message not yet synced.
+ */
+
+void setDurableLsn(unsigned long lsn){
+	if(atomic_load(&logRing->durableLsn)==lsn) return;
+	atomic_store(&logRing->durableLsn, lsn);
+	if(atomic_load(&logRing->durableWaiters)) futexWake(&logRing->durableWake, INT_MAX);
+}
+
+
+
+/*
+ *  Waits until the recovery message with log sequence number 'lsn' is synced to disk.
+ *  All the writes waiting together, share the same sync of the logger.
+ *  (the message has to be sent with 'forceSync', or the recovery data class has to be selected)
+ *
+ *    'lsn' = the log sequence number of the message, returned by publishMainChange().
+ */
+
+void waitDurable(unsigned long lsn){
+	unsigned wake;
+	atomic_fetch_add(&logRing->durableWaiters, 1);
+	while(1){
+		wake = atomic_load(&logRing->durableWake);
+		if((long) (atomic_load(&logRing->durableLsn) - lsn) > 0) break;
+		futexWait(&logRing->durableWake, wake, LOG_RING_STALL_TIMEOUT_MS);
+	}
+	atomic_fetch_sub(&logRing->durableWaiters, 1);
+}
+
+
+
+/*
+ *  Prints the stats of the logger ring buffer.
+ */
+
+void printLogRingStats(void){
+	unsigned long tail = atomic_load(&logRing->tail);
+	unsigned long head = atomic_load(&logRing->head);
+	printf("\nLogger ring buffer: %d slots\n", LOG_RING_SLOTS);
+	printf("Depth = %lu,   Max depth = %lu,   Sent = %lu,   Dropped = %lu,   Stalls = %lu\n\n", tail-head, atomic_load(&logRing->maxDepth), atomic_load(&logRing->pushed), atomic_load(&logRing->drops), atomic_load(&logRing->stalls));
+	fflush(stdout);
+}
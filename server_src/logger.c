@@ -2,7 +2,16 @@
 #include "server_headers.h"
 
 
-int logFd, recoveryFd;
+int logFd;
+char loggerBatch[LOGGER_MAX_BATCH][BUFF_SIZE*2];					//the formatted messages of the batch being written
+struct iovec logIov[LOGGER_MAX_BATCH];
+int nLog, syncRecovery, unsyncedRecovery;
+unsigned long nextLsn;												//the log sequence number of the next recovery message to write
+reorderNodeS **reorderBuff;											//the recovery messages received before 'nextLsn', indexed by log sequence number
+unsigned long reorderCap;
+char *txnBuff;														//the parts of the transaction with sequence number 'nextLsn', received until now
+size_t txnLen, txnMax;
+unsigned long loggedMsgs, loggedBatches, loggedSyncs;
 
 
 
@@ -41,15 +50,244 @@ char *writeTime(char *dest){
 
 
 /*
- *  The function where will execute the logger process
+ *  Tells if a message type has to be synced to disk,
+ *  according to the classes of messages selected with the -s option.
+ *
+ *    'type' = the type of the message.
+ *
+ *    returns 1 if the file where the message is written has to be synced, else
+ *    returns 0
+ */
+
+int needsSync(long type){
+	switch(type){
+		case ERR_MSG:
+			return !!strchr(syncClasses, SYNC_ERR_CLASS);
+		case WARN_MSG:
+			return !!strchr(syncClasses, SYNC_WARN_CLASS);
+		case INFO_MSG:
+			return !!strchr(syncClasses, SYNC_INFO_CLASS);
+		case SUCCESSFULL_SAFE_SHUTDOWN:
+			return 1;
+		case RECOVERY_ADD_REC_MSG:
+		case RECOVERY_DEL_REC_MSG:
+		case RECOVERY_BATCH_END_MSG:
+			return !!strchr(syncClasses, SYNC_RECOVERY_CLASS);
+		default:													//a part of an atomic batch is synced with its last part
+			return 0;
+	}
+}
+
+
+
+/*
+ *  Formats a diagnostic message, as it will be written in the log file.
+ *
+ *    'msg' = pointer to the received message.
+ *    'dest' = pointer to a buffer of size BUFF_SIZE*2, where the formatted message will be saved.
+ *
+ *    returns the length of the formatted message.
+ */
+
+size_t formatLogMsg(msgS *msg, char *dest){
+	if(!msg || !dest) fatalError("NULL argument");
+	char *p = writeTime(dest);
+
+	switch(msg->type){
+		case ERR_MSG:												//error message
+			p += sprintf(p, "ERROR: %s\n", msg->txt);
+			break;
+		case WARN_MSG:												//warning message
+			p += sprintf(p, "WARNING: %s\n", msg->txt);
+			break;
+		case INFO_MSG:												//info message
+			p += sprintf(p, "INFO: %s\n", msg->txt);
+			break;
+		case SUCCESSFULL_SAFE_SHUTDOWN:								//this message tells the logger that can exit safely
+			p += sprintf(p, "INFO: Successfully done a safe-shutdown. (before this, logged %lu messages in %lu batches, with %lu syncs, and dropped %lu)\n", loggedMsgs, loggedBatches, loggedSyncs, atomic_load(&logRing->drops));
+			break;
+		default:
+			fatalError("invalid message type");
+			break;
+	}
+	return p - dest;
+}
+
+
+
+/*
+ *  Writes all the buffers of an iovec array to a file,
+ *  retrying if the writev() is interrupted or partial.
+ *
+ *    'fd' = the file descriptor.
+ *    'iov' = the iovec array. (it's modified)
+ *    'n' = the number of buffers in 'iov'.
+ */
+
+void writevToFile(int fd, struct iovec *iov, int n){
+	ssize_t writed;
+	while(n>0){
+		while((writed = writev(fd, iov, n))<0) if(errno!=EINTR) fatalError("writev() failed");
+		while(n>0 && (size_t) writed>=iov->iov_len){				//skips the buffers completely written
+			writed -= iov->iov_len;
+			iov++;
+			n--;
+		}
+		if(n>0){
+			iov->iov_base = (char *) iov->iov_base + writed;
+			iov->iov_len -= writed;
+		}
+	}
+}
+
+
+
+/*
+ *  Adds a buffer to an iovec array, writing the array to its file first,
+ *  if it's already full.
+ *
+ *    'fd' = the file descriptor.
+ *    'iov' = the iovec array, of size LOGGER_MAX_BATCH.
+ *    'n' = pointer to the number of buffers in 'iov'.
+ *    'buff' = the buffer to add.
+ *    'len' = the length of 'buff'.
+ */
+
+void addToIov(int fd, struct iovec *iov, int *n, char *buff, size_t len){
+	if(*n==LOGGER_MAX_BATCH){
+		writevToFile(fd, iov, *n);
+		*n = 0;
+	}
+	iov[*n].iov_base = buff;
+	iov[(*n)++].iov_len = len;
+}
+
+
+
+/*
+ *  Encodes the recovery message with log sequence number 'nextLsn' as a WAL record,
+ *  and moves to the next one, unless the message is only a part of a transaction.
+ *
+ *    'type' = the type of the message.
+ *    'txt' = the text of the message, doesn't need to be terminated.
+ *    'len' = the length of the text.
+ *    'forceSync' = 1 if the message has to be synced anyway, else 0.
+ */
+
+void writeInOrder(long type, char *txt, size_t len, int forceSync){
+	syncRecovery |= needsSync(type) || forceSync;
+	unsyncedRecovery = 1;
+	switch(type){
+		case RECOVERY_ADD_REC_MSG:
+			appendWalRecord(nextLsn, WAL_ADD_OP, txt, len);
+			break;
+		case RECOVERY_DEL_REC_MSG:
+			appendWalRecord(nextLsn, WAL_DEL_OP, txt, len);
+			break;
+		case RECOVERY_BATCH_MSG:									//all the parts of a transaction have the same log sequence number
+		case RECOVERY_BATCH_END_MSG:
+			if(txnLen + len > txnMax){
+				while(txnLen + len > txnMax) txnMax = txnMax ? txnMax<<1 : BUFF_SIZE*4;
+				if(!(txnBuff = realloc(txnBuff, txnMax))) fatalError("realloc() failed");
+			}
+			memcpy(txnBuff + txnLen, txt, len);
+			txnLen += len;
+			if(type==RECOVERY_BATCH_MSG) return;
+			appendWalRecord(nextLsn, WAL_TXN_OP, txnBuff, txnLen);
+			txnLen = 0;
+			break;
+		default:
+			fatalError("invalid message type");
+			break;
+	}
+	nextLsn++;
+}
+
+
+
+/*
+ *  Keeps a recovery message received before the previous ones,
+ *  in the reorder buffer, until 'nextLsn' reaches it.
+ *  (the main changes get their log sequence number under the main write lock,
+ *  but are sent to the logger after releasing it, so they can arrive out of order)
+ *
+ *    'lsn' = the log sequence number of the message.
+ *    'type' = the type of the message.
+ *    'forceSync' = 1 if the message has to be synced anyway, else 0.
+ *    'txt' = the text of the message, doesn't need to be terminated.
+ *    'len' = the length of the text.
+ */
+
+void storeOutOfOrder(unsigned long lsn, long type, int forceSync, char *txt, size_t len){
+	if((long) (lsn - nextLsn) <= 0) fatalError("This error should never occur");
+	reorderNodeS *node, **p;
+
+	if(lsn - nextLsn >= reorderCap){								//the reorder buffer is too small, doubles it
+		unsigned long newCap = reorderCap ? reorderCap : LOG_RING_SLOTS;
+		while(lsn - nextLsn >= newCap) newCap <<= 1;
+		reorderNodeS **newBuff = calloc(newCap, sizeof(reorderNodeS *));
+		if(!newBuff) fatalError("calloc() failed");
+		for(unsigned long i=0; i<reorderCap; i++) if(reorderBuff[i]) newBuff[reorderBuff[i]->lsn & (newCap-1)] = reorderBuff[i];
+		free(reorderBuff);
+		reorderBuff = newBuff;
+		reorderCap = newCap;
+	}
+
+	if(!(node = malloc(sizeof(reorderNodeS)))) fatalError("malloc() failed");
+	if(!(node->txt = malloc(len + 1))) fatalError("malloc() failed");
+	memcpy(node->txt, txt, len);
+	node->len = len;
+	node->lsn = lsn;
+	node->type = type;
+	node->forceSync = forceSync;
+	node->next = NULL;
+	for(p = &reorderBuff[lsn & (reorderCap-1)]; *p; p = &(*p)->next);	//the parts of a transaction are kept in order
+	*p = node;
+}
+
+
+
+/*
+ *  Encodes all the recovery messages of the reorder buffer,
+ *  that now follow in order the ones already encoded.
+ */
+
+void drainReorderBuff(void){
+	reorderNodeS *node, *next;
+	unsigned long lsn;
+	while(reorderCap && (node = reorderBuff[nextLsn & (reorderCap-1)])){
+		reorderBuff[nextLsn & (reorderCap-1)] = NULL;
+		lsn = nextLsn;
+		for(; node; node = next){
+			next = node->next;
+			writeInOrder(node->type, node->txt, node->len, node->forceSync);
+			free(node->txt);
+			free(node);
+		}
+		if(nextLsn==lsn) break;										//the other parts of this transaction will arrive in order
+	}
+}
+
+
+
+/*
+ *  The function where will execute the logger process.
+ *
+ *  The messages are written in batches (group commit): every message
+ *  already in the ring buffer is collected, written with a single writev() per file,
+ *  and then each file is synced only once, if at least one message needs it.
+ *  If a group commit window is set, and the batch has to be synced,
+ *  the logger keeps collecting messages for up to 'groupCommitMs' milliseconds.
+ *  The recovery messages are written to the WAL in order of log sequence number,
+ *  so the WAL follows the commit order of the changes.
  */
 
 void loggerProcess(void){
-	ssize_t readed, writed;
-	size_t toWrite;
-	char buff[BUFF_SIZE*2];
-	char *p;
+	size_t l;
 	msgS msg;
+	logEntryS *entry;
+	int nMsgs, syncLog;
+	long long batchStart = 0, wait;
 
 	struct sigaction act;
 	act.sa_flags = 0;
@@ -66,12 +304,15 @@ void loggerProcess(void){
 	char logFilename[BUFF_SIZE];
 	if(time(&rawtime)==-1) fatalError("time() failed");
 	if(!gmtime_r(&rawtime, &tS)) fatalError("gmtime() failed");
-	int l = snprintf(logFilename, BUFF_SIZE-1, "%s_%02d%02d%02d_%02d%02d%02d.txt", BASE_LOG_FILENAME, (tS.tm_year+1900)%100, tS.tm_mon+1, tS.tm_mday, tS.tm_hour, tS.tm_min, tS.tm_sec);
-	if(l>=BUFF_SIZE-1) fatalError("log filepath too long")
+	int ret = snprintf(logFilename, BUFF_SIZE-1, "%s_%02d%02d%02d_%02d%02d%02d.txt", BASE_LOG_FILENAME, (tS.tm_year+1900)%100, tS.tm_mon+1, tS.tm_mday, tS.tm_hour, tS.tm_min, tS.tm_sec);
+	if(ret>=BUFF_SIZE-1) fatalError("log filepath too long")
 
-	int pid, fd;
 	if((logFd = open(logFilename, O_WRONLY | O_CREAT | O_APPEND, 0600))==-1) fatalError("read() failed");
-	if((recoveryFd = open(RECOVERY_DATA_FILENAME, O_WRONLY | O_CREAT | O_APPEND, 0600))==-1) fatalError("read() failed");
+	nextLsn = lastLsn + 1;											//continues after the records replayed at startup
+	if(!primaryPort){												//a replica doesn't have recovery data
+		nWalSegs = listWalSegments(&walSegs);						//the segments left by a recovery, that can be recycled
+		openWalSegment(nextLsn);
+	}
 
 	msg.type = INFO_MSG;
 	sprintf(msg.txt, "Logger started.");
@@ -80,54 +321,49 @@ void loggerProcess(void){
 
 	int loop = 1;
 	while(loop){
-		while((readed = msgrcv(msgQueue, &msg, BUFF_SIZE, 0, MSG_NOERROR))==-1) if(errno!=EINTR) fatalError("msgrcv() failed");
+		nMsgs = nLog = syncLog = syncRecovery = 0;
+		while(loop && nMsgs<LOGGER_MAX_BATCH){
+			if(!nMsgs) wait = -1;									//waits for the first message of the batch
+			else if(groupCommitMs && (syncLog || syncRecovery)){	//waits for the other ones until the end of the window
+				wait = batchStart + groupCommitMs - getTimeMs();
+				if(wait<0) wait = 0;
+			}
+			else wait = 0;											//or collects only the messages already queued
+			if(!(entry = logRingPeek(wait))) break;				//the message is read in place, and copied only where it's needed
+			if(!nMsgs) batchStart = getTimeMs();
 
-		if(msg.type<RECOVERY_ADD_REC_MSG){
-			fd = logFd;
-			p = writeTime(buff);
-		}
-		else fd = recoveryFd;
-		
-		switch(msg.type){
-			case ERR_MSG:											//error message
-				p += sprintf(p, "ERROR: %s\n", msg.txt);
-				toWrite = p - buff;
-				break;
-			case WARN_MSG:											//warning message
-				p += sprintf(p, "WARNING: %s\n", msg.txt);
-				toWrite = p - buff;
-				break;
-			case INFO_MSG:											//info message
-				p += sprintf(p, "INFO: %s\n", msg.txt);
-				toWrite = p - buff;
-				break;
-			case SUCCESSFULL_SAFE_SHUTDOWN:							//this message tells the logger that can exit safely
-				p += sprintf(p, "INFO: Successfully done a safe-shutdown.\n");		
-				toWrite = p - buff;
-				loop = 0;
-				break;
-			case RECOVERY_ADD_REC_MSG:								//a record has been added, will be logged to the recovery data file
-				toWrite = sprintf(buff, "1%s\n", msg.txt);
-				break;
-			case RECOVERY_DEL_REC_MSG:								//a record has been removed, will be logged to the recovery data file
-				toWrite = sprintf(buff, "0%s:\n", msg.txt);
-				break;
-			default:
-				fatalError("invalid message type");
-				break;
+			if(entry->msg.type<RECOVERY_ADD_REC_MSG){
+				l = formatLogMsg(&entry->msg, loggerBatch[nMsgs]);
+				addToIov(logFd, logIov, &nLog, loggerBatch[nMsgs], l);
+				syncLog |= needsSync(entry->msg.type);
+			}
+			else if(entry->lsn==nextLsn){
+				writeInOrder(entry->msg.type, entry->msg.txt, entry->len, entry->forceSync);
+				drainReorderBuff();
+			}
+			else storeOutOfOrder(entry->lsn, entry->msg.type, entry->forceSync, entry->msg.txt, entry->len);
+			if(entry->msg.type==SUCCESSFULL_SAFE_SHUTDOWN) loop = 0;
+			logRingRelease();
+			nMsgs++;
 		}
 
-		p = buff;
-		while(toWrite>0){
-			while((writed = write(fd, p, toWrite))<0) if(errno!=EINTR) fatalError("write() failed");
-			toWrite -= writed;
-			p += writed;
+		if(nLog) writevToFile(logFd, logIov, nLog);
+		flushWal();
+		if(syncLog){
+			if(fsync(logFd)==-1) fatalError("fsync() failed");
+			loggedSyncs++;
+		}
+		if(syncRecovery){
+			if(fdatasync(walFd)==-1) fatalError("fdatasync() failed");	//the segments are preallocated, so their size never changes
+			loggedSyncs++;
+			unsyncedRecovery = 0;
 		}
-		if(fsync(fd)==-1) fatalError("fsync() failed");
+		if(!unsyncedRecovery) setDurableLsn(nextLsn);				//wakes up the durable writes of this batch
+		loggedMsgs += nMsgs;
+		loggedBatches++;
 	}
 	
 	if(close(logFd)) fatalError("close() failed");
-	if(close(recoveryFd)) fatalError("close() failed");
-	if(msgctl(msgQueue, IPC_RMID, NULL)==-1) fatalError("msgctl() failed");
+	if(!primaryPort && close(walFd)) fatalError("close() failed");
 	exit(0);
 }
@@ -0,0 +1,257 @@
+
+#include "server_headers.h"
+
+
+unsigned long replicaAppliedSeq, replicaPrimarySeq;					//last applied change, and last change known to be committed on the primary
+long long replicaLagMs;
+int replicaConnected;
+pthread_mutex_t replicaMutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+/*
+ *  The function where will execute the replication thread of a replica.
+ *  Connects to the primary server, subscribes to its change feed,
+ *  (requesting a snapshot the first time, or if the missed changes are no more available)
+ *  and applies every received change to the main dynamic array.
+ *  If the connection is lost, it retries every REPLICA_RETRY_INTERVAL seconds.
+ *
+ *    'dummy' = dummy variable
+ */
+
+void replicationThread(void *dummy){
+	char buff[BUFF_SIZE*2];
+	char token[SESSION_TOKEN_LEN+1];
+	char *p1, *p2;
+	size_t len, carry;
+	int sock, first, needSnapshot = 1;
+	dArrS *snapshot = NULL;
+	msgS msg;
+	msg.type = INFO_MSG;
+
+	while(1){
+		if((sock = connectToPrimary(token))==-1){
+			sleep(REPLICA_RETRY_INTERVAL);
+			continue;
+		}
+
+		len = sprintf(buff, "%c%s%c%c%lu", SUBSCRIBE_REQ, token, QUERY_ITEMS_SEPARATOR, needSnapshot?FEED_SNAPSHOT:FEED_RESUME, replicaAppliedSeq);
+		if(writeToSocket(buff, len, sock)) goto replica_disconnect;
+
+		first = 1;
+		carry = 0;
+		while((len = readStreamFromSocket(buff+carry, BUFF_SIZE-1, sock))){ //the pushed lines can be splitted between different reads
+			len += carry;
+			buff[len] = '\0';
+			p1 = buff;
+			while((p2 = strchr(p1, FEED_LINES_SEPARATOR))){
+				*p2 = '\0';
+				if(first){											//the first line is the response to the subscription
+					if(*p1!=SUCCESS_RESP){							//the missed changes are no more available
+						needSnapshot = 1;
+						goto replica_disconnect;
+					}
+					if(needSnapshot) snapshot = initDynArr(0);
+					if(pthread_mutex_lock(&replicaMutex)) fatalError("pthread_mutex_lock() failed");
+					replicaConnected = 1;
+					replicaPrimarySeq = strtoul(p1+1, NULL, 10);
+					if(pthread_mutex_unlock(&replicaMutex)) fatalError("pthread_mutex_unlock() failed");
+					sprintf(msg.txt, "Replica connected to the primary on port %u.", primaryPort);
+					logMsg(msg);
+					first = 0;
+				}
+				else if(applyFeedLine(p1, &snapshot)){
+					snprintf(msg.txt, sizeof(msg.txt), "Replica received an invalid change '%.*s', a new snapshot will be requested.", MAX_MAIN_REC_STR_LEN, p1); //the line can be longer than the message
+					logMsg(msg);
+					needSnapshot = 1;
+					goto replica_disconnect;
+				}
+				else if(!snapshot) needSnapshot = 0;
+				p1 = p2 + 1;
+			}
+			carry = len - (p1 - buff);
+			if(carry>=BUFF_SIZE) goto replica_disconnect;
+			memmove(buff, p1, carry);
+		}
+
+		replica_disconnect:
+		if(close(sock)==-1) error("close() failed");
+		if(snapshot){												//an incomplete snapshot is discarded
+			delDynArr(snapshot);
+			snapshot = NULL;
+		}
+		if(pthread_mutex_lock(&replicaMutex)) fatalError("pthread_mutex_lock() failed");
+		if(replicaConnected){
+			sprintf(msg.txt, "Replica lost the connection with the primary.");
+			logMsg(msg);
+		}
+		replicaConnected = 0;
+		if(pthread_mutex_unlock(&replicaMutex)) fatalError("pthread_mutex_unlock() failed");
+		sleep(REPLICA_RETRY_INTERVAL);
+	}
+}
+
+
+
+/*
+ *  Connects and logins to the primary server,
+ *  using the credentials of the 'replicaUser' user,
+ *  taken from the users dynamic arrays.
+ *
+ *    'token' = pointer to a buffer of size SESSION_TOKEN_LEN+1, where will be saved the session token.
+ *
+ *    returns the socket connected to the primary, or
+ *    returns -1 if the connection or the login failed.
+ */
+
+int connectToPrimary(char *token){
+	if(!token) error("NULL argument");
+	char buff[BUFF_SIZE];
+	unsigned long index;
+	size_t len;
+	int sock;
+
+	len = sprintf(buff, "%c%s%c", TOKEN_REQ, replicaUser, KEY_VALUE_SEPARATOR);
+	startUserRead();
+	if(findIndexFromKey(replicaUser, privUsersDynArr, &index)) strcpy(buff+len, dynArrRec(privUsersDynArr, index)->value);
+	else if(findIndexFromKey(replicaUser, normUsersDynArr, &index)) strcpy(buff+len, dynArrRec(normUsersDynArr, index)->value);
+	else buff[0] = '\0';
+	endUserRead();
+	if(buff[0]=='\0') return -1;									//the user is not registered
+	len += HASH_LEN;
+
+	if((sock = socket(AF_INET, SOCK_STREAM, 0))==-1) error("socket() failed");
+
+	struct timeval t;
+	t.tv_usec = 0;
+	t.tv_sec = REPLICA_READ_TIMEOUT;								//the primary sends an heartbeat every FEED_HEARTBEAT_INTERVAL seconds
+	if(setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &t, sizeof(t))==-1) error("setsockopt() failed");
+	t.tv_sec = SOCKET_WRITE_TIMEOUT;
+	if(setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &t, sizeof(t))==-1) error("setsockopt() failed");
+
+	struct sockaddr_in primaryAddr;
+	memset(&primaryAddr, 0, sizeof(primaryAddr));
+	primaryAddr.sin_family = AF_INET;
+	primaryAddr.sin_port = htons(primaryPort);
+	if(!inet_aton(DEFAULT_SERVER_IP, &primaryAddr.sin_addr)) error("inet_aton() failed");
+
+	if(connect(sock, (struct sockaddr *) &primaryAddr, sizeof(primaryAddr))==-1 ||
+	   writeToSocket(buff, len, sock) || !readFromSocket(buff, sock) ||
+	   buff[0]!=SUCCESS_RESP || strlen(buff)!=SESSION_TOKEN_LEN+2){
+		if(close(sock)==-1) error("close() failed");
+		return -1;
+	}
+	strcpy(token, buff+2);
+	return sock;
+}
+
+
+
+/*
+ *  Applies a line received from the change feed of the primary.
+ *  While a snapshot is being received, the records are added to the 'snapshot'
+ *  dynamic array, that replaces the main one when the snapshot ends.
+ *  Else, the changes are applied to the main dynamic array,
+ *  and appended to the change feed of the replica.
+ *
+ *    'line' = the received line, with this format: "'seq';'time';'type''data'".
+ *      (the data of an added record is "'version';'record'")
+ *    'snapshot' = pointer to the dynamic array of the snapshot being received, or to NULL.
+ *
+ *    returns 0 if the line has been applied, or
+ *    returns 1 if the line is invalid, or it's not the next expected change.
+ */
+
+int applyFeedLine(char *line, dArrS **snapshot){
+	if(!line || !snapshot) error("NULL argument");
+
+	char *timeStr, *data, *p;
+	recSliceS slice;
+	recS *rec;
+	unsigned long version;
+	if(!(timeStr = strchr(line, QUERY_ITEMS_SEPARATOR))) return 1;
+	*timeStr++ = '\0';
+	if(!(data = strchr(timeStr, QUERY_ITEMS_SEPARATOR))) return 1;
+	*data++ = '\0';
+	if(checkSeqString(line) || checkSeqString(timeStr)) return 1;
+
+	unsigned long seq = strtoul(line, NULL, 10);
+	long long time = strtoll(timeStr, NULL, 10);
+	char type = *data++;
+	dArrS *old;
+
+	switch(type){
+		case FEED_HEARTBEAT_LINE:
+			if(pthread_mutex_lock(&replicaMutex)) fatalError("pthread_mutex_lock() failed");
+			replicaPrimarySeq = seq;
+			if(replicaAppliedSeq==seq) replicaLagMs = 0;
+			if(pthread_mutex_unlock(&replicaMutex)) fatalError("pthread_mutex_unlock() failed");
+			return 0;
+		case FEED_SNAPSHOT_END_LINE:								//the snapshot is complete, it replaces the main dynamic array
+			if(!*snapshot) return 1;
+			startMainWrite();
+			old = mainDynArr;
+			mainDynArr = *snapshot;
+			loadSharedDb(mainDynArr);
+			clearRespCache();
+			initFeed(seq);
+			endMainWrite();
+			delDynArr(old);
+			*snapshot = NULL;
+			break;
+		case FEED_ADD_LINE:									//the record keeps the version it has on the primary
+			if(!(p = strchr(data, QUERY_ITEMS_SEPARATOR))) return 1;
+			*p++ = '\0';
+			if(checkVersionString(data) || parseRecordString(p, MAIN_TYPE, &slice)) return 1;
+			version = strtoul(data, NULL, 10);
+			data = p;
+			rec = sliceToRecord(&slice);
+			rec->version = version;
+			if(*snapshot) return addRecToDynArr(rec, *snapshot);
+			if(seq!=replicaAppliedSeq+1){
+				delRecord(rec);
+				return 1;
+			}
+			startMainWrite();
+			if(addRecToDynArr(rec, mainDynArr)) fatalError("Maximum size of dynamic array reached while replicating it.");
+			appendToFeed(FEED_ADD_LINE, data, version);
+			syncSharedRec(data);
+			invalidateRespCache(data);
+			endMainWrite();
+			break;
+		case FEED_DEL_LINE:
+			if(*snapshot || checkNameString(data) || seq!=replicaAppliedSeq+1) return 1;
+			startMainWrite();
+			removeRecFromDynArr(data, mainDynArr);
+			appendToFeed(FEED_DEL_LINE, data, 0);
+			syncSharedRec(data);
+			invalidateRespCache(data);
+			endMainWrite();
+			break;
+		default:
+			return 1;
+	}
+
+	if(pthread_mutex_lock(&replicaMutex)) fatalError("pthread_mutex_lock() failed");
+	replicaAppliedSeq = seq;
+	if(seq>replicaPrimarySeq) replicaPrimarySeq = seq;
+	replicaLagMs = type==FEED_SNAPSHOT_END_LINE ? 0 : getTimeMs() - time;
+	if(pthread_mutex_unlock(&replicaMutex)) fatalError("pthread_mutex_unlock() failed");
+	return 0;
+}
+
+
+
+/*
+ *  Prints the replication status of a replica,
+ *  and its lag from the primary, in records and in milliseconds.
+ */
+
+void printReplicationStatus(void){
+	if(pthread_mutex_lock(&replicaMutex)) fatalError("pthread_mutex_lock() failed");
+	printf("\nReplica of the primary on port %u (%s)\n", primaryPort, replicaConnected?"connected":"disconnected");
+	printf("Last applied change: %lu,   Last change on the primary: %lu\n", replicaAppliedSeq, replicaPrimarySeq);
+	printf("Replication lag: %lu records, %lld ms\n\n", replicaPrimarySeq-replicaAppliedSeq, replicaLagMs);
+	fflush(stdout);
+	if(pthread_mutex_unlock(&replicaMutex)) fatalError("pthread_mutex_unlock() failed");
+}
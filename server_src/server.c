@@ -2,7 +2,6 @@
 #include "server_headers.h"
 
 
-int msgQueue;
 int sem;
 
 pid_t serverPid, loggerPid;
@@ -13,23 +12,53 @@ dArrS *normUsersDynArr;
 
 int mainSocket;
 unsigned port = DEFAULT_SERVER_PORT;
+unsigned primaryPort = 0;											//if not 0, the server is a read-only replica of the primary on this port
+char *replicaUser = NULL;
+unsigned nReadWorkers = 0;											//number of processes that serve the searches from the shared main database
+int isReadWorker = 0;
+pid_t readWorkersPid[MAX_READ_WORKERS];
+struct stat usersFilesStat[2];										//the users files imported by a read worker
+char *syncClasses = DEFAULT_SYNC_CLASSES;							//the classes of messages that the logger syncs to disk
+unsigned groupCommitMs = 0;											//for how long the logger can wait for other messages, before a sync
+unsigned long lastLsn = 0;											//the last log sequence number assigned to a main change (protected by the main write lock)
+int walDirect = 0;													//if 1, the logger writes the WAL with O_DIRECT
+unsigned slowReqUs = 0;												//the requests slower than this are logged, 0 to disable the slow request log
+char *captureFilename = NULL;										//if not NULL, all the requests are captured in this file
+pthread_mutex_t checkpointMutex = PTHREAD_MUTEX_INITIALIZER;		//the checkpoints of the console and of the checkpoint thread write the same files
 
 
 
 int main(int argc, char **argv){
 
-	parseCmdLine(argc, argv, &port);
+	parseCmdLine(argc, argv, &port, &primaryPort, &replicaUser, &nReadWorkers, &syncClasses, &groupCommitMs, &walDirect, &slowReqUs, &captureFilename);
 
-	/* setups the semaphore and the message queue global variables */
+	/* setups the semaphore and the logger ring buffer global variables */
 	srand(time(NULL));
-	if((msgQueue = msgget(IPC_PRIVATE, 0600))==-1) fatalError("msgget() failed");
+	initLogRing();
+	initStats();
+	initRespCache();
+	initCrc32c();
+	if(captureFilename) initCapture(captureFilename);
 	if((sem = semget(IPC_PRIVATE, TOT_SEMAPHORES_N, IPC_CREAT | 0600))==-1) fatalError("semget() failed");
 
 	if(mkdir(RESOURCES_FOLDER, 0700)==-1) if(errno!=EEXIST) fatalError("mkdir() failed");
 	if(mkdir(LOG_FOLDER, 0700)==-1) if(errno!=EEXIST) fatalError("mkdir() failed");
-
-	/* tries to access the RECOVERY_DATA_FILENAME, if it exists means that the last shutdown was forced and data has to be recovered */
-	if(!access(RECOVERY_DATA_FILENAME, F_OK)) mainDynArr = recoverMainDynArr();
+	if(mkdir(WAL_FOLDER, 0700)==-1) if(errno!=EEXIST) fatalError("mkdir() failed");
+
+	/* the change feed starts from the sequence number of the last export, and it's filled by the eventual recovery */
+	/* (a replica doesn't have its own main data, it receives a snapshot from the primary) */
+	if(!primaryPort){
+		initFeed(importSeq(MAIN_DB_SEQ_FILENAME));
+		lastLsn = importSeq(MAIN_DB_LSN_FILENAME);
+		if(lastLsn<IMPORTED_REC_VERSION) lastLsn = IMPORTED_REC_VERSION;	//the log sequence numbers are also the versions of the records
+		atomic_store(&logRing->checkpointLsn, lastLsn);
+
+		/* if there are WAL segments, the last shutdown was forced and data has to be recovered */
+		/* (only the records after the last checkpoint) */
+		unsigned long *walSegs;
+		if(listWalSegments(&walSegs)) mainDynArr = recoverMainDynArr(lastLsn);
+		free(walSegs);
+	}
 
 
 	loggerPid = fork();
@@ -67,7 +96,15 @@ int main(int argc, char **argv){
 		if(retVal>>8!=0) fatalError("(MAIN) server process failed")
 		else while(waitpid(loggerPid, &retVal, 0)==-1) if(errno!=EINTR) fatalError("waitpid() failed");
 	}
-	else fatalError("(MAIN) logger process failed")
+	else if(retVal>>8!=0) fatalError("(MAIN) logger process failed")
+	else{															//the logger can exit first, right after the safe shutdown message
+		while(waitpid(serverPid, &retVal, 0)==-1) if(errno!=EINTR) fatalError("waitpid() failed");
+		if(retVal>>8!=0) fatalError("(MAIN) server process failed")
+	}
+
+	/* after a safe shutdown deletes the WAL, so that the next time data doesn't have to be recovered */
+	/* (only once the logger has exited, so that it can't create another segment) */
+	if(!primaryPort) removeWal();
 	
 	if(semctl(sem, 123, IPC_RMID)==-1) fatalError("semctl() failed");
 	exit(0);
@@ -115,6 +152,7 @@ void sigAlrmMainHandler(int x){
  */
 void safeShutdown(int x){
 	printNow("\nSafe shutdown started.\n");
+	stopReadWorkers();
 
 	struct timespec t;
 	struct sembuf op;
@@ -126,8 +164,15 @@ void safeShutdown(int x){
 	t.tv_sec = SEMAPHORE_SAFE_SHUTDOWN_TIMEOUT;
 	t.tv_nsec = 0;
 	while(semtimedop(sem, &op, 1, &t)==-1) if(errno!=EINTR) fatalError("semtimedop() failed, or reached timeout");
-	if(mainDynArr) exportDynArr(mainDynArr, MAIN_DB_FILENAME);
-	printNow("Saved main dynamic array.\n");
+	if(clock_gettime(CLOCK_REALTIME, &t)==-1) fatalError("clock_gettime() failed");
+	t.tv_sec += SEMAPHORE_SAFE_SHUTDOWN_TIMEOUT;					//a checkpoint holds only the read lock, and writes the same files
+	if(pthread_mutex_timedlock(&checkpointMutex, &t)) fatalError("pthread_mutex_timedlock() failed, or reached timeout");
+	if(!primaryPort){
+		if(mainDynArr) exportDynArr(mainDynArr, MAIN_DB_FILENAME);
+		exportSeq(getFeedLastSeq(), MAIN_DB_SEQ_FILENAME);			//the sequence number of the last change included in the export
+		exportSeq(lastLsn, MAIN_DB_LSN_FILENAME);
+		printNow("Saved main dynamic array.\n");
+	}
 
 	/* exports the user dynamic arrays */
 	op.sem_num = USER_WRITE_SEM;
@@ -144,9 +189,6 @@ void safeShutdown(int x){
 	logMsg(msg);
 
 	printNow("Safe shutdown successfully completed.\n");
-	
-	/* if successfull deletes the RECOVERY_DATA_FILENAME, so that the next time data doesn't have to be recovered */
-	if(unlink(RECOVERY_DATA_FILENAME)==-1) fatalError("unlink() failed");
 
 	if(close(mainSocket)==-1) fatalError("close() failed");
 	exit(0);
@@ -159,9 +201,14 @@ void safeShutdown(int x){
  */
 
 void serverProcess(void){
-	if(!mainDynArr) mainDynArr = importDynArr(MAIN_DB_FILENAME, MAIN_TYPE);
+	if(primaryPort) mainDynArr = initDynArr(0);						//a replica waits for the snapshot from the primary
+	else if(!mainDynArr) mainDynArr = importDynArr(MAIN_DB_FILENAME, MAIN_TYPE);
 	privUsersDynArr = importDynArr(PRIV_USERS_DB_FILENAME, USER_TYPE);
 	normUsersDynArr = importDynArr(NORM_USERS_DB_FILENAME, USER_TYPE);
+	if(nReadWorkers) initSharedDb(mainDynArr);
+#ifdef TRACE
+	initTrace();
+#endif
 
 	struct sigaction act;
 	act.sa_flags = 0;
@@ -179,6 +226,8 @@ void serverProcess(void){
 
 
 	if((mainSocket = socket(AF_INET, SOCK_STREAM, 0))==-1) error("socket() failed");
+	int reuse = 1;													//the connections of the replicas would keep the port busy, after a restart
+	if(setsockopt(mainSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse))==-1) error("setsockopt() failed");
 
 	struct sockaddr_in serverAddr;
 	memset(&serverAddr, 0, sizeof(serverAddr));
@@ -194,12 +243,129 @@ void serverProcess(void){
 	printNow(msg.txt);
 	logMsg(msg);
 
+	/* starts the read workers, before creating any other thread */
+	if(nReadWorkers) startReadWorkers();
+
 	/* starts the server console thread */
 	pthread_t tid;
 	if(pthread_create(&tid, NULL, (void *) serverConsoleThread, (void *) &tid)) fatalError("pthread_create() failed");
 
+	/* a replica starts the replication thread */
+	pthread_t replicaTid;
+	if(primaryPort && pthread_create(&replicaTid, NULL, (void *) replicationThread, NULL)) fatalError("pthread_create() failed");
+
+	/* a primary starts the checkpoint thread */
+	pthread_t checkpointTid;
+	if(!primaryPort && pthread_create(&checkpointTid, NULL, (void *) checkpointThread, NULL)) fatalError("pthread_create() failed");
+
+	acceptConnections(mainSocket);
+}
+
+
+
+/*
+ *  Creates the socket of the read workers, on the server port + READ_WORKERS_PORT_OFFSET,
+ *  and forks 'nReadWorkers' read worker processes that accept connections from it.
+ *  (has to be called after the creation of the shared main database)
+ */
+
+void startReadWorkers(void){
+	int readSocket;
+	if((readSocket = socket(AF_INET, SOCK_STREAM, 0))==-1) error("socket() failed");
+	int reuse = 1;
+	if(setsockopt(readSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse))==-1) error("setsockopt() failed");
+
+	struct sockaddr_in readAddr;
+	memset(&readAddr, 0, sizeof(readAddr));
+	readAddr.sin_family = AF_INET;
+	readAddr.sin_addr.s_addr = htonl(INADDR_ANY);
+	readAddr.sin_port = htons(port + READ_WORKERS_PORT_OFFSET);
+
+	if(bind(readSocket, (struct sockaddr *) &readAddr, sizeof(readAddr))==-1) error("bind() failed");
+	if(listen(readSocket, SERVER_BACKLOG)==-1) error("listen() failed");
+
+	for(unsigned i=0; i<nReadWorkers; i++){
+		if((readWorkersPid[i] = fork())==-1) fatalError("fork() failed");
+		if(!readWorkersPid[i]) readWorkerProcess(readSocket);
+	}
+	if(close(readSocket)==-1) error("close() failed");				//only the read workers accept connections from it
+
+	msgS msg;
+	msg.type = INFO_MSG;
+	sprintf(msg.txt, "Started %u read workers on port %u.\n", nReadWorkers, port + READ_WORKERS_PORT_OFFSET);
+	printNow(msg.txt);
+	logMsg(msg);
+}
+
+
+
+/*
+ *  Terminates the read workers, and waits for them.
+ */
+
+void stopReadWorkers(void){
+	for(unsigned i=0; i<nReadWorkers; i++) if(readWorkersPid[i]>0) kill(readWorkersPid[i], SIGINT);
+	for(unsigned i=0; i<nReadWorkers; i++) if(readWorkersPid[i]>0) while(waitpid(readWorkersPid[i], NULL, 0)==-1) if(errno!=EINTR) break;
+}
+
+
+
+/*
+ *  The function where will execute a read worker process.
+ *  A read worker serves only the search requests, using the shared main database,
+ *  so that all the cores can serve them without having more copies of the data.
+ *
+ *    'readSocket' = the listening socket of the read workers.
+ */
+
+void readWorkerProcess(int readSocket){
+	isReadWorker = 1;
+	if(mprotect(sharedDb, SHARED_DB_SIZE, PROT_READ)==-1) fatalError("mprotect() failed"); //only the server process writes the shared segment
+	if(close(mainSocket)==-1) error("close() failed");
+
+	struct sigaction act;
+	act.sa_flags = 0;
+	act.sa_restorer = NULL;
+	if(sigfillset(&act.sa_mask)==-1) fatalError("sigfillset() failed");
+	if(sigdelset(&act.sa_mask, SIGQUIT)==-1) fatalError("sigdelset() failed");
+
+	act.sa_handler = sigIntWorkerHandler;
+	if(sigaction(SIGINT, &act, NULL)==-1) fatalError("sigaction() failed");
+
+	/* the users dynamic arrays inherited from the server process, are re-imported when the files change */
+	if(stat(PRIV_USERS_DB_FILENAME, &usersFilesStat[0])==-1) error("stat() failed");
+	if(stat(NORM_USERS_DB_FILENAME, &usersFilesStat[1])==-1) error("stat() failed");
+
+	acceptConnections(readSocket);
+}
+
+
+
+/*
+ *  SIGINT handler for the read worker processes,
+ *  they don't have data to save, so they just exit.
+ *
+ *    'x' = dummy variable
+ */
+
+void sigIntWorkerHandler(int x){
+	_exit(0);
+}
+
+
+
+/*
+ *  Accepts the client connections from a listening socket,
+ *  and starts a connection thread for each one of them.
+ *
+ *    'sockFd' = the listening socket.
+ */
+
+void acceptConnections(int sockFd){
 	socklen_t clientAddrLen;
 	connThS *thData;
+	msgS msg;
+	msg.type = INFO_MSG;
 
 	/* listens for client connections */
 	while(1){
@@ -207,18 +373,55 @@ void serverProcess(void){
 		thData = malloc(sizeof(struct connectionThreadStruct));
 
 		clientAddrLen = sizeof(struct sockaddr_in);
-		while((thData->socket = accept(mainSocket, (struct sockaddr *) &thData->addr, &clientAddrLen))==-1) if(errno!=EINTR) error("accept() failed"); //wait for requests
+		while((thData->socket = accept(sockFd, (struct sockaddr *) &thData->addr, &clientAddrLen))==-1) if(errno!=EINTR) error("accept() failed"); //wait for requests
+		traceBegin(TRACE_ACCEPT);
 
 		sprintf(msg.txt, "Received connection from '%s'", inet_ntoa(thData->addr.sin_addr));
 		logMsg(msg);
 
 		if(pthread_create(&thData->tid, NULL, (void *) connectionThread, (void *) thData)) fatalError("pthread_create() failed");
+		traceEnd(TRACE_ACCEPT);
 
 	}
 	exit(2);
 }
 
 
+
+/*
+ *  Re-imports the users dynamic arrays of a read worker,
+ *  if the server process exported them after the last import.
+ *  (every export creates a new file, so it's enough to check the inode and the modification time)
+ */
+
+void refreshUserDynArrs(void){
+	char *filenames[2] = {PRIV_USERS_DB_FILENAME, NORM_USERS_DB_FILENAME};
+	dArrS **dynArrs[2] = {&privUsersDynArr, &normUsersDynArr};
+	struct stat st;
+	dArrS *old;
+	int changed = 0;
+
+	startUserRead();												//the server process exports the files while holding the user write lock
+	for(int i=0; i<2; i++){
+		if(stat(filenames[i], &st)==-1) error("stat() failed");
+		if(st.st_ino!=usersFilesStat[i].st_ino || st.st_mtim.tv_sec!=usersFilesStat[i].st_mtim.tv_sec || st.st_mtim.tv_nsec!=usersFilesStat[i].st_mtim.tv_nsec) changed = 1;
+	}
+	endUserRead();
+	if(!changed) return;
+
+	startUserWrite();												//excludes also the other connection threads of the worker
+	for(int i=0; i<2; i++){
+		if(stat(filenames[i], &st)==-1) error("stat() failed");
+		if(st.st_ino==usersFilesStat[i].st_ino && st.st_mtim.tv_sec==usersFilesStat[i].st_mtim.tv_sec && st.st_mtim.tv_nsec==usersFilesStat[i].st_mtim.tv_nsec) continue;
+		old = *dynArrs[i];
+		*dynArrs[i] = importDynArr(filenames[i], USER_TYPE);
+		delDynArr(old);
+		usersFilesStat[i] = st;
+	}
+	endUserWrite();
+}
+
+
 void connectionThread(void *v){
 	connThS *thData = v;
 	msgS msg;
@@ -241,44 +444,64 @@ void connectionThread(void *v){
 
 
 	unsigned permission = NO_PERM;
-	unsigned long index;
-	int i;
+	unsigned long index, expVersion, curVersion, lsn = 0;
+	int durable = 0;												//if the writes are acknowledged only after being synced to disk
+	recS *rec;
+	recSliceS slice;
+	char *p, *op;
+	char reqType;
+	char reqKey[MAX_NAME_LEN+1];
+	unsigned long reqStart;
+	size_t respLen;													//0 if the response is a string, to send without its terminator
+	size_t keyLen;
+	unsigned long keyHash;
+	int i, res;
+	atomic_fetch_add(&stats->activeConns, 1);
+	unsigned long session = atomic_fetch_add(&stats->totalConns, 1);
+
+	char **txnOps = NULL;											//the operations of the transaction currently being received
+	unsigned long txnN = 0, txnMax = 0;
+	int txnAborted = 0;												//1 if the transaction being received has been discarded, until its commit chunk
 	for(i=0; i<MAX_LOGIN_TRY; i++){
+		if(isReadWorker) refreshUserDynArrs();						//the users could have been changed by the server process
 
 		if(!readFromSocket(userStr, thData->socket)) goto connection_exit; //listen client request
+		reqStart = getTimeNs();
 
 		if(userStr[0]!=TOKEN_REQ) goto connection_exit;					//the first requests have to be TOKEN_REQ
-		if(checkRecordString(userStr+1, USER_TYPE)){					//check the validity of the arrived user record string
+		traceBegin(TRACE_LOGIN);
+		if(parseRecordString(userStr+1, USER_TYPE, &slice)){			//check the validity of the arrived user record string
 			shortBuff[0] = INV_REQ_RESP;
 			writeToSocket(shortBuff, 1, thData->socket);
 			goto connection_exit;
 		}
 	
 		/* get the username and hash from request */
-		hash = username = userStr + 1;
-		while(*hash!=KEY_VALUE_SEPARATOR && *hash!='\0') hash++;
-		if(*hash=='\0') fatalError("This error should not occur");
-		*hash++ = '\0';
+		username = slice.key;
+		username[slice.keyLen] = '\0';
+		hash = slice.value;
 
 		/* username and password check */
 		startUserRead();
 		if(findIndexFromKey(username, normUsersDynArr, &index)){	//The user is a normal user
-			if(strcmp(hash, normUsersDynArr->arr[index]->value)){	//invalid password
+			if(strcmp(hash, dynArrRec(normUsersDynArr, index)->value)){	//invalid password
 				shortBuff[0] = INV_PASSWORD_RESP;
 			}
 			else{													//psw confirmed, user has now read permissions
 				permission = READ_PERM;
 				endUserRead();
+				traceEnd(TRACE_LOGIN);
 				break;
 			}
 		}
 		else if(findIndexFromKey(username, privUsersDynArr, &index)){ //the user is a privileged user
-			if(strcmp(hash, privUsersDynArr->arr[index]->value)){	//invalid password
+			if(strcmp(hash, dynArrRec(privUsersDynArr, index)->value)){	//invalid password
 				shortBuff[0] = INV_PASSWORD_RESP;
 			}
 			else{													//psw confirmed, user has now read and write permissions
 				permission = READ_WRITE_PERM;
 				endUserRead();
+				traceEnd(TRACE_LOGIN);
 				break;
 			}
 		}
@@ -286,6 +509,7 @@ void connectionThread(void *v){
 			shortBuff[0] = INV_USERNAME_RESP;
 		}
 		endUserRead();
+		traceEnd(TRACE_LOGIN);
 		sleep(FAILED_LOGIN_SLEEP);
 		if(i+1<MAX_LOGIN_TRY) writeToSocket(shortBuff, 1, thData->socket);
 	}
@@ -302,7 +526,11 @@ void connectionThread(void *v){
 	tokenStr[0] = SUCCESS_RESP;										//return success response to client
 	tokenStr[1] = permission;										//and its permission level
 	randomString(SESSION_TOKEN_LEN, token);
-	if(writeToSocket(tokenStr, SESSION_TOKEN_LEN+2, thData->socket)) goto connection_exit; //try to send the client the response with his token
+	traceBegin(TRACE_SOCKET_WRITE);
+	res = writeToSocket(tokenStr, SESSION_TOKEN_LEN+2, thData->socket);
+	traceEnd(TRACE_SOCKET_WRITE);
+	if(res) goto connection_exit;									//try to send the client the response with his token
+	histRecord(&stats->reqLatency[TOKEN_REQ-TOKEN_REQ], getTimeNs() - reqStart);
 
 
 	msg.type = INFO_MSG;
@@ -314,7 +542,14 @@ void connectionThread(void *v){
 
 	char *data;
 	while(1){														//read client request
-		if(!(readed = readFromSocket(buff, thData->socket))) break;
+		timePhases = slowReqUs!=0;									//the slow request log is checked once per request, not in every span
+		if(timePhases) resetPhases();
+		traceBegin(TRACE_SOCKET_READ);
+		if(captureFd!=-1) waitCapture(thData->socket);
+		readed = readFromSocket(buff, thData->socket);
+		traceEnd(TRACE_SOCKET_READ);
+		if(!readed) break;
+		reqStart = getTimeNs();
 		if(readed<SESSION_TOKEN_LEN+3 || buff[SESSION_TOKEN_LEN+1]!=QUERY_ITEMS_SEPARATOR) {
 			shortBuff[0] = INV_REQ_RESP;
 			writeToSocket(shortBuff, 1, thData->socket);
@@ -322,60 +557,189 @@ void connectionThread(void *v){
 		}
 		buff[SESSION_TOKEN_LEN+1] = '\0';
 		data = buff + SESSION_TOKEN_LEN+2;
+		reqType = buff[0];
+		respLen = 0;
+		traceBegin(traceReqSpan(reqType));
+		if(captureFd!=-1) captureRequest(session, reqType, data, reqStart);
+		if(timePhases){												//saves the key for the slow request log, before the data is parsed
+			p = data;
+			if((reqType==CAS_ADD_REQ || reqType==CAS_DEL_REQ) && (op = strchr(data, QUERY_ITEMS_SEPARATOR))) p = op + 1;
+			else if(reqType==TXN_REQ && data[0]!='\0' && data[1]!='\0') p = data + 2; //the key of the first operation
+			snprintf(reqKey, sizeof(reqKey), "%.*s", (int) strcspn(p, (char[3]){KEY_VALUE_SEPARATOR, TXN_OPS_SEPARATOR, '\0'}), p);
+		}
 
 
-		switch(buff[0]){
+		if((primaryPort && buff[0]!=SEARCH_REQ && buff[0]!=SUBSCRIBE_REQ && buff[0]!=STATS_REQ) || (isReadWorker && buff[0]!=SEARCH_REQ)){ //a replica serves only the read requests, and a read worker only the searches
+			buff[0] = READ_ONLY_RESP;
+			buff[1] = '\0';
+		}
+		else switch(buff[0]){
 			case SEARCH_REQ:										//search request
 				if(checkNameString(data)) goto connection_exit;		//check arrived data
-				startMainRead();
-				if(findIndexFromKey(data, mainDynArr, &index)){
-					buff[0] = SUCCESS_RESP;
-					recordToString(mainDynArr->arr[index], buff+1);
+				keyLen = strlen(data);
+				keyHash = hashKey(data, keyLen);
+				countHotKey(data, keyLen, keyHash);
+				if(!(respLen = lookupRespCache(data, keyLen, keyHash, buff))){	//the cached responses are sent without taking the lock
+					startMainRead();
+					traceBegin(TRACE_DB_OP);
+					if(isReadWorker) respLen = searchSharedDb(data, buff);	//the response is stored ready to send, with the record
+					else if(findIndexFromKey(data, mainDynArr, &index)) respLen = recordToResp(dynArrRec(mainDynArr, index), buff);
+					if(respLen) fillRespCache(keyHash, buff, respLen);
+					traceEnd(TRACE_DB_OP);
+					endMainRead();
 				}
+				if(respLen) atomic_fetch_add_explicit(&stats->searchHits, 1, memory_order_relaxed);
 				else{
 					buff[0] = FAIL_RESP;
 					buff[1] = '\0';
+					atomic_fetch_add_explicit(&stats->searchMisses, 1, memory_order_relaxed);
 				}
-				endMainRead();
 				break;
 			case ADD_REQ:											//add record request
 				if(permission!=READ_WRITE_PERM) goto connection_exit;
-				if(checkRecordString(data, MAIN_TYPE)) goto connection_exit; //check arrived data
+				if(parseRecordString(data, MAIN_TYPE, &slice)) goto connection_exit; //check arrived data
 				startMainWrite();
-				if(addRecToDynArr(stringToRecord(data), mainDynArr)) buff[0] = FAIL_RESP;
+				traceBegin(TRACE_DB_OP);
+				rec = sliceToRecord(&slice);
+				rec->version = lastLsn + 1;							//the version of a record is the log sequence number of its last write
+				if(addRecToDynArr(rec, mainDynArr)) buff[0] = FAIL_RESP;
 				else{
 					buff[0] = SUCCESS_RESP;
-					msg.type = RECOVERY_ADD_REC_MSG;
-					sprintf(msg.txt, "%s", data);
-					logMsg(msg);
+					lsn = publishMainChange(RECOVERY_ADD_REC_MSG, data);
 				}
+				traceEnd(TRACE_DB_OP);
 				endMainWrite();
+				if(buff[0]==SUCCESS_RESP) logMainChange(RECOVERY_ADD_REC_MSG, data, lsn, durable); //logged outside of the lock
+				else atomic_fetch_add_explicit(&stats->writeFails, 1, memory_order_relaxed);
 				buff[1] = '\0';
 				break;
 			case DEL_REQ:											//remove record request
 				if(permission!=READ_WRITE_PERM) goto connection_exit;
 				if(checkNameString(data)) goto connection_exit;		//check arrived data
 				startMainWrite();
+				traceBegin(TRACE_DB_OP);
 				if(removeRecFromDynArr(data, mainDynArr)) buff[0] = FAIL_RESP;
 				else{
 					buff[0] = SUCCESS_RESP;
-					msg.type = RECOVERY_DEL_REC_MSG;
-					sprintf(msg.txt, "%s", data);
-					logMsg(msg);
+					lsn = publishMainChange(RECOVERY_DEL_REC_MSG, data);
 				}
+				traceEnd(TRACE_DB_OP);
 				endMainWrite();
+				if(buff[0]==SUCCESS_RESP) logMainChange(RECOVERY_DEL_REC_MSG, data, lsn, durable);
+				else atomic_fetch_add_explicit(&stats->writeFails, 1, memory_order_relaxed);
 				buff[1] = '\0';
 				break;
+			case CAS_ADD_REQ:										//conditional add record request
+			case CAS_DEL_REQ:										//conditional remove record request
+				if(permission!=READ_WRITE_PERM) goto connection_exit;
+				p = data;											//the data should have this format: "'version';'record'"
+				while(*p!=QUERY_ITEMS_SEPARATOR && *p!='\0') p++;
+				if(*p=='\0') goto connection_exit;
+				*p++ = '\0';
+				if(checkVersionString(data)) goto connection_exit;	//check arrived data
+				expVersion = strtoul(data, NULL, 10);
+				if(buff[0]==CAS_ADD_REQ){
+					if(parseRecordString(p, MAIN_TYPE, &slice)) goto connection_exit;
+					rec = sliceToRecord(&slice);
+					startMainWrite();
+					traceBegin(TRACE_DB_OP);
+					rec->version = lastLsn + 1;
+					if(!(res = addRecToDynArrIfVersion(rec, mainDynArr, expVersion, &curVersion))) lsn = publishMainChange(RECOVERY_ADD_REC_MSG, p);
+					traceEnd(TRACE_DB_OP);
+					endMainWrite();
+					if(res) delRecord(rec);
+					else logMainChange(RECOVERY_ADD_REC_MSG, p, lsn, durable);
+				}
+				else{
+					if(checkNameString(p)) goto connection_exit;
+					startMainWrite();
+					traceBegin(TRACE_DB_OP);
+					if(!(res = removeRecFromDynArrIfVersion(p, mainDynArr, expVersion, &curVersion))) lsn = publishMainChange(RECOVERY_DEL_REC_MSG, p);
+					traceEnd(TRACE_DB_OP);
+					endMainWrite();
+					if(!res) logMainChange(RECOVERY_DEL_REC_MSG, p, lsn, durable);
+				}
+				if(res) atomic_fetch_add_explicit(&stats->writeFails, 1, memory_order_relaxed);
+				if(res==1){											//the array is full, or there isn't a record to remove
+					buff[0] = FAIL_RESP;
+					buff[1] = '\0';
+				}													//else return the new version, or the current one if they didn't match
+				else sprintf(buff, "%c%lu", res?VERSION_MISMATCH_RESP:SUCCESS_RESP, curVersion);
+				break;
+			case TXN_REQ:											//transaction request
+				if(permission!=READ_WRITE_PERM) goto connection_exit;
+				if(*data!=TXN_MORE_FLAG && *data!=TXN_COMMIT_FLAG) goto connection_exit;
+				res = txnAborted;									//the chunks of a discarded transaction are refused, up to its commit
+				p = data + 1;										//the operations are separated by TXN_OPS_SEPARATOR
+				while(*p!='\0'){
+					op = p;
+					while(*p!=TXN_OPS_SEPARATOR && *p!='\0') p++;
+					if(*p!='\0') *p++ = '\0';
+					if(checkTxnOpString(op)) goto connection_exit;	//check arrived data
+					if(res) continue;
+					if(txnN>=MAX_TXN_OPS){							//transaction too big, it's discarded
+						res = 1;
+						txnAborted = 1;
+						continue;
+					}
+					if(txnN==txnMax){
+						txnMax = txnMax ? txnMax<<1 : 64;
+						if(!(txnOps = realloc(txnOps, txnMax * sizeof(char *)))) error("realloc() failed");
+					}
+					if(!(txnOps[txnN] = malloc(strlen(op) + 1))) error("malloc() failed");
+					strcpy(txnOps[txnN++], op);
+				}
+				if(res || *data==TXN_COMMIT_FLAG){					//commit the transaction, or discard it
+					if(!res) res = commitTxn(txnOps, txnN, durable);
+					for(unsigned long j=0; j<txnN; j++) free(txnOps[j]);
+					txnN = 0;
+				}
+				if(*data==TXN_COMMIT_FLAG) txnAborted = 0;			//the next chunk starts a new transaction
+				if(res) atomic_fetch_add_explicit(&stats->writeFails, 1, memory_order_relaxed);
+				buff[0] = res?FAIL_RESP:SUCCESS_RESP;
+				buff[1] = '\0';
+				break;
+			case DURABILITY_REQ:									//durability mode request, for the following writes of the session
+				if(permission!=READ_WRITE_PERM) goto connection_exit;
+				if((*data!=DURABILITY_OFF && *data!=DURABILITY_ON) || data[1]!='\0') goto connection_exit;
+				durable = *data==DURABILITY_ON;
+				buff[0] = SUCCESS_RESP;
+				buff[1] = '\0';
+				break;
+			case STATS_REQ:											//stats request, the response is the same dump of the server console
+				if(permission!=READ_WRITE_PERM) goto connection_exit;
+				if((*data!=STATS_KEEP && *data!=STATS_RESET) || data[1]!='\0') goto connection_exit;
+				res = *data==STATS_RESET;
+				buff[0] = SUCCESS_RESP;
+				formatStats(buff+1);
+				if(res) resetStats();
+				break;
+			case SUBSCRIBE_REQ:										//change feed subscription request, the data should have this format: "'mode''lastSeq'"
+				if(*data!=FEED_FROM_NOW && *data!=FEED_RESUME && *data!=FEED_SNAPSHOT) goto connection_exit;
+				if(*data==FEED_RESUME && checkSeqString(data+1)) goto connection_exit; //check arrived data
+				subscribeToFeed(thData->socket, *data, *data==FEED_RESUME?strtoul(data+1, NULL, 10):0);
+				goto connection_exit;								//after a subscription, the connection is used only to push changes
 			default:
 				buff[0] = INV_REQ_RESP;
 				buff[1] = '\0';
 				break;
 		}
-		if(writeToSocket(buff, strlen(buff), thData->socket)) break;
+		traceBegin(TRACE_SOCKET_WRITE);
+		res = writeToSocket(buff, respLen?respLen:strlen(buff), thData->socket);
+		traceEnd(TRACE_SOCKET_WRITE);
+		traceEnd(traceReqSpan(reqType));
+		if(res) break;
+		reqStart = getTimeNs() - reqStart;
+		if(reqType>TOKEN_REQ && reqType<TOT_REQ) histRecord(&stats->reqLatency[reqType-TOKEN_REQ], reqStart);
+		if(timePhases) logSlowRequest(reqType, reqKey, &thData->addr, reqStart);
 	}
 
 
 	connection_exit:
+	atomic_fetch_sub(&stats->activeConns, 1);
+	if(captureFd!=-1) closeCapture();
+	for(unsigned long j=0; j<txnN; j++) free(txnOps[j]);
+	free(txnOps);
 	if(close(thData->socket)==-1) error("close() failed");
 	free(thData);
 	pthread_exit(0);
@@ -383,18 +747,279 @@ void connectionThread(void *v){
 
 
 
+/*
+ *  Applies all the operations of a transaction to the main dynamic array,
+ *  under a single write lock, and logs them to the WAL as a single record.
+ *  The operations are sent to the logger in parts, after releasing the lock,
+ *  and all the parts share the same log sequence number.
+ *  (assumes that all the operations have already been checked)
+ *
+ *    'ops' = array of valid transaction operation strings.
+ *    'nOps' = number of operations in 'ops'.
+ *    'durable' = 1 if it has to return only after the batch has been synced to disk, else 0.
+ *
+ *    returns 0 if the transaction has been committed, or
+ *    returns 1 if it could exceed the maximum size of the main dynamic array (and nothing has been applied).
+ */
+
+int commitTxn(char **ops, unsigned long nOps, int durable){
+	if(!ops && nOps) error("NULL argument");
+	msgS msg;
+	char *p = msg.txt;
+	size_t l;
+	recS *rec;
+
+	unsigned long nAdds = 0;
+	for(unsigned long i=0; i<nOps; i++) if(ops[i][0]==TXN_ADD_OP) nAdds++;
+
+	startMainWrite();
+	traceBegin(TRACE_DB_OP);
+	if(mainDynArr->size + nAdds > DYNARR_MAX_POSSIBLE_SIZE){		//checks the limit size before applying anything
+		traceEnd(TRACE_DB_OP);
+		endMainWrite();
+		return 1;
+	}
+	unsigned long lsn = ++lastLsn;									//all the records written by the transaction get its log sequence number as version
+	for(unsigned long i=0; i<nOps; i++){
+		if(ops[i][0]==TXN_ADD_OP){
+			rec = stringToRecord(ops[i]+1);
+			rec->version = lsn;
+			if(addRecToDynArr(rec, mainDynArr)) fatalError("This error should never occur");
+			appendToFeed(FEED_ADD_LINE, ops[i]+1, lsn);
+		}
+		else if(!removeRecFromDynArr(ops[i]+1, mainDynArr)) appendToFeed(FEED_DEL_LINE, ops[i]+1, 0);
+		syncSharedRec(ops[i]+1);
+		invalidateRespCache(ops[i]+1);
+	}
+	traceEnd(TRACE_DB_OP);
+	endMainWrite();
+
+	traceBegin(TRACE_WAL_HANDOFF);
+	msg.txt[0] = '\0';												//the operations are logged separated by TXN_OPS_SEPARATOR
+	for(unsigned long i=0; i<nOps; i++){
+		l = strlen(ops[i]);
+		if((p - msg.txt) + l + 2 >= BUFF_SIZE){					//the message is full, sends this part of the transaction
+			msg.type = RECOVERY_BATCH_MSG;
+			logRingPush(&msg, lsn, 0);
+			p = msg.txt;
+		}
+		if(i) *p++ = TXN_OPS_SEPARATOR;
+		p += sprintf(p, "%s", ops[i]);
+	}
+	msg.type = RECOVERY_BATCH_END_MSG;
+	logRingPush(&msg, lsn, durable);
+	if(durable) waitDurable(lsn);
+	traceEnd(TRACE_WAL_HANDOFF);
+	return 0;
+}
+
+
+
+/*
+ *  Publishes a committed change of the main dynamic array,
+ *  appending it to the change feed and copying it in the shared main database,
+ *  and assigns it the log sequence number of its WAL record.
+ *  (an added record has to have as version the log sequence number that will be assigned, lastLsn+1)
+ *  (has to be called while holding the main write lock,
+ *  so that the changes are published and numbered in commit order)
+ *
+ *    'type' = RECOVERY_ADD_REC_MSG or RECOVERY_DEL_REC_MSG.
+ *    'rec' = the added record string, or the key of the removed record.
+ *
+ *    returns the log sequence number of the change, to pass to logMainChange().
+ */
+
+unsigned long publishMainChange(long type, char *rec){
+	if(!rec) error("NULL argument");
+	appendToFeed(type==RECOVERY_ADD_REC_MSG?FEED_ADD_LINE:FEED_DEL_LINE, rec, ++lastLsn);
+	syncSharedRec(rec);
+	invalidateRespCache(rec);
+	return lastLsn;
+}
+
+
+
+/*
+ *  Logs a change of the main dynamic array to the WAL.
+ *  The record is copied straight from 'rec' into the slot of the ring buffer,
+ *  and the logger encodes the WAL record from the slot.
+ *  (has to be called after releasing the main write lock,
+ *  the logger writes the changes in order of log sequence number anyway)
+ *
+ *    'type' = RECOVERY_ADD_REC_MSG or RECOVERY_DEL_REC_MSG.
+ *    'rec' = the added record string, or the key of the removed record.
+ *    'lsn' = the log sequence number returned by publishMainChange().
+ *    'durable' = 1 if it has to return only after the change has been synced to disk, else 0.
+ */
+
+void logMainChange(long type, char *rec, unsigned long lsn, int durable){
+	if(!rec) error("NULL argument");
+	traceBegin(TRACE_WAL_HANDOFF);
+	logRingPushText(type, rec, strlen(rec), lsn, durable);
+	if(durable) waitDurable(lsn);
+	traceEnd(TRACE_WAL_HANDOFF);
+}
+
+
+
+/*
+ *  Exports the main dynamic array, if it changed since the last checkpoint,
+ *  so that the WAL segments with only older records can be recycled by the logger,
+ *  and a recovery has to replay only the records after it.
+ *  The log sequence number is exported last, so that if the checkpoint is interrupted,
+ *  the records after the previous checkpoint are replayed again on the new export.
+ *  Only the main read lock is held, that excludes the writers, so the array, 'lastLsn'
+ *  and the feed can't change, while the searches continue during the disk flushes.
+ *  (only for the primary, the replicas don't have a WAL)
+ */
+
+void checkpointMainDynArr(void){
+	msgS msg;
+	if(pthread_mutex_lock(&checkpointMutex)) fatalError("pthread_mutex_lock() failed");
+	startMainRead();
+	unsigned long lsn = lastLsn;
+	if(lsn==atomic_load(&logRing->checkpointLsn)){
+		endMainRead();
+		if(pthread_mutex_unlock(&checkpointMutex)) fatalError("pthread_mutex_unlock() failed");
+		return;
+	}
+	exportDynArr(mainDynArr, MAIN_DB_FILENAME);
+	exportSeq(getFeedLastSeq(), MAIN_DB_SEQ_FILENAME);
+	exportSeq(lsn, MAIN_DB_LSN_FILENAME);
+	syncDir(RESOURCES_FOLDER);										//the renames of the exports have to be durable, before recycling the WAL
+	atomic_store(&logRing->checkpointLsn, lsn);
+	endMainRead();
+	if(pthread_mutex_unlock(&checkpointMutex)) fatalError("pthread_mutex_unlock() failed");
+
+	msg.type = INFO_MSG;
+	sprintf(msg.txt, "Checkpoint of the main dynamic array at log sequence number %lu.", lsn);
+	logMsg(msg);
+}
+
+
+
+/*
+ *  The function where will execute the checkpoint thread,
+ *  that checkpoints the main dynamic array every WAL_CHECKPOINT_INTERVAL seconds.
+ *
+ *    'dummy' = dummy variable
+ */
+
+void checkpointThread(void *dummy){
+	sigset_t set;													//the safe shutdown has to be executed by another thread
+	if(sigemptyset(&set)==-1) fatalError("sigemptyset() failed");
+	if(sigaddset(&set, SIGINT)==-1) fatalError("sigaddset() failed");
+	if(pthread_sigmask(SIG_BLOCK, &set, NULL)) fatalError("pthread_sigmask() failed");
+
+	while(1){
+		sleep(WAL_CHECKPOINT_INTERVAL);
+		checkpointMainDynArr();
+	}
+}
+
+
+
+/*
+ *  Compacts a dynamic array, DYNARR_COMPACT_BATCH records at a time,
+ *  taking its write lock for every batch, so that the requests wait at most one batch.
+ *
+ *    'dynArr' = pointer to the global variable of the dynamic array, that can be replaced between two batches.
+ *    'lock' = the lock of the dynamic array, MAIN_LOCK or USER_LOCK.
+ *
+ *    returns the nanoseconds of the longest batch.
+ */
+
+unsigned long compactDynArrWithLock(dArrS **dynArr, unsigned lock){
+	if(!dynArr) error("NULL argument");
+	char cursor[MAX_NAME_LEN+1] = "";
+	unsigned long start, ns, maxNs = 0;
+	int done;
+	do{
+		if(lock==MAIN_LOCK){ startMainWrite(); }
+		else{ startUserWrite(); }
+		start = getTimeNs();
+		done = compactDynArr(*dynArr, cursor, DYNARR_COMPACT_BATCH);
+		ns = getTimeNs() - start;
+		if(lock==MAIN_LOCK){ endMainWrite(); }
+		else{ endUserWrite(); }
+		if(ns>maxNs) maxNs = ns;
+	}while(!done);
+	return maxNs;
+}
+
+
+
+/*
+ *  Compacts all the dynamic arrays without stopping the requests,
+ *  and then returns to the system the free memory of the heap.
+ *  (see compactDynArr())
+ */
+
+void compactDynArrs(void){
+	unsigned long start = getTimeNs(), maxNs, ns;
+	maxNs = compactDynArrWithLock(&mainDynArr, MAIN_LOCK);
+	if((ns = compactDynArrWithLock(&privUsersDynArr, USER_LOCK))>maxNs) maxNs = ns;
+	if((ns = compactDynArrWithLock(&normUsersDynArr, USER_LOCK))>maxNs) maxNs = ns;
+	malloc_trim(0);
+	printf("\nCompaction done in %.1f ms, the write locks have been held at most %.1f us at a time.\n", (getTimeNs() - start) / 1e6, maxNs / 1e3);
+}
+
+
+
+/*
+ *  Prints the memory used by every dynamic array, its index and its records,
+ *  and by the whole heap, from the server console.
+ */
+
+void printMemoryUsage(void){
+	dArrS **dynArrs[3] = {&mainDynArr, &privUsersDynArr, &normUsersDynArr};
+	char *names[3] = {"Main records", "Privileged users", "Normal users"};
+	size_t indexBytes[3], recBytes[3];
+	unsigned long sizes[3];
+	unsigned long rss = 0;
+	FILE *f;
+
+	startMainRead();
+	indexBytes[0] = getDynArrMemory(mainDynArr, &recBytes[0]);
+	sizes[0] = mainDynArr->size;
+	endMainRead();
+	startUserRead();
+	for(int i=1; i<3; i++){
+		indexBytes[i] = getDynArrMemory(*dynArrs[i], &recBytes[i]);
+		sizes[i] = (*dynArrs[i])->size;
+	}
+	endUserRead();
+	struct mallinfo2 mi = mallinfo2();
+	if((f = fopen("/proc/self/statm", "r"))){
+		if(fscanf(f, "%*u %lu", &rss)!=1) rss = 0;
+		fclose(f);
+	}
+
+	printf("\nMemory usage:\n");
+	for(int i=0; i<3; i++) printf("%s = %lu,   Index = %zu bytes,   Records = %zu bytes\n", names[i], sizes[i], indexBytes[i], recBytes[i]);
+	printf("Heap = %zu bytes,   In use = %zu bytes,   Free = %zu bytes,   Resident = %lu bytes\n", mi.arena + mi.hblkhd, mi.uordblks + mi.hblkhd, mi.fordblks, rss * sysconf(_SC_PAGESIZE));
+	fflush(stdout);
+}
+
+
+
 void serverConsoleThread(void *dummy){
 	char buff[BUFF_SIZE];
 	char *key, *value;
 	recS *rec;
 	msgS msg;
+	unsigned long lsn;
 	int command = 1;
 	printf("Server console initialized.");
-	char askStr[] = "\n\nAvailable commands:\n\t- Administration:\n\t\t0: Safe shutdown.\n\t- Main dynamic array:\n\t\t1: Print main dynamic array.\n\t\t2: Add main record. (or modify an already existing one)\n\t\t3: Remove main record.\n\t- Privileged users dynamic array:\n\t\t4: Print privileged users dynamic array.\n\t\t5: Add privileged user. (or modify password of an already existing one)\n\t\t6: Remove privileged user.\n\t- Normal users dynamic array:\n\t\t7: Print normal users dynamic array.\n\t\t8: Add normal user. (or modify password of an already existing one)\n\t\t9: Remove normal user.\n\nEnter command: ";
+	char askStr[] = "\n\nAvailable commands:\n\t- Administration:\n\t\t0: Safe shutdown.\n\t- Main dynamic array:\n\t\t1: Print main dynamic array.\n\t\t2: Add main record. (or modify an already existing one)\n\t\t3: Remove main record.\n\t- Privileged users dynamic array:\n\t\t4: Print privileged users dynamic array.\n\t\t5: Add privileged user. (or modify password of an already existing one)\n\t\t6: Remove privileged user.\n\t- Normal users dynamic array:\n\t\t7: Print normal users dynamic array.\n\t\t8: Add normal user. (or modify password of an already existing one)\n\t\t9: Remove normal user.\n\t- Replication:\n\t\t10: Print replication status. (only for replicas)\n\t\t11: Print shared main database stats. (only with read workers)\n\t- Logger:\n\t\t12: Print logger ring buffer stats.\n\t\t13: Checkpoint the main dynamic array. (only for the primary)\n\t\t14: Dump the trace events. (only if compiled with tracing)\n\t- Stats:\n\t\t15: Print the server stats.\n\t\t16: Print the response cache stats and the hot keys.\n\t- Memory:\n\t\t17: Compact the dynamic arrays, and print the memory usage before and after.\n\nEnter command: ";
 	char errStr[] = "Invalid command, try again.\n\n";
 	while(command){												//loop until a safe shutdown command is received
-		while(!readLine(askStr, errStr, 1, buff, NULL)) printf("%s", errStr);
+		while(!readLine(askStr, errStr, 2, buff, NULL)) printf("%s", errStr);
 		command = atoi(buff);
+		if(primaryPort && (command==2 || command==3)){				//the main dynamic array of a replica can be changed only by the primary
+			printf("This server is a read-only replica, the main records can be changed only on the primary.\n");
+			continue;
+		}
 		switch(command){
 			case 0:													//safe shutdown
 				if(kill(0, SIGINT)) fatalError("kill() failed");
@@ -409,21 +1034,33 @@ void serverConsoleThread(void *dummy){
 				msg.type = RECOVERY_ADD_REC_MSG;
 				readMainRecordString(msg.txt);
 				startMainWrite();
-				if(addRecToDynArr(stringToRecord(msg.txt), mainDynArr)) printf("Maximum size reached, can't add the record.\n");
-				else printf("Main record added.\n");
-				endMainWrite();
-				logMsg(msg);
+				rec = stringToRecord(msg.txt);
+				rec->version = lastLsn + 1;
+				if(addRecToDynArr(rec, mainDynArr)){
+					endMainWrite();
+					printf("Maximum size reached, can't add the record.\n");
+				}
+				else{
+					lsn = publishMainChange(msg.type, msg.txt);
+					endMainWrite();
+					logMainChange(msg.type, msg.txt, lsn, 0);
+					printf("Main record added.\n");
+				}
 				break;
 			case 3:													//remove main record
 				msg.type = RECOVERY_DEL_REC_MSG;
 				readNameString(msg.txt, NULL);
 				startMainWrite();
-				if(removeRecFromDynArr(msg.txt, mainDynArr)) printf("There isn't a main record with name '%s'.\n", msg.txt);
+				if(removeRecFromDynArr(msg.txt, mainDynArr)){
+					endMainWrite();
+					printf("There isn't a main record with name '%s'.\n", msg.txt);
+				}
 				else{
-					logMsg(msg);
+					lsn = publishMainChange(msg.type, msg.txt);
+					endMainWrite();
+					logMainChange(msg.type, msg.txt, lsn, 0);
 					printf("The main record with name '%s' has been removed.\n", msg.txt);
 				}
-				endMainWrite();
 				break;
 			case 4:													//print privileged users dynamic array
 				printf("\n\n\n\n\n- - - Privileged users dynamic array - - -\n");
@@ -491,6 +1128,37 @@ void serverConsoleThread(void *dummy){
 				exportDynArr(normUsersDynArr, NORM_USERS_DB_FILENAME);
 				endUserWrite();
 				break;
+			case 10:												//print replication status
+				if(primaryPort) printReplicationStatus();
+				else printf("This server is not a replica.\n");
+				break;
+			case 11:												//print shared main database stats
+				printSharedDbStats();
+				break;
+			case 12:												//print logger ring buffer stats
+				printLogRingStats();
+				break;
+			case 13:												//checkpoint the main dynamic array
+				if(primaryPort) printf("A replica doesn't have a WAL to checkpoint.\n");
+				else{
+					checkpointMainDynArr();
+					printf("Checkpoint done at log sequence number %lu.\n", atomic_load(&logRing->checkpointLsn));
+				}
+				break;
+			case 14:												//dump the trace events
+				printTraceDump();
+				break;
+			case 15:												//print the server stats
+				printStats();
+				break;
+			case 16:												//print the response cache stats and the hot keys
+				printRespCacheStats();
+				break;
+			case 17:												//compact the dynamic arrays
+				printMemoryUsage();
+				compactDynArrs();
+				printMemoryUsage();
+				break;
 			default:												//invalid command
 				printf("%s", errStr);
 				break;
@@ -507,9 +1175,17 @@ void serverConsoleThread(void *dummy){
  *    'argc' = the main argc variable.
  *    'argv' = the main argv variable.
  *    'port' = a pointer where will be saved the evetual port.
+ *    'primaryPort' = a pointer where will be saved the eventual port of the primary, if the server is a replica.
+ *    'replicaUser' = a pointer where will be saved the eventual user, that a replica uses to login to the primary.
+ *    'nReadWorkers' = a pointer where will be saved the eventual number of read workers.
+ *    'syncClasses' = a pointer where will be saved the eventual classes of messages that the logger syncs to disk.
+ *    'groupCommitMs' = a pointer where will be saved the eventual group commit window of the logger.
+ *    'walDirect' = a pointer where will be saved 1, if the WAL has to be written with O_DIRECT.
+ *    'slowReqUs' = a pointer where will be saved the eventual threshold of the slow request log.
+ *    'captureFilename' = a pointer where will be saved the eventual file where the requests are captured.
  */
 
-void parseCmdLine(int argc, char **argv, int *port){
+void parseCmdLine(int argc, char **argv, int *port, int *primaryPort, char **replicaUser, int *nReadWorkers, char **syncClasses, int *groupCommitMs, int *walDirect, int *slowReqUs, char **captureFilename){
 
 	for(int i=1; i<argc; i++){
 		if(argv[i][0]!='-' || argv[i][0]=='\0') continue;
@@ -517,12 +1193,36 @@ void parseCmdLine(int argc, char **argv, int *port){
 			case 'p':
 				if(i+1<argc) *port = atoi(argv[i+1]);
 				break;
+			case 'r':
+				if(i+1<argc) *primaryPort = atoi(argv[i+1]);
+				break;
+			case 'u':
+				if(i+1<argc) *replicaUser = argv[i+1];
+				break;
+			case 'w':
+				if(i+1<argc) *nReadWorkers = atoi(argv[i+1]);
+				break;
+			case 's':
+				if(i+1<argc) *syncClasses = argv[i+1];
+				break;
+			case 'g':
+				if(i+1<argc) *groupCommitMs = atoi(argv[i+1]);
+				break;
+			case 'd':
+				*walDirect = 1;
+				break;
+			case 't':
+				if(i+1<argc) *slowReqUs = atoi(argv[i+1]);
+				break;
+			case 'c':
+				if(i+1<argc) *captureFilename = argv[i+1];
+				break;
 			case 'e':
 				printf("%s\n", (char[8]){67,108,97,117,100,105,111,0});
 				fflush(stdout);
 				exit(3);
 			case 'h':
-				printf("Options:\n\t-p (port)\n\t-h display this help and exit\n");
+				printf("Options:\n\t-p (port)\n\t-r (primary port) run as a read-only replica of the local primary server\n\t-u (username) user with which the replica logins to the primary\n\t-w (n) start n read worker processes, that serve the searches on port + 1 from a shared copy of the database\n\t-s (classes) the classes of log messages synced to disk: e (errors), w (warnings), i (infos), r (recovery data), 0 (none). default: " DEFAULT_SYNC_CLASSES "\n\t-g (ms) group commit window, for how long the logger can wait for other messages before syncing them together\n\t-d write the WAL with O_DIRECT, bypassing the page cache\n\t-t (us) log the requests slower than this, with the time spent in each phase\n\t-c (file) capture all the requests in a file, that can be replayed with the replay tool\n\t-h display this help and exit\n");
 				exit(0);
 			default:
 			invalid:
@@ -531,4 +1231,20 @@ void parseCmdLine(int argc, char **argv, int *port){
 		}
 		if(argv[i][2]!='\0') goto invalid;
 	}
+	if(*primaryPort && (!*replicaUser || checkUsernameString(*replicaUser))){
+		printf("A replica needs a valid user to login to the primary, use -h for help.\n");
+		exit(1);
+	}
+	if(*nReadWorkers<0 || *nReadWorkers>MAX_READ_WORKERS){
+		printf("The number of read workers has to be between 0 and %d, use -h for help.\n", MAX_READ_WORKERS);
+		exit(1);
+	}
+	if(*slowReqUs<0){
+		printf("Invalid slow request threshold, use -h for help.\n");
+		exit(1);
+	}
+	if(strspn(*syncClasses, SYNC_CLASSES_CHARSET)!=strlen(*syncClasses) || (*groupCommitMs<0 || *groupCommitMs>MAX_GROUP_COMMIT_MS)){
+		printf("Invalid sync classes, or group commit window (max %d ms), use -h for help.\n", MAX_GROUP_COMMIT_MS);
+		exit(1);
+	}
 }
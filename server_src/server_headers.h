@@ -29,21 +29,62 @@
 #include <sys/ipc.h>
 #include <sys/msg.h>
 #include <sys/sem.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <dirent.h>
 #include <pthread.h>
 #include <signal.h>
 #include <fcntl.h>
 #include <time.h>
+#include <malloc.h>
 
 
 
-#define twoPow(x) ((unsigned long)1<<x)
+#define twoPow(x) ((unsigned long)1<<(x))
 #define error(str) { errorHandler(str, errno, __func__, __LINE__); }
 #define fatalError(str) { printf("FATAL ERROR: %s. (func: %s() line: %d)\nERRNO (%d): %s\n", str, __func__, __LINE__, errno, strerror(errno)); fflush(stdout); kill(0, SIGQUIT); exit(2); }
-#define logMsg(msg) { while(msgsnd(msgQueue, &msg, strlen(msg.txt)+1, 0)==-1) if(errno!=EINTR) fatalError("msgsnd() failed"); }
+#define logMsg(msg) { logRingPush(&msg, 0, 0); }
 #define semaphore(nSem, nToken) { while(semop(sem, &(struct sembuf){nSem,nToken,0}, 1)==-1) if(errno!=EINTR) error("semop() failed"); }
 
 
 
+//the spans recorded by the tracing, when compiled with -DTRACE ('make trace'),
+//and timed for the slow request log, when it's enabled
+enum traceSpans{
+	TRACE_ACCEPT,
+	TRACE_LOGIN,
+	TRACE_SOCKET_READ,
+	TRACE_LOCK_WAIT,
+	TRACE_DB_OP,
+	TRACE_WAL_HANDOFF,
+	TRACE_LOG_MSG,
+	TRACE_SOCKET_WRITE,
+	TRACE_REQ,														//the span of a request is TRACE_REQ + (type - TOKEN_REQ)
+	TOT_TRACE_SPANS = TRACE_REQ + TOT_REQ - TOKEN_REQ
+};
+
+enum tracePhases{
+	TRACE_BEGIN,
+	TRACE_END
+};
+
+#ifdef TRACE
+#define traceBegin(span) { if(timePhases) phaseBegin(span); traceEvent(span, TRACE_BEGIN); }
+#define traceEnd(span) { if(timePhases) phaseEnd(span); traceEvent(span, TRACE_END); }
+#define traceLockWait(phase) traceEvent(TRACE_LOCK_WAIT, phase)
+#else
+#define traceBegin(span) { if(timePhases) phaseBegin(span); }
+#define traceEnd(span) { if(timePhases) phaseEnd(span); }
+#define traceLockWait(phase)
+#endif
+#define traceReqSpan(type) ( TRACE_REQ + (unsigned char) (type) - TOKEN_REQ )
+
+
+
 //the index of the varius semaphores
 enum semaphores{
 	MAIN_READ_SEM,
@@ -55,14 +96,24 @@ enum semaphores{
 
 #define TOT_READ_TOKENS 20
 
-#define startMainRead() { semaphore(MAIN_WRITE_SEM, -1); semaphore(MAIN_READ_SEM, -1); semaphore(MAIN_WRITE_SEM, 1); }
+//the semaphore pairs, whose wait times are counted in the stats
+enum locks{
+	MAIN_LOCK,
+	USER_LOCK,
+	TOT_LOCKS
+};
+
+//the wait is timed only for the slow request log, or once every LOCK_WAIT_SAMPLE acquisitions of the thread
+#define lockWaitStart() ( ++lockWaitSample>=LOCK_WAIT_SAMPLE || timePhases ? getTimeNs() : 0 )
+
+#define startMainRead() { unsigned long lockStart = lockWaitStart(); traceLockWait(TRACE_BEGIN); semaphore(MAIN_WRITE_SEM, -1); semaphore(MAIN_READ_SEM, -1); semaphore(MAIN_WRITE_SEM, 1); traceLockWait(TRACE_END); if(lockStart) recordLockWait(MAIN_LOCK, lockStart); }
 #define endMainRead() { semaphore(MAIN_READ_SEM, 1); }
-#define startMainWrite() { semaphore(MAIN_WRITE_SEM, -1); semaphore(MAIN_READ_SEM, -TOT_READ_TOKENS); }
+#define startMainWrite() { unsigned long lockStart = lockWaitStart(); traceLockWait(TRACE_BEGIN); semaphore(MAIN_WRITE_SEM, -1); semaphore(MAIN_READ_SEM, -TOT_READ_TOKENS); traceLockWait(TRACE_END); if(lockStart) recordLockWait(MAIN_LOCK, lockStart); }
 #define endMainWrite() { semaphore(MAIN_WRITE_SEM, 1); semaphore(MAIN_READ_SEM, TOT_READ_TOKENS); }
 
-#define startUserRead() { semaphore(USER_WRITE_SEM, -1); semaphore(USER_READ_SEM, -1); semaphore(USER_WRITE_SEM, 1); }
+#define startUserRead() { unsigned long lockStart = lockWaitStart(); traceLockWait(TRACE_BEGIN); semaphore(USER_WRITE_SEM, -1); semaphore(USER_READ_SEM, -1); semaphore(USER_WRITE_SEM, 1); traceLockWait(TRACE_END); if(lockStart) recordLockWait(USER_LOCK, lockStart); }
 #define endUserRead() { semaphore(USER_READ_SEM, 1); }
-#define startUserWrite() { semaphore(USER_WRITE_SEM, -1); semaphore(USER_READ_SEM, -TOT_READ_TOKENS); }
+#define startUserWrite() { unsigned long lockStart = lockWaitStart(); traceLockWait(TRACE_BEGIN); semaphore(USER_WRITE_SEM, -1); semaphore(USER_READ_SEM, -TOT_READ_TOKENS); traceLockWait(TRACE_END); if(lockStart) recordLockWait(USER_LOCK, lockStart); }
 #define endUserWrite() { semaphore(USER_WRITE_SEM, 1); semaphore(USER_READ_SEM, TOT_READ_TOKENS); }
 
 
@@ -74,7 +125,11 @@ enum semaphores{
 #define PRIV_USERS_DB_FILENAME RESOURCES_FOLDER "priv_user_db.txt"
 #define NORM_USERS_DB_FILENAME RESOURCES_FOLDER "norm_user_db.txt"
 #define BASE_LOG_FILENAME LOG_FOLDER "server_log"
-#define RECOVERY_DATA_FILENAME RESOURCES_FOLDER "recovery_data.txt"
+#define MAIN_DB_SEQ_FILENAME RESOURCES_FOLDER "main_db_seq.txt"
+#define MAIN_DB_LSN_FILENAME RESOURCES_FOLDER "main_db_lsn.txt"		//the last WAL record included in the export
+#define WAL_FOLDER RESOURCES_FOLDER "wal/"
+#define WAL_SEGMENT_PREFIX "wal_"
+#define WAL_SEGMENT_SUFFIX ".bin"
 
 #define MAIN_SAFE_SHUTDOWN_TIMEOUT 30
 #define SEMAPHORE_SAFE_SHUTDOWN_TIMEOUT 12
@@ -83,52 +138,138 @@ enum semaphores{
 
 #define DYNARR_MAX_POSSIBLE_POWER 16
 #define DYNARR_MAX_POSSIBLE_SIZE twoPow(DYNARR_MAX_POSSIBLE_POWER)
+#define DYNARR_SEGMENT_POWER 10										//the dynamic arrays grow by segments of 2^DYNARR_SEGMENT_POWER records
+#define DYNARR_SEGMENT_SIZE twoPow(DYNARR_SEGMENT_POWER)
+#define DYNARR_MAX_SEGMENTS twoPow(DYNARR_MAX_POSSIBLE_POWER-DYNARR_SEGMENT_POWER)
+#define DYNARR_SLAB_SIZE (64*1024)									//the maximum size of the blocks where a compaction relocates the records
+#define DYNARR_COMPACT_BATCH 256									//the records relocated every time the write lock is taken, by a compaction
+#define IMPORTED_REC_VERSION 1										//the version of the main records imported without one, the log sequence numbers start after it
 
 #define SERVER_BACKLOG 100
 #define SERVER_SESSION_TIMEOUT 300
 #define SOCKET_READ_TIMEOUT SERVER_SESSION_TIMEOUT
 #define SOCKET_WRITE_TIMEOUT 10
 
+#define FEED_HISTORY_LEN 4096
+#define FEED_HEARTBEAT_INTERVAL 5
+#define REPLICA_RETRY_INTERVAL 2
+#define REPLICA_READ_TIMEOUT ( FEED_HEARTBEAT_INTERVAL * 3 )
+
+#define MAX_READ_WORKERS 64
+#define READ_WORKERS_PORT_OFFSET 1									//the read workers listen on the server port + READ_WORKERS_PORT_OFFSET
+
+#define WAL_SEGMENT_SIZE ( 4 * 1024 * 1024 )							//a new segment is started when the next record doesn't fit
+#define WAL_SEGMENT_MAGIC 0x4C415745								//"EWAL" at the start of every segment
+#define WAL_MAX_REC_LEN ( MAX_TXN_OPS * ( MAX_MAIN_REC_STR_LEN + 2 ) )	//the payload of the biggest transaction
+#define WAL_DIRECT_ALIGN 4096										//alignment of the buffers, offsets and lengths written with O_DIRECT
+#define WAL_CHECKPOINT_INTERVAL 30									//seconds between the checkpoints of the main dynamic array
+
+#define TRACE_FILENAME RESOURCES_FOLDER "trace.json"
+#define TRACE_RING_EVENTS 65536										//events kept for every thread, has to be a power of 2
+#define TRACE_MAX_RINGS 256											//threads that can trace at the same time
+
+#define CAPTURE_BUFF_SIZE 65536										//the requests captured by a thread are written together
+#define CAPTURE_FLUSH_INTERVAL_MS 1000								//or when the oldest one has waited this long
+
+#define RESP_CACHE_SLOTS 4096										//entries of the search response cache, has to be a power of 2
+#define RESP_CACHE_MAX_LEN ( 1 + MAX_MAIN_REC_STR_LEN )				//the response type followed by the record string
+#define HOT_KEYS_TOP 16												//the hottest keys shown by the console
+#define HOT_KEYS_SKETCH_DEPTH 4										//rows of the count-min sketch
+#define HOT_KEYS_SKETCH_WIDTH 4096									//counters of every row, has to be a power of 2
+#define HOT_KEYS_SKETCH_SAMPLE 16									//every thread counts one search every this many, has to be a power of 2
+#define HOT_KEYS_SAMPLE 8											//the hot keys are updated every this many counted searches of a key, has to be a power of 2
+
+#define SLOW_LOG_MAX_PER_SEC 20										//the slow requests over this rate are only counted
+#define LOCK_WAIT_SAMPLE 16											//the lock waits in the stats are timed every this many acquisitions, and scaled
+
+#define LOGGER_MAX_BATCH 256										//maximum number of messages written and synced together
+#define LOG_RING_SLOTS 1024											//has to be a power of 2
+#define LOG_RING_STALL_TIMEOUT_MS 100
+#define MAX_GROUP_COMMIT_MS 1000
+
 #define FAILED_LOGIN_SLEEP 5
 #define MAX_LOGIN_TRY 5
 
 
 //global variables
-extern int msgQueue;
 extern int sem;
+extern unsigned primaryPort;
+extern char *replicaUser;
+extern unsigned nReadWorkers;
+extern int isReadWorker;
+extern char *syncClasses;
+extern unsigned groupCommitMs;
+extern int walDirect;
+extern unsigned slowReqUs;
+extern char *captureFilename;
+extern unsigned long lastLsn;
 
 
 
 //database.c
 typedef struct recordStruct{
-	char *key;
+	char *key;														//can be stored inline, right after the struct (see sliceToRecord())
 	char *value;
+	char *resp;														//the response to a search, SUCCESS_RESP followed by "key:value", or NULL
+	size_t respLen;
+	unsigned long version;											//the log sequence number of its last write, 0 for the user records
+	struct slabStruct *slab;										//the slab where the record has been relocated, or NULL if it has its own allocation
 } recS;
 
+typedef struct slabStruct{
+	struct dynamicArrayStruct *dynArr;								//the dynamic array of its records
+	size_t size;													//the bytes of 'data', at most DYNARR_SLAB_SIZE
+	size_t used;
+	unsigned long live;												//the records still stored in it, it's freed when they are all deleted
+	char data[] __attribute__((aligned(8)));
+} slabS;
+
 typedef struct dynamicArrayStruct{
-	unsigned power;
+	unsigned nSegs;													//the allocated segments, the first ones of 'segs'
 	unsigned long size;
-	unsigned long maxSize;
-	struct recordStruct **arr;
+	unsigned long maxSize;											//'nSegs' * DYNARR_SEGMENT_SIZE
+	struct recordStruct **segs[DYNARR_MAX_SEGMENTS];				//the segments, of DYNARR_SEGMENT_SIZE record pointers each
+	struct slabStruct *slab;										//the slab being filled by a compaction, or NULL
+	size_t slabBytes;												//the bytes allocated for all its slabs
 } dArrS;
 
+#define dynArrRec(dynArr, i) ((dynArr)->segs[(i) >> DYNARR_SEGMENT_POWER][(i) & (DYNARR_SEGMENT_SIZE-1)])	//the i-th record of a dynamic array
+
+extern dArrS *mainDynArr;
+extern dArrS *privUsersDynArr;
+extern dArrS *normUsersDynArr;
+
 recS *initRecord(char *key, char *value);
 void delRecord(recS *rec);
 recS **initArr(unsigned power);
 dArrS *initDynArr(unsigned power);
 void delDynArr(dArrS *dynArr);
+int growDynArr(dArrS *dynArr);
+void shrinkDynArr(dArrS *dynArr);
+void openDynArrGap(dArrS *dynArr, unsigned long index);
+void closeDynArrGap(dArrS *dynArr, unsigned long index);
 int appendRecToDynArr(recS *rec, dArrS *dynArr);
 int findIndexFromKeyRecursive(char *key, dArrS *dynArr, unsigned long *retVal, unsigned long p1, unsigned long p2);
 int findIndexFromKey(char *key, dArrS *dynArr, unsigned long *retVal);
 int addRecToDynArr(recS *rec, dArrS *dynArr);
 int removeRecFromDynArr(char *key, dArrS *dynArr);
+unsigned long getRecVersion(char *key, dArrS *dynArr);
+int addRecToDynArrIfVersion(recS *rec, dArrS *dynArr, unsigned long expVersion, unsigned long *curVersion);
+int removeRecFromDynArrIfVersion(char *key, dArrS *dynArr, unsigned long expVersion, unsigned long *curVersion);
 void printDynArr(dArrS *dynArr);
+recS *relocateRecord(recS *rec, dArrS *dynArr, unsigned long left);
+int compactDynArr(dArrS *dynArr, char *cursor, unsigned long n);
+size_t getDynArrMemory(dArrS *dynArr, size_t *recBytes);
 unsigned neededPow(unsigned long n);
 size_t recordToString(recS *rec, char *dest);
+size_t recordToResp(recS *rec, char *dest);
+recS *sliceToRecord(recSliceS *slice);
 recS *stringToRecord(char *str);
 void exportDynArr(dArrS *dynArr, char *filename);
 dArrS *importDynArr(char *filename, unsigned char dynArrType);
-dArrS *recoverMainDynArr(void);
+void exportSeq(unsigned long seq, char *filename);
+unsigned long importSeq(char *filename);
+dArrS *recoverMainDynArr(unsigned long fromLsn);
 
 
 //error_handler.c
@@ -149,16 +290,382 @@ enum msgType{
 	SUCCESSFULL_SAFE_SHUTDOWN,
 	RECOVERY_ADD_REC_MSG,
 	RECOVERY_DEL_REC_MSG,
+	RECOVERY_BATCH_MSG,
+	RECOVERY_BATCH_END_MSG,
 	TOT_MSG_TYPES
 };
 
+//the classes of messages that can be selected to be synced to disk, with the -s option
+enum syncClass{
+	SYNC_NONE = '0',
+	SYNC_ERR_CLASS = 'e',
+	SYNC_WARN_CLASS = 'w',
+	SYNC_INFO_CLASS = 'i',
+	SYNC_RECOVERY_CLASS = 'r'
+};
+
+#define SYNC_CLASSES_CHARSET "0ewir"
+#define DEFAULT_SYNC_CLASSES "r"									//by default only the recovery data is synced, not the diagnostic logs
+
+//a recovery message received before the previous ones, kept until all of them are written
+typedef struct reorderNodeStruct{
+	unsigned long lsn;
+	long type;
+	int forceSync;
+	char *txt;
+	size_t len;
+	struct reorderNodeStruct *next;									//the next part of the same batch
+} reorderNodeS;
+
 void sigIntLoggerHandler(int x);
 void sigAlrmLoggerHandler(int x);
 char *writeTime(char *dest);
+int needsSync(long type);
+size_t formatLogMsg(msgS *msg, char *dest);
+void writevToFile(int fd, struct iovec *iov, int n);
+void addToIov(int fd, struct iovec *iov, int *n, char *buff, size_t len);
+void writeInOrder(long type, char *txt, size_t len, int forceSync);
+void storeOutOfOrder(unsigned long lsn, long type, int forceSync, char *txt, size_t len);
+void drainReorderBuff(void);
 void loggerProcess(void);
 void logg(long type, char *txt);
 
 
+//log_ring.c
+typedef struct logEntryStruct{
+	unsigned long lsn;												//log sequence number of a recovery message, or 0 for the other messages
+	int forceSync;													//the recovery data file has to be synced, even if its class is not selected
+	size_t len;														//the length of msg.txt
+	msgS msg;
+} logEntryS;
+
+typedef struct logSlotStruct{
+	atomic_ulong seq;												//position+1 when the message is published, position+LOG_RING_SLOTS when the slot is free again
+	logEntryS entry;
+} logSlotS;
+
+typedef struct logRingStruct{
+	_Alignas(64) atomic_ulong tail;									//the next position that will be reserved by a producer
+	_Alignas(64) atomic_ulong head;									//the next position that will be read by the logger
+	atomic_uint loggerWake;											//futex where the logger waits, when the ring buffer is empty
+	atomic_int loggerSleeping;
+	atomic_uint spaceWake;											//futex where the producers wait, when the ring buffer is full
+	atomic_int producersWaiting;
+	_Alignas(64) atomic_ulong durableLsn;							//all the recovery messages before this log sequence number are synced to disk
+	atomic_uint durableWake;										//futex where the durable writes wait to be synced
+	atomic_int durableWaiters;
+	_Alignas(64) atomic_ulong checkpointLsn;						//the WAL records up to this log sequence number are included in the last export
+	_Alignas(64) atomic_ulong maxDepth;
+	atomic_ulong pushed;
+	atomic_ulong drops;												//diagnostic messages dropped, because the ring buffer was full
+	atomic_ulong stalls;											//messages that had to wait, because the ring buffer was full
+	_Alignas(64) logSlotS slots[LOG_RING_SLOTS];
+} logRingS;
+
+extern logRingS *logRing;
+
+void initLogRing(void);
+void futexWait(atomic_uint *addr, unsigned val, long long timeoutMs);
+void futexWake(atomic_uint *addr, int n);
+void logRingPush(msgS *msg, unsigned long lsn, int forceSync);
+void logRingPushText(long type, const char *txt, size_t len, unsigned long lsn, int forceSync);
+logEntryS *logRingPeek(long long timeoutMs);
+void logRingRelease(void);
+void setDurableLsn(unsigned long lsn);
+void waitDurable(unsigned long lsn);
+void printLogRingStats(void);
+
+
+//wal.c
+typedef struct walSegHeaderStruct{
+	uint32_t magic;													//WAL_SEGMENT_MAGIC
+	uint32_t crc;													//CRC32C of 'firstSeq'
+	uint64_t firstSeq;												//the sequence number of the first record, also in the name of the segment
+} walSegHeaderS;
+
+typedef struct walRecHeaderStruct{
+	uint32_t crc;													//CRC32C of the rest of the header and of the payload
+	uint32_t len;													//length of the payload, that follows the header
+	uint64_t seq;													//log sequence number, every record has a different one
+	uint32_t op;
+	uint32_t reserved;												//always 0, keeps the header size a multiple of 8
+} walRecHeaderS;
+
+enum walOp{
+	WAL_ADD_OP = 1,													//the payload is a "key:value" record string
+	WAL_DEL_OP,														//the payload is the key of the removed record
+	WAL_TXN_OP,														//the payload is the operations of a transaction, separated by TXN_OPS_SEPARATOR
+	WAL_SEG_END_OP													//the segment is complete, the next record is in the segment starting with 'seq'
+};
+
+#define walRecSize(len) ( ( sizeof(walRecHeaderS) + (len) + 7 ) & ~7UL )	//the records are aligned to 8 bytes in the segments
+
+void initCrc32c(void);
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+uint32_t walRecCrc(walRecHeaderS *header, const char *payload);
+void walSegmentPath(char *dest, unsigned long firstSeq);
+void syncDir(char *path);
+void openWalSegment(unsigned long firstSeq);
+void growWalBuff(size_t len);
+void encodeWalRecord(unsigned long seq, unsigned op, char *payload, size_t len);
+void appendWalRecord(unsigned long seq, unsigned op, char *payload, size_t len);
+void flushWal(void);
+void pwriteToFile(int fd, char *buff, size_t len, off_t offset);
+unsigned long listWalSegments(unsigned long **seqs);
+int compareSeqs(const void *a, const void *b);
+unsigned long seekWalSegment(unsigned long *seqs, unsigned long n, unsigned long seq);
+int replayWalRecord(walRecHeaderS *header, char *payload, dArrS *dynArr);
+void replayWal(dArrS *dynArr, unsigned long fromSeq);
+void removeWal(void);
+
+extern int walFd;
+extern unsigned long *walSegs;
+extern unsigned long nWalSegs;
+
+
+//feed.c
+typedef struct feedEntryStruct{
+	unsigned long seq;
+	long long time;													//commit time, in milliseconds since the epoch
+	char type;														//FEED_ADD_LINE or FEED_DEL_LINE
+	unsigned long version;											//the version of the added record
+	char rec[MAX_MAIN_REC_STR_LEN+1];								//the added record, or the key of the removed one
+} feedEntryS;
+
+long long getTimeMs(void);
+void initFeed(unsigned long lastSeq);
+unsigned long appendToFeed(char type, char *rec, unsigned long version);
+unsigned long getFeedLastSeq(void);
+unsigned long getFeedOldestSeq(void);
+void subscribeToFeed(int sockFd, char mode, unsigned long lastSeq);
+
+
+//block_store.c
+#define BLOCK_STORE_BLOCK_SIZE 1024
+#define BLOCK_STORE_MAX_VALUE_SIZE ( MAX_N_NUMS * (1 + (MAX_NUM_LEN+1)/2) )	//the biggest value packed by encodeNums()
+#define BLOCK_STORE_MAX_ENTRY_SIZE ( 2 + MAX_NAME_LEN + 1 + BLOCK_STORE_MAX_VALUE_SIZE )
+#define BLOCK_STORE_MAX_BLOCKS ( DYNARR_MAX_POSSIBLE_SIZE / ((BLOCK_STORE_BLOCK_SIZE - 2) / BLOCK_STORE_MAX_ENTRY_SIZE) + 1 )
+
+typedef struct blockStoreStruct{
+	unsigned long nRecs;
+	unsigned long nBlocks;
+	uint64_t firstKeys[BLOCK_STORE_MAX_BLOCKS];						//the first 8 bytes of the first key of every block (see keyPrefix())
+} blockStoreS;														//followed by the blocks
+
+#define BLOCK_STORE_SIZE ( sizeof(blockStoreS) + BLOCK_STORE_MAX_BLOCKS * BLOCK_STORE_BLOCK_SIZE )
+
+typedef struct blockIteratorStruct{
+	blockStoreS *store;
+	unsigned long block;
+	unsigned entry;													//the index of the record in its block
+	size_t pos;														//the offset of the record from the start of its block
+	char key[MAX_NAME_LEN+1];										//the key of the record, once read
+	size_t keyLen;
+	unsigned char *value;											//the packed numbers of the record, once read
+	size_t valueLen;
+} blockIterS;
+
+typedef struct blockBuilderStruct{
+	blockStoreS *store;
+	unsigned char *block;											//the block being filled, NULL before the first record
+	uint16_t nEntries;												//the entries of the block
+	size_t used;													//the bytes used in the block
+	char prev[MAX_NAME_LEN+1];										//the last key added, not terminated
+	size_t prevLen;
+} blockBuilderS;
+
+void buildBlockStore(blockStoreS *store, dArrS *dynArr);
+void startBlockStore(blockBuilderS *builder, blockStoreS *store);
+void appendBlockStore(blockBuilderS *builder, char *key, size_t keyLen, unsigned char *value, size_t valueLen);
+void finishBlockStore(blockBuilderS *builder);
+size_t encodeBlockEntry(char *key, size_t keyLen, size_t prefix, unsigned char *value, size_t valueLen, unsigned char *dest);
+size_t encodeNums(char *nums, unsigned char *dest);
+size_t decodeNums(unsigned char *src, size_t len, char *dest);
+uint64_t keyPrefix(char *key, size_t keyLen);
+unsigned char *getStoreBlock(blockStoreS *store, unsigned long i);
+unsigned long findStoreBlock(blockStoreS *store, char *key, size_t keyLen);
+int seekBlockStore(blockStoreS *store, char *key, blockIterS *it);
+int readBlockIter(blockIterS *it);
+void advanceBlockIter(blockIterS *it);
+size_t blockIterToResp(blockIterS *it, char *dest);
+size_t searchBlockStore(blockStoreS *store, char *key, char *dest);
+size_t blockStoreBytes(blockStoreS *store);
+
+
+
+//shared_db.c
+typedef struct sharedRecordStruct{
+	unsigned long version;
+	unsigned keyLen;
+	unsigned respLen;
+	char data[];													//the search response of the record: SUCCESS_RESP followed by "key:value"
+} sharedRecS;
+
+typedef struct sharedDeltaStruct{
+	unsigned long size;												//the records of the delta
+	unsigned long arenaUsed;										//bytes used in the arena of the delta
+	unsigned long index[DYNARR_MAX_POSSIBLE_SIZE];					//offsets of the delta records from the start of the segment, sorted by key
+} sharedDeltaS;
+
+typedef struct sharedDbStruct{
+	unsigned base;													//the block store searched as the base, 0 or 1
+	unsigned delta;													//the delta where the changes are copied, 0 or 1
+	int merging;													//1 while the other delta is being merged with the base in the other block store
+	unsigned long compactions;
+	sharedDeltaS deltas[2];
+} sharedDbS;
+
+//the two arenas of the deltas follow the sharedDbS header, and every one can hold the biggest possible main dynamic array, plus one record
+//then there are the two block stores, one is the base with all the records, the other one is where the next base is merged
+//when the delta grows over a quarter of the base, it's frozen, and merged a few records for every write
+#define SHARED_REC_MAX_SIZE ( (sizeof(sharedRecS) + 1 + MAX_MAIN_REC_STR_LEN + 1 + 7) & ~7UL )
+#define SHARED_ARENA_SIZE ( (DYNARR_MAX_POSSIBLE_SIZE + 1) * SHARED_REC_MAX_SIZE )
+#define SHARED_DELTA_MIN_SIZE (256*1024)							//the bytes of delta allowed anyway, even if the base is small
+#define SHARED_DELTA_RATIO 4
+#define SHARED_MERGE_STEP 64										//the records merged in the next base for every write
+#define SHARED_DB_SIZE ( sizeof(sharedDbS) + 2 * SHARED_ARENA_SIZE + 2 * BLOCK_STORE_SIZE )
+#define sharedArena(i) ( sizeof(sharedDbS) + (i) * SHARED_ARENA_SIZE )	//the offset of the arena of the i-th delta
+#define sharedStore(i) ( (blockStoreS *) ((char *) sharedDb + sizeof(sharedDbS) + 2 * SHARED_ARENA_SIZE + (i) * BLOCK_STORE_SIZE) )
+#define sharedBase() sharedStore(sharedDb->base)
+
+//the state of the merge of the frozen delta and of the base, kept by the process of the writers
+typedef struct sharedMergeStruct{
+	blockIterS it;													//the next record of the base
+	int baseLeft;													//1 if 'it' is on a record
+	unsigned long next;												//the next record of the frozen delta
+	blockBuilderS builder;											//the next base
+} sharedMergeS;
+
+extern sharedDbS *sharedDb;
+
+void initSharedDb(dArrS *dynArr);
+void loadSharedDb(dArrS *dynArr);
+size_t sharedRecSize(size_t respLen);
+unsigned long copyToSharedArena(recS *rec);
+unsigned long copyTombstoneToSharedArena(char *key, size_t keyLen);
+void startSharedMerge(void);
+int stepSharedMerge(unsigned long n);
+int findSharedIndexFromKey(char *key, sharedDeltaS *delta, unsigned long *retVal);
+void syncSharedRec(char *rec);
+size_t searchSharedDb(char *key, char *dest);
+void printSharedDbStats(void);
+
+
+//replica.c
+void replicationThread(void *dummy);
+int connectToPrimary(char *token);
+int applyFeedLine(char *line, dArrS **snapshot);
+void printReplicationStatus(void);
+
+
+//trace.c
+typedef struct traceEventStruct{
+	uint64_t ticks;													//timestamp counter, converted to microseconds only in the dump
+	int32_t tid;
+	uint16_t span;
+	uint16_t phase;
+} traceEventS;
+
+typedef struct traceRingStruct{
+	traceEventS events[TRACE_RING_EVENTS];
+	atomic_ulong head;												//the number of events recorded, written only by the owner thread
+	pid_t tid;
+	unsigned index;													//the position in 'traceRings'
+} traceRingS;
+
+unsigned long long traceTicks(void);
+void initTrace(void);
+traceRingS *acquireTraceRing(void);
+void releaseTraceRing(void *ring);
+void traceEvent(unsigned span, unsigned phase);
+unsigned long dumpTrace(char *filename);
+void printTraceDump(void);
+
+
+//stats.c
+typedef struct statsStruct{
+	histS reqLatency[TOT_REQ-TOKEN_REQ];							//nanoseconds from the read of a request to the write of its response
+	atomic_ulong searchHits;
+	atomic_ulong searchMisses;
+	atomic_ulong writeFails;										//writes refused because of the size limit, a missing record or a version mismatch
+	atomic_ulong lockWaits[TOT_LOCKS];
+	atomic_ulong lockWaitNs[TOT_LOCKS];
+	atomic_ulong lockWaitMaxNs[TOT_LOCKS];
+	atomic_long activeConns;
+	atomic_ulong totalConns;										//also the ids of the sessions, in the request capture
+	atomic_ulong slowReqs;
+	atomic_ulong slowLogSecond;										//the second of the last slow request logged, and how many in it
+	atomic_ulong slowLogCount;
+	atomic_ulong slowLogSkipped;
+	atomic_ulong cacheHits;
+	atomic_ulong cacheMisses;
+	atomic_ulong cacheInvalidations;
+	long long startTime;
+} statsS;
+
+extern statsS *stats;
+extern char *reqTypeNames[TOT_REQ-TOKEN_REQ];
+extern __thread int timePhases;
+extern __thread unsigned lockWaitSample;
+
+void initStats(void);
+void recordLockWait(unsigned lock, unsigned long start);
+size_t formatStats(char *dest);
+void resetStats(void);
+void resetPhases(void);
+void phaseBegin(unsigned span);
+void phaseEnd(unsigned span);
+void logSlowRequest(char reqType, char *key, struct sockaddr_in *addr, unsigned long totalNs);
+void printStats(void);
+
+
+//cache.c
+typedef struct respCacheEntryStruct{
+	atomic_uint seq;												//odd while the entry is being written
+	atomic_uint respLen;
+	atomic_ulong keyHash;											//0 if the entry is empty
+	char resp[RESP_CACHE_MAX_LEN];									//SUCCESS_RESP followed by "key:value", not terminated
+} respCacheEntryS;
+
+typedef struct hotKeyStruct{
+	unsigned long count;											//estimated number of searches
+	char key[MAX_NAME_LEN+1];
+} hotKeyS;
+
+typedef struct respCacheStruct{
+	respCacheEntryS entries[RESP_CACHE_SLOTS];
+	atomic_ulong sketch[HOT_KEYS_SKETCH_DEPTH][HOT_KEYS_SKETCH_WIDTH];	//count-min sketch of the searched keys
+	atomic_flag hotLock;											//spinlock of the hot keys
+	atomic_ulong hotMin;											//the count of the coldest hot key, 0 if there are less than HOT_KEYS_TOP
+	unsigned nHot;
+	hotKeyS hot[HOT_KEYS_TOP];										//min-heap by count
+} respCacheS;
+
+extern respCacheS *respCache;
+
+void initRespCache(void);
+unsigned long hashKey(char *key, size_t keyLen);
+size_t lookupRespCache(char *key, size_t keyLen, unsigned long hash, char *dest);
+void fillRespCache(unsigned long hash, char *resp, size_t respLen);
+void invalidateRespCache(char *rec);
+void clearRespCache(void);
+void countHotKey(char *key, size_t keyLen, unsigned long hash);
+void updateHotKeys(char *key, size_t keyLen, unsigned long count);
+void resetHotKeys(void);
+int compareHotKeys(const void *a, const void *b);
+void printRespCacheStats(void);
+
+
+//capture.c
+extern int captureFd;
+
+void initCapture(char *filename);
+void captureRequest(unsigned long session, char type, char *data, unsigned long time);
+void flushCapture(void);
+void waitCapture(int socket);
+void closeCapture(void);
+
+
 //server.c
 typedef struct connectionThreadStruct{
 	pthread_t tid;
@@ -171,6 +678,20 @@ void sigIntMainHandler(int x);
 void sigAlrmMainHandler(int x);
 void safeShutdown(int x);
 void serverProcess(void);
+void startReadWorkers(void);
+void stopReadWorkers(void);
+void readWorkerProcess(int readSocket);
+void sigIntWorkerHandler(int x);
+void acceptConnections(int sockFd);
+void refreshUserDynArrs(void);
 void connectionThread(void *v);
+int commitTxn(char **ops, unsigned long nOps, int durable);
+unsigned long publishMainChange(long type, char *rec);
+void logMainChange(long type, char *rec, unsigned long lsn, int durable);
+void checkpointMainDynArr(void);
+void checkpointThread(void *dummy);
+unsigned long compactDynArrWithLock(dArrS **dynArr, unsigned lock);
+void compactDynArrs(void);
+void printMemoryUsage(void);
 void serverConsoleThread(void *dummy);
-void parseCmdLine(int argc, char **argv, int *port);
+void parseCmdLine(int argc, char **argv, int *port, int *primaryPort, char **replicaUser, int *nReadWorkers, char **syncClasses, int *groupCommitMs, int *walDirect, int *slowReqUs, char **captureFilename);
@@ -0,0 +1,333 @@
+
+#include "server_headers.h"
+
+
+sharedDbS *sharedDb = NULL;											//the copy of the main dynamic array shared with the read workers (if any)
+sharedMergeS sharedMerge;											//the merge of the frozen delta in progress, if 'sharedDb->merging'
+
+
+
+/*
+ *  Creates the shared memory segment, where will be kept
+ *  a copy of the main dynamic array readable by the read workers,
+ *  and loads in it all the records of 'dynArr'.
+ *  (has to be called before forking the read workers, so that they inherit the mapping)
+ *
+ *  The copy is made of a base, a compact block store of all the records (see buildBlockStore()),
+ *  and of a delta, with the records changed after the base has been built, searched first.
+ *  While a new base is being merged, the changes go in a second delta, searched before the frozen one.
+ *  The segment contains only offsets from its start, and no pointers,
+ *  so it's valid even if it's mapped at a different address.
+ *
+ *    'dynArr' = pointer to the main dynamic array.
+ */
+
+void initSharedDb(dArrS *dynArr){
+	int fd;
+	if((fd = memfd_create("main_db", 0))==-1) fatalError("memfd_create() failed");
+	if(ftruncate(fd, SHARED_DB_SIZE)==-1) fatalError("ftruncate() failed");	//the pages are allocated only when they are written
+	if((sharedDb = mmap(NULL, SHARED_DB_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0))==MAP_FAILED) fatalError("mmap() failed");
+	if(close(fd)==-1) fatalError("close() failed");
+	loadSharedDb(dynArr);
+}
+
+
+
+/*
+ *  Replaces all the content of the shared segment with the records of 'dynArr':
+ *  rebuilds the base with all of them, and empties the deltas, dropping the merge in progress.
+ *  (assumes that the main write lock is held, or that there aren't read workers yet)
+ *
+ *    'dynArr' = pointer to the main dynamic array.
+ */
+
+void loadSharedDb(dArrS *dynArr){
+	if(!dynArr) error("NULL argument");
+	if(!sharedDb) return;
+	buildBlockStore(sharedBase(), dynArr);
+	for(int i=0; i<2; i++){
+		sharedDb->deltas[i].size = 0;
+		sharedDb->deltas[i].arenaUsed = 0;
+	}
+	sharedDb->merging = 0;
+}
+
+
+
+/*
+ *  Returns the size that a record occupies in an arena.
+ *  (aligned to 8 bytes, so that the version of every record is aligned)
+ *
+ *    'respLen' = the length of the search response of the record.
+ */
+
+size_t sharedRecSize(size_t respLen){
+	return (sizeof(sharedRecS) + respLen + 1 + 7) & ~7UL;
+}
+
+
+
+/*
+ *  Copies a record at the end of the arena of the current delta, as its search response.
+ *  (assumes that the main write lock is held, and that the arena isn't full)
+ *
+ *    'rec' = pointer to a record of the main dynamic array.
+ *
+ *    returns the offset of the copied record, from the start of the segment.
+ */
+
+unsigned long copyToSharedArena(recS *rec){
+	if(!rec) error("NULL argument");
+	size_t keyLen = strlen(rec->key);
+	size_t respLen = rec->resp ? rec->respLen : 1 + keyLen + 1 + (rec->value?strlen(rec->value):0);
+	size_t recSize = sharedRecSize(respLen);
+	sharedDeltaS *delta = &sharedDb->deltas[sharedDb->delta];
+	if(delta->arenaUsed + recSize > SHARED_ARENA_SIZE) fatalError("This error should never occur");
+
+	unsigned long offset = sharedArena(sharedDb->delta) + delta->arenaUsed;
+	sharedRecS *sharedRec = (sharedRecS *) ((char *) sharedDb + offset);
+	sharedRec->version = rec->version;
+	sharedRec->keyLen = keyLen;
+	sharedRec->respLen = respLen;
+	recordToResp(rec, sharedRec->data);
+	delta->arenaUsed += recSize;
+	return offset;
+}
+
+
+
+/*
+ *  Copies at the end of the arena of the current delta a tombstone:
+ *  a record without a response, that hides the ones of the frozen delta and of the base with the same key.
+ *  (assumes that the main write lock is held, and that the arena isn't full)
+ *
+ *    'key' = the key of the removed record.
+ *    'keyLen' = the length of the key.
+ *
+ *    returns the offset of the tombstone, from the start of the segment.
+ */
+
+unsigned long copyTombstoneToSharedArena(char *key, size_t keyLen){
+	if(!key) error("NULL argument");
+	size_t recSize = sharedRecSize(1 + keyLen);
+	sharedDeltaS *delta = &sharedDb->deltas[sharedDb->delta];
+	if(delta->arenaUsed + recSize > SHARED_ARENA_SIZE) fatalError("This error should never occur");
+
+	unsigned long offset = sharedArena(sharedDb->delta) + delta->arenaUsed;
+	sharedRecS *sharedRec = (sharedRecS *) ((char *) sharedDb + offset);
+	sharedRec->version = 0;
+	sharedRec->keyLen = keyLen;
+	sharedRec->respLen = 0;
+	sharedRec->data[0] = FAIL_RESP;									//the key is stored where the one of a response is
+	memcpy(sharedRec->data + 1, key, keyLen);
+	sharedRec->data[1 + keyLen] = '\0';
+	delta->arenaUsed += recSize;
+	return offset;
+}
+
+
+
+/*
+ *  Starts compacting the shared segment, merging the delta in the base.
+ *  The overwritten and removed records of the delta are never freed,
+ *  so when the delta grows over 1/SHARED_DELTA_RATIO of the base (plus SHARED_DELTA_MIN_SIZE),
+ *  it's frozen, and the next changes go in the other delta, while the frozen one
+ *  is merged with the base in the other block store, SHARED_MERGE_STEP records for every write.
+ *  (so no write rebuilds the whole base while holding the main write lock,
+ *  unless the other delta fills up before the merge has been completed)
+ *  (assumes that the main write lock is held, and that no merge is in progress)
+ */
+
+void startSharedMerge(void){
+	sharedDb->delta = !sharedDb->delta;								//the other delta is empty, since the last merge has been completed
+	sharedDb->merging = 1;
+	seekBlockStore(sharedBase(), "", &sharedMerge.it);
+	sharedMerge.baseLeft = readBlockIter(&sharedMerge.it);
+	sharedMerge.next = 0;
+	startBlockStore(&sharedMerge.builder, sharedStore(!sharedDb->base));
+}
+
+
+
+/*
+ *  Merges the next records of the base and of the frozen delta in the next base,
+ *  and replaces the base with it, emptying the frozen delta, when all of them have been merged.
+ *  The records of the base are copied still packed, the ones of the delta replace them,
+ *  and the tombstones of the delta remove them.
+ *  (assumes that the main write lock is held, and that a merge is in progress)
+ *
+ *    'n' = the maximum number of records to merge, ULONG_MAX to complete the merge.
+ *
+ *    returns 1 if the merge has been completed, or
+ *    returns 0 if there are still records to merge.
+ */
+
+int stepSharedMerge(unsigned long n){
+	unsigned char value[BLOCK_STORE_MAX_VALUE_SIZE];
+	sharedDeltaS *frozen = &sharedDb->deltas[!sharedDb->delta];
+	blockIterS *it = &sharedMerge.it;
+	sharedRecS *rec;
+	int cmp;
+
+	for(; n && (sharedMerge.baseLeft || sharedMerge.next<frozen->size); n--){
+		rec = sharedMerge.next<frozen->size ? (sharedRecS *) ((char *) sharedDb + frozen->index[sharedMerge.next]) : NULL;
+		if(!rec) cmp = -1;
+		else if(!sharedMerge.baseLeft) cmp = 1;
+		else{
+			cmp = memcmp(it->key, rec->data + 1, it->keyLen < rec->keyLen ? it->keyLen : rec->keyLen);	//the key in the response isn't terminated
+			if(!cmp) cmp = (it->keyLen > rec->keyLen) - (it->keyLen < rec->keyLen);
+		}
+
+		if(cmp<0) appendBlockStore(&sharedMerge.builder, it->key, it->keyLen, it->value, it->valueLen);	//the record of the base hasn't changed
+		else if(rec->respLen) appendBlockStore(&sharedMerge.builder, rec->data + 1, rec->keyLen, value, encodeNums(rec->data + 2 + rec->keyLen, value));
+		if(cmp<=0){
+			advanceBlockIter(it);
+			sharedMerge.baseLeft = readBlockIter(it);
+		}
+		if(cmp>=0) sharedMerge.next++;
+	}
+	if(sharedMerge.baseLeft || sharedMerge.next<frozen->size) return 0;
+
+	finishBlockStore(&sharedMerge.builder);
+	sharedDb->base = !sharedDb->base;
+	frozen->size = 0;
+	frozen->arenaUsed = 0;
+	sharedDb->merging = 0;
+	sharedDb->compactions++;
+	return 1;
+}
+
+
+
+/*
+ *  Finds the index of a delta where the record
+ *  with the key string 'key' is, or should be inserted.
+ *  (assumes that the main read or write lock is held)
+ *
+ *    'key' = pointer to a valid key string.
+ *    'delta' = pointer to one of the deltas of the shared segment.
+ *    'retVal' = pointer to an integer variable where the correct index will be saved.
+ *
+ *    returns 1 if a record with the key string 'key' is present, else
+ *    returns 0
+ */
+
+int findSharedIndexFromKey(char *key, sharedDeltaS *delta, unsigned long *retVal){
+	if(!key || !delta || !retVal) error("NULL argument");
+	unsigned long p1 = 0, p2 = delta->size, half;
+	sharedRecS *rec;
+	int cmp;
+	while(p1<p2){
+		half = p1 + ((p2 - p1)>>1);
+		rec = (sharedRecS *) ((char *) sharedDb + delta->index[half]);
+		cmp = strncmp(key, rec->data + 1, rec->keyLen);				//the key in the response isn't terminated
+		if(!cmp) cmp = key[rec->keyLen]!='\0';
+		if(cmp<0) p2 = half;
+		else if(cmp>0) p1 = half + 1;
+		else{
+			*retVal = half;
+			return 1;
+		}
+	}
+	*retVal = p1;
+	return 0;
+}
+
+
+
+/*
+ *  Copies in the current delta of the shared segment the current state
+ *  of a record of the main dynamic array, or a tombstone, if it's still in the frozen delta or in the base.
+ *  Advances the merge in progress, and starts a new one if the delta is too big.
+ *  (has to be called after every change of the main dynamic array,
+ *  while still holding the main write lock)
+ *
+ *    'rec' = the added record string, or the key of the removed record.
+ */
+
+void syncSharedRec(char *rec){
+	if(!rec) error("NULL argument");
+	if(!sharedDb) return;
+	char key[MAX_NAME_LEN+1];
+	unsigned long sharedIndex, index, offset;
+	sharedDeltaS *delta;
+	blockIterS it;
+	size_t keyLen = strcspn(rec, (char[2]){KEY_VALUE_SEPARATOR, '\0'});
+	if(keyLen>MAX_NAME_LEN) error("invalid string");				//this error should never occur
+	memcpy(key, rec, keyLen);
+	key[keyLen] = '\0';
+
+	if(sharedDb->merging) stepSharedMerge(SHARED_MERGE_STEP);
+	delta = &sharedDb->deltas[sharedDb->delta];
+	size_t maxDelta = blockStoreBytes(sharedBase()) / SHARED_DELTA_RATIO + SHARED_DELTA_MIN_SIZE;
+	if(delta->size>=DYNARR_MAX_POSSIBLE_SIZE || delta->arenaUsed + SHARED_REC_MAX_SIZE > (maxDelta < SHARED_ARENA_SIZE ? maxDelta : SHARED_ARENA_SIZE)){
+		if(sharedDb->merging) stepSharedMerge(ULONG_MAX);			//the merge didn't keep up with the writes
+		startSharedMerge();
+		delta = &sharedDb->deltas[sharedDb->delta];
+	}
+
+	int found = findSharedIndexFromKey(key, delta, &sharedIndex);
+	if(findIndexFromKey(key, mainDynArr, &index)) offset = copyToSharedArena(dynArrRec(mainDynArr, index));	//the record has been added or overwritten
+	else if(found || (sharedDb->merging && findSharedIndexFromKey(key, &sharedDb->deltas[!sharedDb->delta], &index)) || seekBlockStore(sharedBase(), key, &it)) offset = copyTombstoneToSharedArena(key, keyLen);	//the record has been removed
+	else return;
+	if(!found){
+		memmove(delta->index+sharedIndex+1, delta->index+sharedIndex, (delta->size-sharedIndex)*sizeof(unsigned long));
+		delta->size++;
+	}
+	delta->index[sharedIndex] = offset;
+}
+
+
+
+/*
+ *  Searches a record in the shared segment, in the current delta, in the frozen one,
+ *  and then in the base, and copies its search response in 'dest'. (see recordToResp())
+ *  (assumes that the main read lock is held,
+ *  and that the buffer pointed by 'dest' has a size of BUFF_SIZE)
+ *
+ *    'key' = pointer to a valid key string.
+ *    'dest' = pointer to a buffer where the response will be saved.
+ *
+ *    returns the size of the response, or
+ *    returns 0 if the record hasn't been found
+ */
+
+size_t searchSharedDb(char *key, char *dest){
+	if(!key || !dest) error("NULL argument");
+	unsigned long index;
+	sharedDeltaS *delta;
+	sharedRecS *rec;
+	for(int i=0; i<=sharedDb->merging; i++){
+		delta = &sharedDb->deltas[sharedDb->delta ^ i];
+		if(!findSharedIndexFromKey(key, delta, &index)) continue;
+		rec = (sharedRecS *) ((char *) sharedDb + delta->index[index]);
+		if(!rec->respLen) return 0;									//a tombstone
+		memcpy(dest, rec->data, rec->respLen + 1);
+		return rec->respLen;
+	}
+	return searchBlockStore(sharedBase(), key, dest);
+}
+
+
+
+/*
+ *  Prints the stats of the shared segment.
+ */
+
+void printSharedDbStats(void){
+	if(!sharedDb){
+		printf("The shared main database is not enabled. (execute with -w for the read workers)\n");
+		return;
+	}
+	startMainRead();
+	printf("\nShared main database: %u read workers\n", nReadWorkers);
+	blockStoreS *base = sharedBase();
+	size_t baseBytes = blockStoreBytes(base);
+	printf("Base records = %lu,   Blocks = %lu,   Base size = %zu bytes (%.1f bytes per record)\n", base->nRecs, base->nBlocks, baseBytes, base->nRecs ? (double) baseBytes / base->nRecs : 0.0);
+	sharedDeltaS *delta = &sharedDb->deltas[sharedDb->delta], *frozen = &sharedDb->deltas[!sharedDb->delta];
+	printf("Delta records = %lu,   Arena used = %lu bytes,   Compactions = %lu\n", delta->size, delta->arenaUsed, sharedDb->compactions);
+	if(sharedDb->merging) printf("Frozen delta records = %lu,   Merged in the next base = %lu records\n", frozen->size, sharedMerge.builder.store->nRecs);
+	printf("\n");
+	endMainRead();
+	fflush(stdout);
+}
@@ -0,0 +1,203 @@
+
+#include "server_headers.h"
+
+
+statsS *stats;														//the counters shared by the server process and the read workers
+
+char *reqTypeNames[TOT_REQ-TOKEN_REQ] = {"TOKEN_REQ", "SEARCH_REQ", "ADD_REQ", "DEL_REQ", "CAS_ADD_REQ", "CAS_DEL_REQ", "TXN_REQ", "SUBSCRIBE_REQ", "DURABILITY_REQ", "STATS_REQ"};
+char *lockNames[TOT_LOCKS] = {"main", "user"};
+
+__thread unsigned long phaseStart[TRACE_REQ];						//the timings of the spans of the current request of the thread
+__thread unsigned long phaseNs[TRACE_REQ];
+__thread int timePhases = 0;										//1 if the spans of the current request of the thread are timed for the slow request log
+__thread unsigned lockWaitSample = 0;								//the lock acquisitions of the thread since the last one counted in the stats
+
+
+
+/*
+ *  Creates the shared memory segment of the stats.
+ *  (has to be called before forking the other processes, so that they inherit the mapping)
+ */
+
+void initStats(void){
+	if((stats = mmap(NULL, sizeof(statsS), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0))==MAP_FAILED) fatalError("mmap() failed");
+	stats->startTime = getTimeMs();
+}
+
+
+
+/*
+ *  Counts the time spent waiting for a lock, in the timings of the current request
+ *  if they are taken, and in the stats once every LOCK_WAIT_SAMPLE acquisitions,
+ *  scaled to estimate all of them. (the maximum is only the one of the sampled waits)
+ *  (called by the lock macros, after the lock has been taken, only if the wait was timed)
+ *
+ *    'lock' = MAIN_LOCK or USER_LOCK.
+ *    'start' = the time when the thread started waiting, returned by getTimeNs().
+ */
+
+void recordLockWait(unsigned lock, unsigned long start){
+	unsigned long wait = getTimeNs() - start;
+	if(timePhases) phaseNs[TRACE_LOCK_WAIT] += wait;
+	if(lockWaitSample<LOCK_WAIT_SAMPLE) return;
+	lockWaitSample = 0;
+	atomic_fetch_add_explicit(&stats->lockWaits[lock], LOCK_WAIT_SAMPLE, memory_order_relaxed);
+	atomic_fetch_add_explicit(&stats->lockWaitNs[lock], wait * LOCK_WAIT_SAMPLE, memory_order_relaxed);
+	unsigned long max = atomic_load_explicit(&stats->lockWaitMaxNs[lock], memory_order_relaxed);
+	while(wait>max && !atomic_compare_exchange_weak_explicit(&stats->lockWaitMaxNs[lock], &max, wait, memory_order_relaxed, memory_order_relaxed));
+}
+
+
+
+/*
+ *  Writes all the stats in a machine-readable format, one per line:
+ *  a name followed by a value, or by "key=value" pairs. (the times are in microseconds)
+ *
+ *    'dest' = pointer to a buffer where the stats will be written, of size BUFF_SIZE.
+ *
+ *    returns the length of the written string.
+ */
+
+size_t formatStats(char *dest){
+	if(!dest) error("NULL argument");
+	char *p = dest;
+	histS *h;
+	unsigned long total;
+
+	p += sprintf(p, "uptime_s %lld\n", (getTimeMs() - stats->startTime) / 1000);
+	p += sprintf(p, "connections.active %ld\nconnections.total %lu\n", atomic_load(&stats->activeConns), atomic_load(&stats->totalConns));
+	p += sprintf(p, "search.hits %lu\nsearch.misses %lu\nwrites.failed %lu\n", atomic_load(&stats->searchHits), atomic_load(&stats->searchMisses), atomic_load(&stats->writeFails));
+	p += sprintf(p, "cache.hits %lu\ncache.misses %lu\ncache.invalidations %lu\n", atomic_load(&stats->cacheHits), atomic_load(&stats->cacheMisses), atomic_load(&stats->cacheInvalidations));
+	p += sprintf(p, "requests.slow %lu\n", atomic_load(&stats->slowReqs));
+	for(int i=0; i<TOT_LOCKS; i++){
+		p += sprintf(p, "lock.%s waits=%lu wait_us=%lu max_us=%lu\n", lockNames[i], atomic_load(&stats->lockWaits[i]), atomic_load(&stats->lockWaitNs[i]) / 1000, atomic_load(&stats->lockWaitMaxNs[i]) / 1000);
+	}
+	p += sprintf(p, "logger.depth %lu\nlogger.max_depth %lu\nlogger.dropped %lu\n", atomic_load(&logRing->tail) - atomic_load(&logRing->head), atomic_load(&logRing->maxDepth), atomic_load(&logRing->drops));
+	for(int i=0; i<TOT_REQ-TOKEN_REQ; i++){
+		h = &stats->reqLatency[i];
+		if(!(total = atomic_load(&h->total))) continue;
+		p += sprintf(p, "req.%s count=%lu mean_us=%.1f p50_us=%.1f p90_us=%.1f p99_us=%.1f p999_us=%.1f max_us=%.1f\n", reqTypeNames[i], total, atomic_load(&h->sum) / 1000.0 / total,
+			histPercentile(h, 50) / 1000.0, histPercentile(h, 90) / 1000.0, histPercentile(h, 99) / 1000.0, histPercentile(h, 99.9) / 1000.0, atomic_load(&h->max) / 1000.0);
+	}
+	return p - dest;
+}
+
+
+
+/*
+ *  Resets the latency histograms, the counters (except the connections ones), and the hot keys.
+ *  (the requests counted concurrently can be lost, or counted only partially)
+ */
+
+void resetStats(void){
+	histS *h;
+	for(int i=0; i<TOT_REQ-TOKEN_REQ; i++){
+		h = &stats->reqLatency[i];
+		for(unsigned j=0; j<HIST_BUCKETS; j++) atomic_store_explicit(&h->counts[j], 0, memory_order_relaxed);
+		atomic_store(&h->total, 0);
+		atomic_store(&h->sum, 0);
+		atomic_store(&h->max, 0);
+	}
+	atomic_store(&stats->searchHits, 0);
+	atomic_store(&stats->searchMisses, 0);
+	atomic_store(&stats->writeFails, 0);
+	atomic_store(&stats->slowReqs, 0);
+	atomic_store(&stats->cacheHits, 0);
+	atomic_store(&stats->cacheMisses, 0);
+	atomic_store(&stats->cacheInvalidations, 0);
+	for(int i=0; i<TOT_LOCKS; i++){
+		atomic_store(&stats->lockWaits[i], 0);
+		atomic_store(&stats->lockWaitNs[i], 0);
+		atomic_store(&stats->lockWaitMaxNs[i], 0);
+	}
+	atomic_store(&logRing->maxDepth, 0);
+	resetHotKeys();
+}
+
+
+
+/*
+ *  Resets the span timings of the current thread, before reading a new request.
+ */
+
+void resetPhases(void){
+	memset(phaseNs, 0, sizeof(phaseNs));
+}
+
+
+
+/*
+ *  Starts timing a span of the current request.
+ *  (called by traceBegin(), only if the spans of the request are timed)
+ *
+ *    'span' = the span, the ones of the whole requests are ignored.
+ */
+
+void phaseBegin(unsigned span){
+	if(span<TRACE_REQ) phaseStart[span] = getTimeNs();
+}
+
+
+
+/*
+ *  Adds the time spent in a span, since phaseBegin(), to the timings of the current request.
+ *  (called by traceEnd(), only if the spans of the request are timed)
+ *
+ *    'span' = the span, the ones of the whole requests are ignored.
+ */
+
+void phaseEnd(unsigned span){
+	if(span<TRACE_REQ) phaseNs[span] += getTimeNs() - phaseStart[span];
+}
+
+
+
+/*
+ *  Logs a request that took more than 'slowReqUs' microseconds,
+ *  with the time spent in each of its phases.
+ *  At most SLOW_LOG_MAX_PER_SEC requests are logged every second,
+ *  the other ones are only counted, and reported with the next logged one.
+ *  (the validation phase is all the time not spent in the other phases,
+ *  while the socket read includes the time waiting for the client)
+ *
+ *    'reqType' = the type of the request.
+ *    'key' = the key of the request, or an empty string.
+ *    'addr' = the address of the client.
+ *    'totalNs' = the time from the read of the request to the write of its response.
+ */
+
+void logSlowRequest(char reqType, char *key, struct sockaddr_in *addr, unsigned long totalNs){
+	if(!key || !addr) error("NULL argument");
+	if(totalNs < slowReqUs * 1000UL) return;
+	atomic_fetch_add_explicit(&stats->slowReqs, 1, memory_order_relaxed);
+
+	unsigned long now = getTimeMs() / 1000, second = atomic_load(&stats->slowLogSecond);
+	if(second!=now && atomic_compare_exchange_strong(&stats->slowLogSecond, &second, now)) atomic_store(&stats->slowLogCount, 0);
+	if(atomic_fetch_add(&stats->slowLogCount, 1)>=SLOW_LOG_MAX_PER_SEC){
+		atomic_fetch_add_explicit(&stats->slowLogSkipped, 1, memory_order_relaxed);
+		return;
+	}
+
+	unsigned long other = phaseNs[TRACE_LOCK_WAIT] + phaseNs[TRACE_DB_OP] + phaseNs[TRACE_WAL_HANDOFF] + phaseNs[TRACE_SOCKET_WRITE];
+	unsigned long skipped = atomic_exchange(&stats->slowLogSkipped, 0);
+	msgS msg;
+	msg.type = WARN_MSG;
+	sprintf(msg.txt, "Slow %s of %lu us, from '%s', key '%s': read %lu us, validation %lu us, lock wait %lu us, database %lu us, WAL hand-off %lu us, write %lu us.",
+		reqType>=TOKEN_REQ && reqType<TOT_REQ ? reqTypeNames[reqType-TOKEN_REQ] : "invalid request", totalNs / 1000, inet_ntoa(addr->sin_addr), key,
+		phaseNs[TRACE_SOCKET_READ] / 1000, (totalNs>other ? totalNs - other : 0) / 1000, phaseNs[TRACE_LOCK_WAIT] / 1000, phaseNs[TRACE_DB_OP] / 1000, phaseNs[TRACE_WAL_HANDOFF] / 1000, phaseNs[TRACE_SOCKET_WRITE] / 1000);
+	if(skipped) sprintf(msg.txt + strlen(msg.txt), " (%lu more slow requests not logged)", skipped);
+	logMsg(msg);
+}
+
+
+
+/*
+ *  Prints all the stats, from the server console.
+ */
+
+void printStats(void){
+	char buff[BUFF_SIZE];
+	formatStats(buff);
+	printf("\nServer stats:\n%s\n", buff);
+	fflush(stdout);
+}
@@ -0,0 +1,191 @@
+
+#include "server_headers.h"
+
+
+#ifdef TRACE
+
+traceRingS *traceRings[TRACE_MAX_RINGS];							//the rings of all the threads that traced something, allocated only once
+atomic_int traceRingsUsed[TRACE_MAX_RINGS];							//1 if the ring is owned by a running thread
+__thread traceRingS *traceRing = NULL;								//the ring of the current thread
+__thread int traceNoRing = 0;										//1 if all the rings were busy, when the thread tried to get one
+pthread_key_t traceKey;												//frees the ring of a thread, when it exits
+double traceTicksPerUs = 1000.0;
+unsigned long long traceStartTicks = 0;								//0 until initTrace() is called, only the server process traces
+atomic_ulong traceDrops;
+
+char *traceSpanNames[TRACE_REQ] = {"accept", "login", "socket read", "lock wait", "database operation", "WAL hand-off", "logMsg", "socket write"}; //then the request types
+
+
+
+/*
+ *  Returns the current value of the timestamp counter,
+ *  or the monotonic clock in nanoseconds where there isn't one.
+ */
+
+unsigned long long traceTicks(void){
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (unsigned long long) t.tv_sec * 1000000000 + t.tv_nsec;
+#endif
+}
+
+
+
+/*
+ *  Initializes the tracing, measuring how many ticks of the timestamp counter are in a microsecond.
+ *  (has to be called once, before creating the threads that trace)
+ */
+
+void initTrace(void){
+	struct timespec t1, t2;
+	unsigned long long ticks;
+	if(pthread_key_create(&traceKey, releaseTraceRing)) fatalError("pthread_key_create() failed");
+	if(clock_gettime(CLOCK_MONOTONIC, &t1)==-1) fatalError("clock_gettime() failed");
+	ticks = traceTicks();
+	usleep(20000);
+	if(clock_gettime(CLOCK_MONOTONIC, &t2)==-1) fatalError("clock_gettime() failed");
+	traceTicksPerUs = (traceTicks() - ticks) / ((t2.tv_sec - t1.tv_sec) * 1000000.0 + (t2.tv_nsec - t1.tv_nsec) / 1000.0);
+	traceStartTicks = traceTicks();
+}
+
+
+
+/*
+ *  Gives to the current thread a free ring, allocating it if it's the first time it's used.
+ *
+ *    returns the ring of the thread, or
+ *    returns NULL if all the TRACE_MAX_RINGS rings are used by other threads.
+ */
+
+traceRingS *acquireTraceRing(void){
+	int expected;
+	for(unsigned i=0; i<TRACE_MAX_RINGS; i++){
+		expected = 0;
+		if(!atomic_compare_exchange_strong(&traceRingsUsed[i], &expected, 1)) continue;
+		if(!traceRings[i] && !(traceRings[i] = calloc(1, sizeof(traceRingS)))) fatalError("calloc() failed");
+		traceRing = traceRings[i];
+		traceRing->tid = syscall(SYS_gettid);
+		traceRing->index = i;
+		if(pthread_setspecific(traceKey, traceRing)) fatalError("pthread_setspecific() failed");
+		return traceRing;
+	}
+	traceNoRing = 1;
+	return NULL;
+}
+
+
+
+/*
+ *  Releases the ring of a thread that exited, so that another thread can reuse it.
+ *  (its events are kept, until they are overwritten)
+ *
+ *    'ring' = the ring of the thread.
+ */
+
+void releaseTraceRing(void *ring){
+	atomic_store(&traceRingsUsed[((traceRingS *) ring)->index], 0);
+}
+
+
+
+/*
+ *  Records an event in the ring of the current thread,
+ *  overwriting the oldest one if the ring is full.
+ *  (use the traceBegin() and traceEnd() macros, that are empty without -DTRACE)
+ *
+ *    'span' = the traced span.
+ *    'phase' = TRACE_BEGIN or TRACE_END.
+ */
+
+void traceEvent(unsigned span, unsigned phase){
+	if(span>=TOT_TRACE_SPANS || !traceStartTicks) return;			//the span of an invalid request type, or a process that doesn't trace
+	traceRingS *ring = traceRing;
+	if(!ring){
+		if(traceNoRing || !(ring = acquireTraceRing())){
+			atomic_fetch_add_explicit(&traceDrops, 1, memory_order_relaxed);
+			return;
+		}
+	}
+	unsigned long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	traceEventS *event = &ring->events[head & (TRACE_RING_EVENTS-1)];
+	event->ticks = traceTicks();
+	event->tid = ring->tid;
+	event->span = span;
+	event->phase = phase;
+	atomic_store_explicit(&ring->head, head+1, memory_order_release);
+}
+
+
+
+/*
+ *  Writes all the events still in the rings to a file, in the Chrome trace event format,
+ *  readable by chrome://tracing and Perfetto.
+ *  The rings are read while the other threads keep tracing,
+ *  so the events overwritten during the copy are discarded.
+ *
+ *    'filename' = the name of the file where will be written the trace.
+ *
+ *    returns the number of events written.
+ */
+
+unsigned long dumpTrace(char *filename){
+	if(!filename) error("NULL argument");
+	traceEventS *events;
+	unsigned long n = 0, head, base, start;
+	char buff[BUFF_SIZE];
+	size_t l = 0;
+	off_t off = 0;
+	int fd;
+
+	if(!(events = malloc(TRACE_RING_EVENTS * sizeof(traceEventS)))) error("malloc() failed");
+	if((fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0600))==-1) error("open() failed");
+	l = sprintf(buff, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	for(unsigned i=0; i<TRACE_MAX_RINGS; i++){
+		if(!traceRings[i]) continue;
+		head = atomic_load_explicit(&traceRings[i]->head, memory_order_acquire);
+		base = head>TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0;
+		for(unsigned long j=base; j<head; j++) events[j-base] = traceRings[i]->events[j & (TRACE_RING_EVENTS-1)];
+		atomic_thread_fence(memory_order_acquire);					//the events are copied before 'head' is loaded again
+		start = atomic_load_explicit(&traceRings[i]->head, memory_order_relaxed);
+		start = start - base >= TRACE_RING_EVENTS ? start - TRACE_RING_EVENTS + 1 : base;	//skips the events overwritten while copying, and the one being written
+		for(unsigned long j=start; j<head; j++){
+			traceEventS *e = &events[j-base];
+			if(l + 256 > BUFF_SIZE){
+				pwriteToFile(fd, buff, l, off);
+				off += l;
+				l = 0;
+			}
+			l += sprintf(buff+l, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d}", n?",":"", e->span<TRACE_REQ?traceSpanNames[e->span]:reqTypeNames[e->span-TRACE_REQ], e->phase==TRACE_BEGIN?'B':'E', (long long) (e->ticks - traceStartTicks) / traceTicksPerUs, getpid(), e->tid);
+			n++;
+		}
+	}
+	l += sprintf(buff+l, "\n]}\n");
+	pwriteToFile(fd, buff, l, off);
+	if(close(fd)==-1) error("close() failed");
+	free(events);
+	return n;
+}
+
+
+
+/*
+ *  Dumps the trace, from the server console.
+ */
+
+void printTraceDump(void){
+	unsigned long n = dumpTrace(TRACE_FILENAME);
+	printf("Written %lu trace events to '%s'. (%lu dropped, with more than %d threads)\n", n, TRACE_FILENAME, atomic_load(&traceDrops), TRACE_MAX_RINGS);
+	fflush(stdout);
+}
+
+#else
+
+void printTraceDump(void){
+	printf("Tracing is not enabled. (compile with 'make trace')\n");
+	fflush(stdout);
+}
+
+#endif
@@ -0,0 +1,523 @@
+
+#include "server_headers.h"
+
+
+uint32_t crc32cTable[256];											//lookup table of the CRC32C (Castagnoli) polynomial
+
+int walFd = -1;														//the segment where the logger is appending (only in the logger process)
+unsigned long *walSegs;												//the first sequence numbers of the segments on disk, oldest first
+unsigned long nWalSegs;
+size_t walSegUsed;													//bytes already written in the current segment
+char *walBuff;														//the end of the current segment from the offset 'walBuffOff', aligned to WAL_DIRECT_ALIGN
+size_t walBuffOff, walBuffLen, walBuffMax;
+
+
+
+/*
+ *  Fills the lookup table used by crc32c().
+ *  (has to be called before computing any checksum)
+ */
+
+void initCrc32c(void){
+	uint32_t c;
+	for(uint32_t i=0; i<256; i++){
+		c = i;
+		for(int j=0; j<8; j++) c = c & 1 ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+		crc32cTable[i] = c;
+	}
+}
+
+
+
+/*
+ *  Computes the CRC32C of a buffer, continuing from a previous checksum.
+ *  (uses the SSE4.2 crc32 instruction, if the compiler targets it)
+ *
+ *    'crc' = the checksum of the previous data, or 0 to start a new one.
+ *    'data' = pointer to the buffer.
+ *    'len' = the length of 'data'.
+ *
+ *    returns the updated checksum.
+ */
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t len){
+	const unsigned char *p = data;
+	crc = ~crc;
+#ifdef __SSE4_2__
+	uint64_t word;
+	for(; len>=8; len-=8, p+=8){
+		memcpy(&word, p, 8);
+		crc = (uint32_t) __builtin_ia32_crc32di(crc, word);
+	}
+	for(; len; len--) crc = __builtin_ia32_crc32qi(crc, *p++);
+#else
+	for(; len; len--) crc = crc32cTable[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+#endif
+	return ~crc;
+}
+
+
+
+/*
+ *  Computes the checksum of a WAL record:
+ *  the header after the 'crc' field, followed by the payload.
+ *
+ *    'header' = pointer to the record header.
+ *    'payload' = pointer to the payload, of length header->len.
+ */
+
+uint32_t walRecCrc(walRecHeaderS *header, const char *payload){
+	uint32_t crc = crc32c(0, (char *) header + sizeof(header->crc), sizeof(walRecHeaderS) - sizeof(header->crc));
+	return crc32c(crc, payload, header->len);
+}
+
+
+
+/*
+ *  Writes in 'dest' the path of the WAL segment
+ *  that starts with the sequence number 'firstSeq'.
+ *  (the names sort like the sequence numbers, because they are fixed width hex)
+ *
+ *    'dest' = pointer to a buffer of size BUFF_SIZE.
+ *    'firstSeq' = the sequence number of the first record of the segment.
+ */
+
+void walSegmentPath(char *dest, unsigned long firstSeq){
+	sprintf(dest, "%s%s%016lx%s", WAL_FOLDER, WAL_SEGMENT_PREFIX, firstSeq, WAL_SEGMENT_SUFFIX);
+}
+
+
+
+/*
+ *  Syncs a directory, so that the files created or renamed in it are durable.
+ *
+ *    'path' = the path of the directory.
+ */
+
+void syncDir(char *path){
+	if(!path) fatalError("NULL argument");
+	int fd;
+	if((fd = open(path, O_RDONLY | O_DIRECTORY))==-1) fatalError("open() failed");
+	if(fsync(fd)==-1) fatalError("fsync() failed");
+	if(close(fd)==-1) fatalError("close() failed");
+}
+
+
+
+/*
+ *  Closes the current WAL segment, if any, and starts a new one.
+ *  The oldest segment is recycled, if all of its records are included in the last checkpoint,
+ *  else a new segment is created and preallocated, so that the writes in it
+ *  don't change the size of the file, and can be synced with fdatasync().
+ *  (has to be called only by the logger process)
+ *
+ *    'firstSeq' = the sequence number of the first record that will be written in it.
+ */
+
+void openWalSegment(unsigned long firstSeq){
+	char path[BUFF_SIZE], oldPath[BUFF_SIZE];
+	int flags = O_WRONLY | O_CREAT | (walDirect ? O_DIRECT : 0);
+	walSegHeaderS header;
+	msgS msg;
+
+	if(walFd!=-1 && close(walFd)==-1) fatalError("close() failed");
+	walSegmentPath(path, firstSeq);
+	if(nWalSegs>1 && walSegs[1]-1<=atomic_load(&logRing->checkpointLsn)){ //the old records are skipped by the replay, because of their sequence numbers
+		walSegmentPath(oldPath, walSegs[0]);
+		if(rename(oldPath, path)==-1) fatalError("rename() failed");
+		memmove(walSegs, walSegs+1, (--nWalSegs) * sizeof(unsigned long));
+	}
+	else flags |= O_TRUNC;											//a segment with the same name can contain only records never replayed
+
+	while((walFd = open(path, flags, 0600))==-1){
+		if(!(flags & O_DIRECT) || errno!=EINVAL) fatalError("open() failed");
+		walDirect = 0;												//the file system doesn't support O_DIRECT
+		flags &= ~O_DIRECT;
+		msg.type = WARN_MSG;
+		sprintf(msg.txt, "The WAL can't be written with O_DIRECT on this file system.");
+		logMsg(msg);
+	}
+	if((flags & O_TRUNC) && fallocate(walFd, 0, 0, WAL_SEGMENT_SIZE)==-1 && errno!=EOPNOTSUPP) fatalError("fallocate() failed");
+	if(!nWalSegs || walSegs[nWalSegs-1]!=firstSeq){
+		if(!(walSegs = realloc(walSegs, (nWalSegs+1) * sizeof(unsigned long)))) fatalError("realloc() failed");
+		walSegs[nWalSegs++] = firstSeq;
+	}
+	syncDir(WAL_FOLDER);
+
+	memset(&header, 0, sizeof(walSegHeaderS));						//the header is written together with the first records
+	header.magic = WAL_SEGMENT_MAGIC;
+	header.firstSeq = firstSeq;
+	header.crc = crc32c(0, &header.firstSeq, sizeof(header.firstSeq));
+	walSegUsed = walBuffOff = walBuffLen = 0;
+	growWalBuff(sizeof(walSegHeaderS));
+	memcpy(walBuff, &header, sizeof(walSegHeaderS));
+	walBuffLen = sizeof(walSegHeaderS);
+}
+
+
+
+/*
+ *  Makes room for 'len' more bytes in the WAL buffer,
+ *  plus the padding needed to write it with O_DIRECT.
+ *  (has to be called only by the logger process)
+ *
+ *    'len' = the number of bytes that will be added.
+ */
+
+void growWalBuff(size_t len){
+	if(walBuffLen + len + WAL_DIRECT_ALIGN <= walBuffMax) return;
+	size_t newMax = walBuffMax ? walBuffMax : BUFF_SIZE*16;
+	while(walBuffLen + len + WAL_DIRECT_ALIGN > newMax) newMax <<= 1;
+	char *newBuff;
+	if((errno = posix_memalign((void **) &newBuff, WAL_DIRECT_ALIGN, newMax))) fatalError("posix_memalign() failed");
+	if(walBuffLen) memcpy(newBuff, walBuff, walBuffLen);
+	free(walBuff);
+	walBuff = newBuff;
+	walBuffMax = newMax;
+}
+
+
+
+/*
+ *  Encodes a record at the end of the WAL buffer.
+ *  (has to be called only by the logger process)
+ *
+ *    'seq' = the log sequence number of the record.
+ *    'op' = the type of the record.
+ *    'payload' = the payload of the record.
+ *    'len' = the length of 'payload'.
+ */
+
+void encodeWalRecord(unsigned long seq, unsigned op, char *payload, size_t len){
+	size_t recSize = walRecSize(len);
+	growWalBuff(recSize);
+	walRecHeaderS *header = (walRecHeaderS *) (walBuff + walBuffLen);
+	memset(header, 0, recSize);
+	header->len = len;
+	header->seq = seq;
+	header->op = op;
+	memcpy(walBuff + walBuffLen + sizeof(walRecHeaderS), payload, len);
+	header->crc = walRecCrc(header, payload);
+	walBuffLen += recSize;
+}
+
+
+
+/*
+ *  Adds a record to the WAL.
+ *  If it doesn't fit in the current segment, the segment is closed
+ *  with a WAL_SEG_END_OP record, written and synced, and a new segment is started.
+ *  (has to be called only by the logger process, in order of sequence number)
+ *
+ *    'seq' = the log sequence number of the record.
+ *    'op' = WAL_ADD_OP, WAL_DEL_OP or WAL_TXN_OP.
+ *    'payload' = the record string, the key, or the operations of the transaction.
+ *    'len' = the length of 'payload'.
+ */
+
+void appendWalRecord(unsigned long seq, unsigned op, char *payload, size_t len){
+	if(!payload) fatalError("NULL argument");
+	size_t end = walBuffOff + walBuffLen;
+	if(end + walRecSize(len) + walRecSize(0) > WAL_SEGMENT_SIZE && end > sizeof(walSegHeaderS)){ //keeps room for the end of the segment
+		encodeWalRecord(seq, WAL_SEG_END_OP, "", 0);
+		flushWal();
+		if(fdatasync(walFd)==-1) fatalError("fdatasync() failed");	//the following segments can be synced only if all the previous ones are
+		openWalSegment(seq);										//a record bigger than a segment is written alone in its segment
+	}
+	encodeWalRecord(seq, op, payload, len);
+}
+
+
+
+/*
+ *  Writes to the current segment all the records encoded in the WAL buffer.
+ *  With O_DIRECT, the buffer is written padded to whole blocks,
+ *  and the last partial block is kept, to be written again with the next records.
+ *  (has to be called only by the logger process)
+ */
+
+void flushWal(void){
+	size_t end = walBuffOff + walBuffLen, keep = 0;
+	if(end==walSegUsed) return;
+	if(walDirect){
+		size_t l = (walBuffLen + WAL_DIRECT_ALIGN - 1) & ~((size_t) WAL_DIRECT_ALIGN - 1);
+		memset(walBuff + walBuffLen, 0, l - walBuffLen);			//the zeros after the last record mark the end of the segment
+		pwriteToFile(walFd, walBuff, l, walBuffOff);
+		keep = walBuffLen & (WAL_DIRECT_ALIGN - 1);
+	}
+	else pwriteToFile(walFd, walBuff + (walSegUsed - walBuffOff), end - walSegUsed, walSegUsed);
+	memmove(walBuff, walBuff + walBuffLen - keep, keep);
+	walBuffOff = end - keep;
+	walBuffLen = keep;
+	walSegUsed = end;
+}
+
+
+
+/*
+ *  Writes all the 'len' bytes of 'buff' to a file, at the offset 'offset',
+ *  retrying if the pwrite() is interrupted or partial.
+ *
+ *    'fd' = the file descriptor.
+ *    'buff' = the buffer to write.
+ *    'len' = the length of 'buff'.
+ *    'offset' = the offset in the file.
+ */
+
+void pwriteToFile(int fd, char *buff, size_t len, off_t offset){
+	ssize_t writed;
+	while(len>0){
+		if((writed = pwrite(fd, buff, len, offset))<0){
+			if(errno!=EINTR) fatalError("pwrite() failed");
+			continue;
+		}
+		buff += writed;
+		len -= writed;
+		offset += writed;
+	}
+}
+
+
+
+/*
+ *  Finds all the WAL segments, sorted by sequence number.
+ *
+ *    'seqs' = pointer to where will be saved the allocated array
+ *      of the first sequence numbers of the segments. (to free)
+ *
+ *    returns the number of segments found.
+ */
+
+unsigned long listWalSegments(unsigned long **seqs){
+	if(!seqs) error("NULL argument");
+	DIR *dir;
+	struct dirent *ent;
+	unsigned long n = 0, max = 0, seq;
+	char *end;
+	size_t prefixLen = strlen(WAL_SEGMENT_PREFIX);
+
+	*seqs = NULL;
+	if(!(dir = opendir(WAL_FOLDER))){
+		if(errno==ENOENT) return 0;
+		error("opendir() failed");
+	}
+	while((ent = readdir(dir))){
+		if(strncmp(ent->d_name, WAL_SEGMENT_PREFIX, prefixLen)) continue;
+		seq = strtoul(ent->d_name + prefixLen, &end, 16);
+		if(end!=ent->d_name + prefixLen + 16 || strcmp(end, WAL_SEGMENT_SUFFIX)) continue;
+		if(n==max){
+			max = max ? max<<1 : 16;
+			if(!(*seqs = realloc(*seqs, max * sizeof(unsigned long)))) error("realloc() failed");
+		}
+		(*seqs)[n++] = seq;
+	}
+	if(closedir(dir)==-1) error("closedir() failed");
+	if(n) qsort(*seqs, n, sizeof(unsigned long), compareSeqs);
+	return n;
+}
+
+
+
+/*
+ *  Compares two sequence numbers, for qsort().
+ */
+
+int compareSeqs(const void *a, const void *b){
+	unsigned long x = *(const unsigned long *) a, y = *(const unsigned long *) b;
+	return x<y ? -1 : x>y;
+}
+
+
+
+/*
+ *  Finds the segment that contains the record with sequence number 'seq'.
+ *
+ *    'seqs' = the sorted first sequence numbers of the segments, from listWalSegments().
+ *    'n' = the number of segments in 'seqs'.
+ *    'seq' = the sequence number to seek.
+ *
+ *    returns the index in 'seqs' of the segment, or
+ *    returns 0 if 'seq' is before the first segment.
+ */
+
+unsigned long seekWalSegment(unsigned long *seqs, unsigned long n, unsigned long seq){
+	unsigned long p1 = 0, p2 = n, half;
+	while(p1<p2){													//finds the first segment that starts after 'seq'
+		half = p1 + ((p2 - p1)>>1);
+		if(seqs[half]<=seq) p1 = half + 1;
+		else p2 = half;
+	}
+	return p1 ? p1 - 1 : 0;
+}
+
+
+
+/*
+ *  Applies a WAL record to a dynamic array, and appends its changes to the change feed.
+ *  The added records get the sequence number of the WAL record as version, like when they were written.
+ *  A transaction is applied only if all of its operations are valid.
+ *
+ *    'header' = pointer to the header of the record, already verified.
+ *    'payload' = a modifiable copy of the payload, terminated by '\0'.
+ *    'dynArr' = pointer to a dynamic array.
+ *
+ *    returns 0 if the record has been applied, or
+ *    returns 1 if it's invalid.
+ */
+
+int replayWalRecord(walRecHeaderS *header, char *payload, dArrS *dynArr){
+	if(!header || !payload || !dynArr) error("NULL argument");
+	char *p, *op;
+	recSliceS slice;
+	recS *rec;
+	switch(header->op){
+		case WAL_ADD_OP:
+			if(parseRecordString(payload, MAIN_TYPE, &slice)) return 1;
+			rec = sliceToRecord(&slice);
+			rec->version = header->seq;
+			if(addRecToDynArr(rec, dynArr)) fatalError("Maximum size of dynamic array reached while recovering it.")
+			appendToFeed(FEED_ADD_LINE, payload, header->seq);
+			return 0;
+		case WAL_DEL_OP:
+			if(checkNameString(payload)) return 1;
+			if(!removeRecFromDynArr(payload, dynArr)) appendToFeed(FEED_DEL_LINE, payload, 0);
+			return 0;
+		case WAL_TXN_OP:											//the operations are separated by TXN_OPS_SEPARATOR
+			for(p = payload; *p!='\0'; p++) if(*p==TXN_OPS_SEPARATOR) *p = '\0';
+			for(op = payload; op<payload+header->len; op += strlen(op) + 1) if(checkTxnOpString(op)) return 1;
+			for(op = payload; op<payload+header->len; op += strlen(op) + 1){
+				if(op[0]==TXN_ADD_OP){
+					rec = stringToRecord(op+1);
+					rec->version = header->seq;
+					if(addRecToDynArr(rec, dynArr)) fatalError("Maximum size of dynamic array reached while recovering it.")
+					appendToFeed(FEED_ADD_LINE, op+1, header->seq);
+				}
+				else if(!removeRecFromDynArr(op+1, dynArr)) appendToFeed(FEED_DEL_LINE, op+1, 0);
+			}
+			return 0;
+		default:
+			return 1;
+	}
+}
+
+
+
+/*
+ *  Replays all the WAL segments on a dynamic array, in order of sequence number,
+ *  starting from the first record after 'fromSeq'.
+ *
+ *  Every record is verified with its checksum, and the records of a segment
+ *  end with a WAL_SEG_END_OP record, or with the first one out of sequence
+ *  (the zeros of the preallocation, or an older use of a recycled segment).
+ *  A torn record at the end of the last segment is discarded, and the segment
+ *  is closed there, while a corrupt segment in the middle is skipped,
+ *  reporting the sequence numbers lost.
+ *  At the end, sets 'lastLsn' to the last sequence number found,
+ *  so that the new records continue after it.
+ *  (assumes that no other processes or threads are modifying the files)
+ *
+ *    'dynArr' = pointer to a dynamic array.
+ *    'fromSeq' = the last sequence number already included in 'dynArr'.
+ */
+
+void replayWal(dArrS *dynArr, unsigned long fromSeq){
+	if(!dynArr) error("NULL argument");
+	unsigned long *seqs, nSegs = listWalSegments(&seqs), nRecs = 0, lastSeq = fromSeq, prevSeq, maxSeq = fromSeq;
+	unsigned long long bytes = 0;
+	long long start = getTimeMs();
+	char path[BUFF_SIZE];
+	char *base, *payload = NULL;
+	size_t payloadMax = 0, off, size, recSize;
+	struct stat st;
+	walSegHeaderS *segHeader;
+	walRecHeaderS *header, seal;
+	int fd, torn, sealed;
+
+	for(unsigned long i=seekWalSegment(seqs, nSegs, fromSeq + 1); i<nSegs; i++){
+		walSegmentPath(path, seqs[i]);
+		if((fd = open(path, O_RDWR))==-1) error("open() failed");
+		if(fstat(fd, &st)==-1) error("fstat() failed");
+		size = st.st_size;
+		segHeader = NULL;
+		base = NULL;
+		if(size>=sizeof(walSegHeaderS) && (base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0))==MAP_FAILED) error("mmap() failed");
+		if(base) segHeader = (walSegHeaderS *) base;
+		if(!segHeader || segHeader->magic!=WAL_SEGMENT_MAGIC || segHeader->firstSeq!=seqs[i] || segHeader->crc!=crc32c(0, &segHeader->firstSeq, sizeof(segHeader->firstSeq))){
+			if(i<nSegs-1) printf("Skipped the corrupt WAL segment '%s'.\n", path);
+			if(base && munmap(base, size)==-1) error("munmap() failed");
+			close(fd);
+			continue;
+		}
+		if(seqs[i]>lastSeq+1 && lastSeq>fromSeq) printf("Lost the WAL records from %lu to %lu.\n", lastSeq+1, seqs[i]-1);
+
+		off = sizeof(walSegHeaderS);
+		prevSeq = seqs[i] - 1;
+		torn = sealed = 0;
+		while(off + sizeof(walRecHeaderS)<=size){
+			header = (walRecHeaderS *) (base + off);
+			if(header->seq<=prevSeq || header->len>WAL_MAX_REC_LEN) break;	//the end of the records of this segment
+			recSize = walRecSize(header->len);
+			if(off + recSize>size || header->crc!=walRecCrc(header, base + off + sizeof(walRecHeaderS))){
+				torn = header->seq==prevSeq+1;
+				break;
+			}
+			off += recSize;
+			if(header->op==WAL_SEG_END_OP){
+				sealed = 1;
+				break;
+			}
+			prevSeq = header->seq;
+			if(header->seq<=lastSeq) continue;						//already included in 'dynArr'
+
+			if(header->len + 1 > payloadMax){						//replays a modifiable copy of the payload
+				payloadMax = header->len + 1;
+				if(!(payload = realloc(payload, payloadMax))) error("realloc() failed");
+			}
+			memcpy(payload, (char *) header + sizeof(walRecHeaderS), header->len);
+			payload[header->len] = '\0';
+			if(replayWalRecord(header, payload, dynArr)) printf("Tried recovering an invalid WAL record with sequence number %lu.\n", header->seq);
+			lastSeq = header->seq;
+			nRecs++;
+			bytes += recSize;
+		}
+		if(prevSeq>maxSeq) maxSeq = prevSeq;
+		if(!sealed && i<nSegs-1) printf("Skipped the corrupt WAL segment '%s', from offset %lu.\n", path, off);
+		else if(!sealed){											//closes the last segment, the logger will continue in a new one
+			if(torn) printf("Discarded a torn WAL record at offset %lu of '%s'.\n", off, path);
+			memset(&seal, 0, sizeof(walRecHeaderS));
+			seal.seq = prevSeq + 1;
+			seal.op = WAL_SEG_END_OP;
+			seal.crc = walRecCrc(&seal, "");
+			pwriteToFile(fd, (char *) &seal, sizeof(walRecHeaderS), off);
+			if(fdatasync(fd)==-1) error("fdatasync() failed");
+		}
+		if(munmap(base, size)==-1) error("munmap() failed");
+		close(fd);
+	}
+	if(nSegs && seqs[nSegs-1]-1>maxSeq) maxSeq = seqs[nSegs-1]-1;	//the new records can't reuse the sequence numbers of a skipped segment
+	lastLsn = lastSeq>maxSeq ? lastSeq : maxSeq;
+
+	long long ms = getTimeMs() - start;
+	printf("Replayed %lu WAL records (%llu bytes) from %lu segments in %lld ms", nRecs, bytes, nSegs, ms);
+	if(ms>0) printf(" (%.0f records/s, %.1f MB/s)", nRecs * 1000.0 / ms, bytes / 1000.0 / ms);
+	printf(".\n");
+	free(payload);
+	free(seqs);
+}
+
+
+
+/*
+ *  Removes all the WAL segments,
+ *  after a safe shutdown has exported all of their changes.
+ */
+
+void removeWal(void){
+	unsigned long *seqs, n = listWalSegments(&seqs);
+	char path[BUFF_SIZE];
+	for(unsigned long i=0; i<n; i++){
+		walSegmentPath(path, seqs[i]);
+		if(unlink(path)==-1) fatalError("unlink() failed");
+	}
+	free(seqs);
+}